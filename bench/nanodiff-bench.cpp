@@ -0,0 +1,529 @@
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <chrono>
+#include <expected>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <optional>
+#include <print>
+#include <random>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/resource.h>
+#endif
+
+#include "../nanodiff.h"
+
+using std::literals::operator""sv;
+
+namespace {
+/**
+ * @brief Command-line arguments of the benchmark.
+ */
+struct bench_args {
+  std::size_t size{std::size_t{2} << 20};
+  std::size_t repeat{3};
+  std::size_t jobs{1};
+  std::size_t seed{1};
+  std::vector<std::string> workloads;
+  std::vector<std::string> engines;
+  std::filesystem::path dir{std::filesystem::temp_directory_path() / "nanodiff-bench"};
+};
+
+/**
+ * @brief Contents of the expected and actual files of a workload.
+ */
+struct workload_files {
+  std::string expected;
+  std::string actual;
+};
+
+/**
+ * @brief Deterministic generator of pseudo-random text, so that the same workloads are compared across commits.
+ */
+class text_generator {
+ public:
+  explicit text_generator(std::size_t seed) : _rng{seed} {}
+
+  /**
+   * @brief Returns a uniformly distributed integer in @code [lo, hi] @endcode.
+   */
+  auto uniform(std::size_t lo, std::size_t hi) -> std::size_t {
+    return std::uniform_int_distribution<std::size_t>{lo, hi}(_rng);
+  }
+
+  /**
+   * @brief Appends a line of 3 to 10 lowercase words, similar to the output of a typical program.
+   */
+  void append_line(std::string& output) {
+    const auto words = uniform(3, 10);
+    for (std::size_t i = 0; i < words; ++i) {
+      if (i != 0) {
+        output.push_back(' ');
+      }
+      append_letters(output, uniform(2, 8));
+    }
+    output.push_back('\n');
+  }
+
+  /**
+   * @brief Appends @code count @endcode random lowercase letters.
+   */
+  void append_letters(std::string& output, std::size_t count) {
+    for (std::size_t i = 0; i < count; ++i) {
+      output.push_back(static_cast<char>('a' + uniform(0, 25)));
+    }
+  }
+
+  /**
+   * @brief Returns lines generated by @code append_line @endcode totalling at least @code size @endcode bytes.
+   */
+  auto lines(std::size_t size) -> std::string {
+    std::string output;
+    output.reserve(size + 128);
+    while (output.size() < size) {
+      append_line(output);
+    }
+    return output;
+  }
+
+ private:
+  std::mt19937_64 _rng;
+};
+
+/**
+ * @brief Splits @code text @endcode into its lines, each including its newline.
+ */
+auto split_lines(std::string_view text) -> std::vector<std::string_view> {
+  std::vector<std::string_view> lines;
+  while (!text.empty()) {
+    const auto end = std::min(text.find('\n'), text.size() - 1) + 1;
+    lines.push_back(text.substr(0, end));
+    text.remove_prefix(end);
+  }
+  return lines;
+}
+
+auto make_identical(text_generator& gen, std::size_t size) -> workload_files {
+  auto expected = gen.lines(size);
+  auto actual = expected;
+  return {.expected = std::move(expected), .actual = std::move(actual)};
+}
+
+auto make_single_edit(text_generator& gen, std::size_t size) -> workload_files {
+  auto expected = gen.lines(size);
+
+  // Replace the line containing the middle byte
+  const auto begin = expected.rfind('\n', expected.size() / 2) + 1;
+  const auto end = expected.find('\n', begin) + 1;
+  std::string actual{std::string_view{expected}.substr(0, begin)};
+  gen.append_line(actual);
+  actual += std::string_view{expected}.substr(end);
+  return {.expected = std::move(expected), .actual = std::move(actual)};
+}
+
+auto make_heavy_edits(text_generator& gen, std::size_t size) -> workload_files {
+  auto expected = gen.lines(size);
+
+  // Delete or insert a run of 1 to 4 lines before every 8th line on average
+  std::string actual;
+  actual.reserve(expected.size() + expected.size() / 8);
+  const auto lines = split_lines(expected);
+  for (std::size_t i = 0; i < lines.size(); ++i) {
+    switch (gen.uniform(0, 15)) {
+      case 0:
+        i += gen.uniform(0, 3);
+        continue;
+      case 1:
+        for (auto n = gen.uniform(1, 4); n != 0; --n) {
+          gen.append_line(actual);
+        }
+        break;
+      default:
+        break;
+    }
+    actual += lines[i];
+  }
+  return {.expected = std::move(expected), .actual = std::move(actual)};
+}
+
+auto make_disjoint(text_generator& gen, std::size_t size) -> workload_files {
+  auto expected = gen.lines(size);
+  auto actual = gen.lines(size);
+  return {.expected = std::move(expected), .actual = std::move(actual)};
+}
+
+auto make_long_lines(text_generator& gen, std::size_t size) -> workload_files {
+  std::string expected;
+  expected.reserve(size + (std::size_t{64} << 10));
+  while (expected.size() < size) {
+    gen.append_letters(expected, gen.uniform(std::size_t{16} << 10, std::size_t{64} << 10));
+    expected.push_back('\n');
+  }
+
+  // Change one character of every 16th line
+  std::string actual;
+  actual.reserve(expected.size());
+  const auto lines = split_lines(expected);
+  for (std::size_t i = 0; i < lines.size(); ++i) {
+    const auto begin = actual.size();
+    actual += lines[i];
+    if (i % 16 == 15) {
+      actual[begin + gen.uniform(0, lines[i].size() - 2)] = '_';
+    }
+  }
+  return {.expected = std::move(expected), .actual = std::move(actual)};
+}
+
+auto make_short_lines(text_generator& gen, std::size_t size) -> workload_files {
+  std::string expected;
+  expected.reserve(size + 4);
+  while (expected.size() < size) {
+    for (auto n = gen.uniform(0, 2); n != 0; --n) {
+      expected.push_back(static_cast<char>('a' + gen.uniform(0, 1)));
+    }
+    expected.push_back('\n');
+  }
+
+  // Replace every 64th line, so that most lines are repeated many times in both files
+  std::string actual;
+  actual.reserve(expected.size());
+  const auto lines = split_lines(expected);
+  for (std::size_t i = 0; i < lines.size(); ++i) {
+    actual += i % 64 == 63 ? "c\n"sv : lines[i];
+  }
+  return {.expected = std::move(expected), .actual = std::move(actual)};
+}
+
+struct workload {
+  std::string_view name;
+  workload_files (*generate)(text_generator& gen, std::size_t size);
+};
+
+constexpr std::array workloads{
+    workload{.name = "identical", .generate = make_identical},
+    workload{.name = "single_edit", .generate = make_single_edit},
+    workload{.name = "heavy_edits", .generate = make_heavy_edits},
+    workload{.name = "disjoint", .generate = make_disjoint},
+    workload{.name = "long_lines", .generate = make_long_lines},
+    workload{.name = "short_lines", .generate = make_short_lines},
+};
+
+using engine_fn = std::expected<diff_result, std::string> (*)(const std::filesystem::path& expected,
+                                                              const std::filesystem::path& actual,
+                                                              const diff_options& options,
+                                                              const diff_line_cb& line_callback);
+
+/**
+ * @brief A diff engine exposed by @code nanodiff.h @endcode. New engines should be added to @code engines @endcode.
+ */
+struct engine {
+  std::string_view name;
+  engine_fn run;
+};
+
+constexpr std::array engines{
+    engine{.name = "greedy",
+           .run = [](const std::filesystem::path& expected,
+                     const std::filesystem::path& actual,
+                     const diff_options& options,
+                     const diff_line_cb& line_callback) {
+             return diff_file_stdout(expected, actual, options, line_callback);
+           }},
+    engine{.name = "greedy_eager",
+           .run = [](const std::filesystem::path& expected,
+                     const std::filesystem::path& actual,
+                     const diff_options&,
+                     const diff_line_cb& line_callback) -> std::expected<diff_result, std::string> {
+             const auto has_diff = diff_file_stdout_eager(expected, actual, line_callback);
+             if (!has_diff) {
+               return std::unexpected{has_diff.error()};
+             }
+             return diff_result{.has_diff = *has_diff, .lookahead_exceeded = 0, .budget_exceeded = false};
+           }},
+    engine{.name = "myers",
+           .run = [](const std::filesystem::path& expected,
+                     const std::filesystem::path& actual,
+                     const diff_options& options,
+                     const diff_line_cb& line_callback) {
+             return diff_file_stdout_myers(expected, actual, options, line_callback);
+           }},
+    engine{.name = "patience",
+           .run = [](const std::filesystem::path& expected,
+                     const std::filesystem::path& actual,
+                     const diff_options& options,
+                     const diff_line_cb& line_callback) {
+             auto patience_options = options;
+             patience_options.algorithm = diff_algorithm::patience;
+             return diff_files(expected, actual, patience_options, line_callback);
+           }},
+    engine{.name = "histogram",
+           .run = [](const std::filesystem::path& expected,
+                     const std::filesystem::path& actual,
+                     const diff_options& options,
+                     const diff_line_cb& line_callback) {
+             auto histogram_options = options;
+             histogram_options.algorithm = diff_algorithm::histogram;
+             return diff_files(expected, actual, histogram_options, line_callback);
+           }},
+};
+
+/**
+ * @brief Resets the peak resident set size reported by @code peak_rss @endcode to the current one, where supported.
+ */
+void reset_peak_rss() {
+#if defined(__linux__)
+  std::ofstream{"/proc/self/clear_refs"} << "5";
+#endif
+}
+
+/**
+ * @brief Returns the peak resident set size of this process in bytes, since the last call to @code reset_peak_rss
+ * @endcode on Linux, or since it started elsewhere.
+ */
+auto peak_rss() -> std::optional<std::size_t> {
+#if defined(__linux__)
+  std::ifstream status{"/proc/self/status"};
+  for (std::string line; std::getline(status, line);) {
+    if (line.starts_with("VmHWM:"sv)) {
+      return std::stoull(line.substr(6)) * 1024;
+    }
+  }
+  return std::nullopt;
+#elif defined(__unix__) || defined(__APPLE__)
+  rusage usage{};
+  if (getrusage(RUSAGE_SELF, &usage) != 0) {
+    return std::nullopt;
+  }
+#if defined(__APPLE__)
+  return static_cast<std::size_t>(usage.ru_maxrss);
+#else
+  return static_cast<std::size_t>(usage.ru_maxrss) * 1024;
+#endif
+#else
+  return std::nullopt;
+#endif
+}
+
+/**
+ * @brief Parses a size in bytes, optionally followed by a binary @code K @endcode, @code M @endcode or @code G
+ * @endcode suffix.
+ */
+auto parse_size(const std::string& size_str, std::string_view option) -> std::expected<std::size_t, std::string> {
+  std::size_t size{};
+  const auto* const last = size_str.data() + size_str.size();
+  const auto [ptr, ec] = std::from_chars(size_str.data(), last, size);
+  if (ec != std::errc{} || last - ptr > 1) {
+    return std::unexpected{std::format("Invalid argument for {}: {}", option, size_str)};
+  }
+
+  if (ptr != last) {
+    const auto suffix = std::string_view{"KMG"}.find(*ptr);
+    if (suffix == std::string_view::npos) {
+      return std::unexpected{std::format("Invalid argument for {}: {}", option, size_str)};
+    }
+    size <<= 10 * (suffix + 1);
+  }
+  if (size == 0) {
+    return std::unexpected{std::format("Argument for {} must be a positive integer", option)};
+  }
+
+  return size;
+}
+
+auto parse_cmdline(const std::vector<std::string>& args) -> std::expected<bench_args, std::string> {
+  bench_args bench{};
+
+  for (auto it = std::next(args.cbegin()); it != args.cend(); ++it) {
+    const auto& option = *it;
+    if (++it == args.cend()) {
+      return std::unexpected{std::format("Missing argument for {}", option)};
+    }
+    const auto& value = *it;
+
+    if (option == "--size") {
+      const auto size = parse_size(value, option);
+      if (!size) {
+        return std::unexpected{size.error()};
+      }
+      bench.size = *size;
+    } else if (option == "--repeat" || option == "--jobs" || option == "--seed") {
+      const auto count = parse_size(value, option);
+      if (!count) {
+        return std::unexpected{count.error()};
+      }
+      auto& target = option == "--repeat" ? bench.repeat : option == "--jobs" ? bench.jobs : bench.seed;
+      target = *count;
+    } else if (option == "--workload") {
+      if (std::ranges::find(workloads, value, &workload::name) == workloads.end()) {
+        return std::unexpected{std::format("Unknown workload: {}", value)};
+      }
+      bench.workloads.push_back(value);
+    } else if (option == "--engine") {
+      if (std::ranges::find(engines, value, &engine::name) == engines.end()) {
+        return std::unexpected{std::format("Unknown engine: {}", value)};
+      }
+      bench.engines.push_back(value);
+    } else if (option == "--dir") {
+      bench.dir = value;
+    } else {
+      return std::unexpected{std::format("Unknown option: {}", option)};
+    }
+  }
+
+  return bench;
+}
+
+/**
+ * @brief Returns whether @code name @endcode was selected, where no selection selects everything.
+ */
+auto is_selected(const std::vector<std::string>& selection, std::string_view name) -> bool {
+  return selection.empty() || std::ranges::find(selection, name) != selection.end();
+}
+
+auto write_file(const std::filesystem::path& path, std::string_view contents) -> std::expected<void, std::string> {
+  std::ofstream file{path, std::ios::binary};
+  file.write(contents.data(), static_cast<std::streamsize>(contents.size()));
+  if (!file.flush()) {
+    return std::unexpected{std::format("Failed to write {}", path.string())};
+  }
+  return {};
+}
+
+/**
+ * @brief Runs @code engine @endcode on the given files @code repeat @endcode times, and prints one JSON record with
+ * the fastest and median time, the throughput derived from the fastest time, and the peak resident set size.
+ */
+auto run_engine(const bench_args& bench,
+                const engine& engine,
+                std::string_view workload_name,
+                const std::filesystem::path& expected,
+                const std::filesystem::path& actual,
+                std::size_t bytes,
+                std::size_t lines) -> std::expected<void, std::string> {
+  const diff_options options{.threads = bench.jobs};
+
+  std::vector<double> seconds;
+  std::size_t diff_lines{};
+  bool has_diff{};
+  reset_peak_rss();
+  for (std::size_t i = 0; i < bench.repeat; ++i) {
+    diff_lines = 0;
+    const auto start = std::chrono::steady_clock::now();
+    const auto result = engine.run(expected, actual, options, [&diff_lines](const diff_line& line) {
+      if (line.type != diff_line_type::context) {
+        ++diff_lines;
+      }
+    });
+    seconds.push_back(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+    if (!result) {
+      return std::unexpected{result.error()};
+    }
+    has_diff = result->has_diff;
+  }
+  const auto rss = peak_rss();
+
+  std::ranges::sort(seconds);
+  const auto fastest = seconds.front();
+  std::print(R"({{"workload":"{}","engine":"{}","bytes":{},"lines":{},"diff_lines":{},"has_diff":{},)"
+             R"("jobs":{},"repeat":{},"seconds_min":{:.6f},"seconds_median":{:.6f},"mb_per_s":{:.2f},)"
+             R"("lines_per_s":{:.0f},"peak_rss_bytes":{}}})"
+             "\n",
+             workload_name,
+             engine.name,
+             bytes,
+             lines,
+             diff_lines,
+             has_diff,
+             bench.jobs,
+             bench.repeat,
+             fastest,
+             seconds[seconds.size() / 2],
+             static_cast<double>(bytes) / 1e6 / fastest,
+             static_cast<double>(lines) / fastest,
+             rss ? std::to_string(*rss) : "null");
+  std::fflush(stdout);
+  return {};
+}
+
+/**
+ * @brief Generates @code workload @endcode into the benchmark directory, and runs every selected engine on it.
+ */
+auto run_workload(const bench_args& bench, const workload& workload) -> std::expected<void, std::string> {
+  const auto expected = bench.dir / std::format("{}-expected.txt", workload.name);
+  const auto actual = bench.dir / std::format("{}-actual.txt", workload.name);
+
+  std::size_t bytes{};
+  std::size_t lines{};
+  {
+    text_generator gen{bench.seed};
+    const auto files = workload.generate(gen, bench.size);
+    bytes = files.expected.size() + files.actual.size();
+    lines = static_cast<std::size_t>(std::ranges::count(files.expected, '\n') + std::ranges::count(files.actual, '\n'));
+    if (auto written = write_file(expected, files.expected); !written) {
+      return written;
+    }
+    if (auto written = write_file(actual, files.actual); !written) {
+      return written;
+    }
+  }
+
+  std::expected<void, std::string> result{};
+  for (const auto& engine : engines) {
+    if (is_selected(bench.engines, engine.name)) {
+      result = run_engine(bench, engine, workload.name, expected, actual, bytes, lines);
+      if (!result) {
+        break;
+      }
+    }
+  }
+
+  std::error_code ec;
+  std::filesystem::remove(expected, ec);
+  std::filesystem::remove(actual, ec);
+  return result;
+}
+}  // namespace
+
+/**
+ * @brief Benchmarks every diff engine on synthetic workloads, printing one JSON record per workload and engine.
+ *
+ * @code
+ * nanodiff-bench [--size <bytes>[K|M|G]] [--repeat <n>] [--jobs <n>] [--seed <n>] [--workload <name>]...
+ *                [--engine <name>]... [--dir <path>]
+ * @endcode
+ */
+auto main(int argc, char** argv) -> int {
+  const auto bench_or_err = parse_cmdline(std::vector<std::string>{argv, argv + argc});
+  if (!bench_or_err) {
+    std::print(stderr, "Error while parsing command-line arguments: {}\n", bench_or_err.error());
+    return EXIT_FAILURE;
+  }
+  const auto& bench = *bench_or_err;
+
+  std::error_code ec;
+  std::filesystem::create_directories(bench.dir, ec);
+  if (ec) {
+    std::print(stderr, "Failed to create {}: {}\n", bench.dir.string(), ec.message());
+    return EXIT_FAILURE;
+  }
+
+  for (const auto& workload : workloads) {
+    if (!is_selected(bench.workloads, workload.name)) {
+      continue;
+    }
+    if (const auto result = run_workload(bench, workload); !result) {
+      std::print(stderr, "{}: {}\n", workload.name, result.error());
+      return EXIT_FAILURE;
+    }
+  }
+}
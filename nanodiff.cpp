@@ -1,63 +1,125 @@
 #include <cassert>
+#include <cerrno>
+#include <cmath>
+#include <cstddef>
 #include <cstdint>
+#include <cstdio>
 #include <cstdlib>
+#include <cstring>
 
 #include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <charconv>
+#include <chrono>
+#include <concepts>
+#include <deque>
 #include <expected>
 #include <filesystem>
 #include <fstream>
 #include <functional>
+#include <initializer_list>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <memory>
+#include <new>
 #include <optional>
 #include <print>
 #include <ranges>
+#include <span>
 #include <string>
 #include <string_view>
+#include <thread>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <variant>
 #include <vector>
 
-#ifdef NANODIFF_TEST
+#if defined(__unix__) || defined(__APPLE__)
+#define NANODIFF_HAS_POSIX
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <spawn.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern char** environ;
+#endif
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__SSE2__) && (defined(__GNUC__) || defined(__clang__))
+#define NANODIFF_HAS_X86_SIMD
+#include <immintrin.h>
+#endif
+
 #include "nanodiff.h"
-#else
 
 namespace {
 /**
- * @brief Command line arguments structure for the diff tool.
+ * @brief Enum representing the format in which the diff is output.
  */
-struct command_line_args {
-  std::optional<std::string> expected{std::nullopt};
-  std::optional<std::string> actual{std::nullopt};
-  // TODO(Derppening): Add option for hiding expected/actual file paths
-  // TODO(Derppening): Add option for showing/hiding all context lines
-  int exit_code{EXIT_FAILURE};
-  // TODO(Derppening): Add diff options supported by ZINC
-  // TODO(Derppening): Add option for treating missing file as empty
+enum struct output_format : std::uint8_t {
+  text,
+  ndjson,
 };
 
 /**
- * @brief Enum representing the type of a diff line.
+ * @brief Enum representing the format in which the statistics of a comparison are output.
  */
-enum struct diff_line_type : std::uint8_t {
-  context,
-  expected_only,
-  actual_only,
+enum struct stats_format : std::uint8_t {
+  text,
+  json,
 };
 
 /**
- * @brief Structure representing a line in the diff output.
+ * @brief Command line arguments structure for the diff tool.
  */
-struct diff_line {
-  std::string_view line;
-  diff_line_type type;
+struct command_line_args {
+  std::optional<std::string> expected{std::nullopt};
+  std::optional<std::string> actual{std::nullopt};
+  // TODO(Derppening): Add option for hiding expected/actual file paths
+  int exit_code{EXIT_FAILURE};
+  diff_algorithm algorithm{diff_algorithm::greedy};
+  std::optional<std::size_t> max_lookahead_lines{std::nullopt};
+  std::optional<std::size_t> max_lookahead_bytes{std::nullopt};
+  // Limits on the search for a minimal diff, after which the greedy algorithm is used
+  std::optional<std::size_t> max_cost{std::nullopt};
+  std::optional<std::size_t> timeout_ms{std::nullopt};
+  bool first{};
+  bool quiet{};
+  // Paths to the actual outputs (or directories thereof) compared against `expected` in batch mode
+  std::optional<std::vector<std::string>> batch_actuals{std::nullopt};
+  std::optional<std::string> manifest{std::nullopt};
+  std::optional<std::size_t> jobs{std::nullopt};
+  std::optional<std::size_t> read_ahead{std::nullopt};
+  // Command whose standard output is compared against `expected` as it runs
+  std::optional<std::vector<std::string>> run_command{std::nullopt};
+  std::optional<std::size_t> max_output_bytes{std::nullopt};
+  // Whether a command exiting with a non-zero status or due to a signal still succeeds if its output matches
+  bool ignore_exit_status{};
+  bool ignore_trailing_space{};
+  bool ignore_all_space{};
+  bool ignore_case{};
+  bool ignore_blank_lines{};
+  std::optional<double> abs_tolerance{std::nullopt};
+  std::optional<double> rel_tolerance{std::nullopt};
+  // Number of context lines around each change in unified output
+  std::optional<std::size_t> unified{std::nullopt};
+  output_format format{output_format::text};
+  // Format in which the statistics of each comparison are output to stderr, if at all
+  std::optional<stats_format> stats{std::nullopt};
+  // Whether the line index of each expected file is cached in an index file, and the directory holding these files
+  bool index{};
+  std::optional<std::string> index_dir{std::nullopt};
+  // TODO(Derppening): Add option for treating missing file as empty
 };
 
-/**
- * @brief Callback type for processing diff lines.
- */
-using diff_line_cb = std::function<void(const diff_line& line)>;
-}  // namespace
-
-#endif  // NANODIFF_TEST
-
-namespace {
 /**
  * @brief Result type for command line argument parsing.
  */
@@ -75,9 +137,31 @@ auto validate_args(const command_line_args& args) -> arg_parse_result;
 
 /**
  * @brief Validates that the given path exists, and converts it into a canonical, absolute path.
+ *
+ * Paths to inputs which are not regular files, such as pipes and FIFOs, are returned as is, and @code stdin_path
+ * @endcode stands for the standard input.
  */
 auto normalize_path(const std::string& path_str) -> std::expected<std::filesystem::path, std::string>;
 
+/**
+ * @brief Path which is read from the standard input.
+ */
+constexpr std::string_view stdin_path = "-";
+
+/**
+ * @brief Whether the statistics of each comparison can be collected, which requires building with @code
+ * NANODIFF_STATS @endcode. Otherwise, all code collecting them is discarded at compile time.
+ */
+#ifdef NANODIFF_STATS
+constexpr bool stats_enabled = true;
+
+// Number and total size of the allocations made by each thread
+thread_local std::size_t thread_allocations{};
+thread_local std::size_t thread_allocated_bytes{};
+#else
+constexpr bool stats_enabled = false;
+#endif  // NANODIFF_STATS
+
 auto parse_ec(const std::optional<std::string>& exit_code_opt) -> std::expected<int, std::string> {
   if (!exit_code_opt) {
     return std::unexpected{"Missing argument for --exit-code"};
@@ -97,6 +181,98 @@ auto parse_ec(const std::optional<std::string>& exit_code_opt) -> std::expected<
   return exit_code;
 }
 
+auto parse_algorithm(const std::optional<std::string>& algorithm_opt) -> std::expected<diff_algorithm, std::string> {
+  if (!algorithm_opt) {
+    return std::unexpected{"Missing argument for --algorithm"};
+  }
+
+  if (*algorithm_opt == "greedy") {
+    return diff_algorithm::greedy;
+  }
+  if (*algorithm_opt == "myers") {
+    return diff_algorithm::myers;
+  }
+  if (*algorithm_opt == "patience") {
+    return diff_algorithm::patience;
+  }
+  if (*algorithm_opt == "histogram") {
+    return diff_algorithm::histogram;
+  }
+
+  return std::unexpected{std::format("Unknown diff algorithm: {}", *algorithm_opt)};
+}
+
+auto parse_format(const std::optional<std::string>& format_opt) -> std::expected<output_format, std::string> {
+  if (!format_opt) {
+    return std::unexpected{"Missing argument for --format"};
+  }
+
+  if (*format_opt == "text") {
+    return output_format::text;
+  }
+  if (*format_opt == "ndjson") {
+    return output_format::ndjson;
+  }
+
+  return std::unexpected{std::format("Unknown output format: {}", *format_opt)};
+}
+
+auto parse_stats_format(std::string_view format) -> std::expected<stats_format, std::string> {
+  if (format == "text") {
+    return stats_format::text;
+  }
+  if (format == "json") {
+    return stats_format::json;
+  }
+
+  return std::unexpected{std::format("Unknown statistics format: {}", format)};
+}
+
+auto parse_count(const std::optional<std::string>& count_opt, std::string_view option)
+    -> std::expected<std::size_t, std::string> {
+  if (!count_opt) {
+    return std::unexpected{std::format("Missing argument for {}", option)};
+  }
+
+  std::size_t count{};
+  const auto* const last = count_opt->data() + count_opt->size();
+  if (const auto [ptr, ec] = std::from_chars(count_opt->data(), last, count); ec != std::errc{} || ptr != last) {
+    return std::unexpected{std::format("Invalid argument for {}: {}", option, *count_opt)};
+  }
+
+  return count;
+}
+
+auto parse_size(const std::optional<std::string>& size_opt, std::string_view option)
+    -> std::expected<std::size_t, std::string> {
+  const auto size = parse_count(size_opt, option);
+  if (size && *size == 0) {
+    return std::unexpected{std::format("Argument for {} must be a positive integer", option)};
+  }
+
+  return size;
+}
+
+auto parse_tolerance(const std::optional<std::string>& tolerance_opt, std::string_view option)
+    -> std::expected<double, std::string> {
+  if (!tolerance_opt) {
+    return std::unexpected{std::format("Missing argument for {}", option)};
+  }
+
+  double tolerance{};
+  const auto* const last = tolerance_opt->data() + tolerance_opt->size();
+  if (const auto [ptr, ec] = std::from_chars(tolerance_opt->data(), last, tolerance);
+      ec != std::errc{} || ptr != last) {
+    return std::unexpected{std::format("Invalid argument for {}: {}", option, *tolerance_opt)};
+  }
+
+  if (!std::isfinite(tolerance) || tolerance < 0) {
+    return std::unexpected{std::format("Argument for {} must be a non-negative number", option)};
+  }
+
+  return tolerance;
+}
+
 auto parse_cmdline(const std::vector<std::string>& args) -> arg_parse_result {
   command_line_args cmd_args{};
 
@@ -104,7 +280,7 @@ auto parse_cmdline(const std::vector<std::string>& args) -> arg_parse_result {
 
   for (auto it = args.cbegin(); it != args.cend(); ++it) {
     // "--" delimits between options and filenames
-    if (*it == "--") {
+    if (parse_options && *it == "--") {
       parse_options = false;
       continue;
     }
@@ -127,12 +303,183 @@ auto parse_cmdline(const std::vector<std::string>& args) -> arg_parse_result {
         }
 
         cmd_args.exit_code = *ec_or_err;
+      } else if (*it == "--algorithm") {
+        ++it;
+
+        std::optional<std::string> algorithm;
+        if (it == args.cend()) {
+          algorithm = std::nullopt;
+        } else {
+          algorithm = std::make_optional(*it);
+        }
+
+        const auto algorithm_or_err = parse_algorithm(algorithm);
+        if (!algorithm_or_err) {
+          return std::unexpected{algorithm_or_err.error()};
+        }
+
+        cmd_args.algorithm = *algorithm_or_err;
+      } else if (*it == "--batch") {
+        cmd_args.batch_actuals = std::make_optional<std::vector<std::string>>();
+      } else if (*it == "--manifest") {
+        ++it;
+
+        if (it == args.cend()) {
+          return std::unexpected{"Missing argument for --manifest"};
+        }
+
+        cmd_args.manifest = std::make_optional(*it);
+      } else if (*it == "--index") {
+        cmd_args.index = true;
+      } else if (*it == "--index-dir") {
+        ++it;
+
+        if (it == args.cend()) {
+          return std::unexpected{"Missing argument for --index-dir"};
+        }
+
+        cmd_args.index = true;
+        cmd_args.index_dir = std::make_optional(*it);
+      } else if (*it == "--run") {
+        cmd_args.run_command = std::make_optional<std::vector<std::string>>();
+      } else if (*it == "--ignore-exit-status") {
+        cmd_args.ignore_exit_status = true;
+      } else if (*it == "--first") {
+        cmd_args.first = true;
+      } else if (*it == "-q" || *it == "--quiet") {
+        cmd_args.quiet = true;
+      } else if (*it == "-Z" || *it == "--ignore-trailing-space") {
+        cmd_args.ignore_trailing_space = true;
+      } else if (*it == "-w" || *it == "--ignore-all-space") {
+        cmd_args.ignore_all_space = true;
+      } else if (*it == "-i" || *it == "--ignore-case") {
+        cmd_args.ignore_case = true;
+      } else if (*it == "-B" || *it == "--ignore-blank-lines") {
+        cmd_args.ignore_blank_lines = true;
+      } else if (*it == "--format" || it->starts_with("--format=")) {
+        std::optional<std::string> format;
+        if (it->starts_with("--format=")) {
+          format = std::make_optional(it->substr(std::string_view{"--format="}.size()));
+        } else if (++it == args.cend()) {
+          format = std::nullopt;
+        } else {
+          format = std::make_optional(*it);
+        }
+
+        const auto format_or_err = parse_format(format);
+        if (!format_or_err) {
+          return std::unexpected{format_or_err.error()};
+        }
+
+        cmd_args.format = *format_or_err;
+      } else if (*it == "--stats" || it->starts_with("--stats=")) {
+        // The format can only be given after `=`, so that `--stats` can be directly followed by other arguments
+        std::expected<stats_format, std::string> format_or_err{stats_format::text};
+        if (it->starts_with("--stats=")) {
+          format_or_err = parse_stats_format(std::string_view{*it}.substr(std::string_view{"--stats="}.size()));
+        }
+        if (!format_or_err) {
+          return std::unexpected{format_or_err.error()};
+        }
+
+        cmd_args.stats = *format_or_err;
+      } else if (*it == "-U" || *it == "--unified") {
+        const auto option = *it;
+        ++it;
+
+        std::optional<std::string> context;
+        if (it == args.cend()) {
+          context = std::nullopt;
+        } else {
+          context = std::make_optional(*it);
+        }
+
+        const auto context_or_err = parse_count(context, option);
+        if (!context_or_err) {
+          return std::unexpected{context_or_err.error()};
+        }
+
+        cmd_args.unified = *context_or_err;
+      } else if (*it == "--max-cost" || *it == "--timeout-ms") {
+        const auto option = *it;
+        ++it;
+
+        std::optional<std::string> limit;
+        if (it == args.cend()) {
+          limit = std::nullopt;
+        } else {
+          limit = std::make_optional(*it);
+        }
+
+        const auto limit_or_err = parse_count(limit, option);
+        if (!limit_or_err) {
+          return std::unexpected{limit_or_err.error()};
+        }
+
+        if (option == "--max-cost") {
+          cmd_args.max_cost = *limit_or_err;
+        } else {
+          cmd_args.timeout_ms = *limit_or_err;
+        }
+      } else if (*it == "--abs-tol" || *it == "--rel-tol") {
+        const auto option = *it;
+        ++it;
+
+        std::optional<std::string> tolerance;
+        if (it == args.cend()) {
+          tolerance = std::nullopt;
+        } else {
+          tolerance = std::make_optional(*it);
+        }
+
+        const auto tolerance_or_err = parse_tolerance(tolerance, option);
+        if (!tolerance_or_err) {
+          return std::unexpected{tolerance_or_err.error()};
+        }
+
+        if (option == "--abs-tol") {
+          cmd_args.abs_tolerance = *tolerance_or_err;
+        } else {
+          cmd_args.rel_tolerance = *tolerance_or_err;
+        }
+      } else if (*it == "--max-lookahead-lines" || *it == "--max-lookahead-bytes" || *it == "--jobs" ||
+                 *it == "--read-ahead" || *it == "--max-output-bytes") {
+        const auto option = *it;
+        ++it;
+
+        std::optional<std::string> size;
+        if (it == args.cend()) {
+          size = std::nullopt;
+        } else {
+          size = std::make_optional(*it);
+        }
+
+        const auto size_or_err = parse_size(size, option);
+        if (!size_or_err) {
+          return std::unexpected{size_or_err.error()};
+        }
+
+        if (option == "--max-lookahead-lines") {
+          cmd_args.max_lookahead_lines = *size_or_err;
+        } else if (option == "--max-lookahead-bytes") {
+          cmd_args.max_lookahead_bytes = *size_or_err;
+        } else if (option == "--jobs") {
+          cmd_args.jobs = *size_or_err;
+        } else if (option == "--read-ahead") {
+          cmd_args.read_ahead = *size_or_err;
+        } else {
+          cmd_args.max_output_bytes = *size_or_err;
+        }
       } else if (it->starts_with('-')) {
         return std::unexpected{std::format("Unknown option: {}", *it)};
       }
     } else {
-      if (!cmd_args.expected) {
+      if (cmd_args.run_command) {
+        cmd_args.run_command->push_back(*it);
+      } else if (!cmd_args.expected) {
         cmd_args.expected = std::make_optional(*it);
+      } else if (cmd_args.batch_actuals) {
+        cmd_args.batch_actuals->push_back(*it);
       } else if (!cmd_args.actual) {
         cmd_args.actual = std::make_optional(*it);
       } else {
@@ -141,15 +488,82 @@ auto parse_cmdline(const std::vector<std::string>& args) -> arg_parse_result {
     }
   }
 
+  // The expected output follows the command to run
+  if (cmd_args.run_command && !cmd_args.run_command->empty()) {
+    cmd_args.expected = std::make_optional(std::move(cmd_args.run_command->back()));
+    cmd_args.run_command->pop_back();
+  }
+
   return validate_args(cmd_args);
 }
 
 auto validate_args(const command_line_args& args) -> arg_parse_result {
-  if (!args.expected) {
-    return std::unexpected{"Missing argument for path to expected output"};
+  if (args.run_command) {
+#ifdef NANODIFF_HAS_POSIX
+    if (args.batch_actuals || args.manifest) {
+      return std::unexpected{"--run cannot be used with --batch or --manifest"};
+    }
+    if (!args.expected) {
+      return std::unexpected{"Missing argument for path to expected output"};
+    }
+    if (args.run_command->empty()) {
+      return std::unexpected{"Missing argument for command to run"};
+    }
+#else
+    return std::unexpected{"--run is not supported on this platform"};
+#endif  // NANODIFF_HAS_POSIX
+  } else if (args.max_output_bytes) {
+    return std::unexpected{"--max-output-bytes is only supported with --run"};
+  } else if (args.ignore_exit_status) {
+    return std::unexpected{"--ignore-exit-status is only supported with --run"};
+  } else if (args.manifest) {
+    if (args.batch_actuals) {
+      return std::unexpected{"--batch and --manifest cannot be used together"};
+    }
+    if (args.expected) {
+      return std::unexpected{"Paths to expected and actual outputs are read from the manifest"};
+    }
+  } else {
+    if (!args.expected) {
+      return std::unexpected{"Missing argument for path to expected output"};
+    }
+    if (args.batch_actuals ? args.batch_actuals->empty() : !args.actual) {
+      return std::unexpected{"Missing argument for path to actual output"};
+    }
+  }
+  auto stdin_inputs =
+      std::ranges::count(std::array{args.expected, args.actual}, std::optional{std::string{stdin_path}});
+  if (args.batch_actuals) {
+    stdin_inputs += std::ranges::count(*args.batch_actuals, stdin_path);
+  }
+  if (stdin_inputs > 1) {
+    return std::unexpected{"Standard input can only be read once"};
+  }
+  if ((args.max_lookahead_lines || args.max_lookahead_bytes) && args.algorithm != diff_algorithm::greedy) {
+    return std::unexpected{"--max-lookahead-lines and --max-lookahead-bytes are only supported by the greedy algorithm"};
   }
-  if (!args.actual) {
-    return std::unexpected{"Missing argument for path to actual output"};
+  if ((args.max_cost || args.timeout_ms) && args.algorithm == diff_algorithm::greedy) {
+    return std::unexpected{"--max-cost and --timeout-ms are not supported by the greedy algorithm"};
+  }
+  // Skipped lines are never output, so the lines of the diff could not be numbered
+  if (args.unified && args.ignore_blank_lines) {
+    return std::unexpected{"--unified cannot be used with --ignore-blank-lines"};
+  }
+  if (args.format == output_format::ndjson && args.ignore_blank_lines) {
+    return std::unexpected{"--format ndjson cannot be used with --ignore-blank-lines"};
+  }
+  if (args.stats && !stats_enabled) {
+    return std::unexpected{"--stats requires nanodiff to be built with NANODIFF_STATS"};
+  }
+  if (args.index) {
+#ifdef NANODIFF_HAS_POSIX
+    // Files read ahead on a separate thread are never in memory as a whole
+    if (args.read_ahead) {
+      return std::unexpected{"--index cannot be used with --read-ahead"};
+    }
+#else
+    return std::unexpected{"--index is not supported on this platform"};
+#endif  // NANODIFF_HAS_POSIX
   }
 
   return args;
@@ -158,219 +572,5136 @@ auto validate_args(const command_line_args& args) -> arg_parse_result {
 auto normalize_path(const std::string& path_str) -> std::expected<std::filesystem::path, std::string> {
   std::filesystem::path path{path_str};
 
+  if (path_str == stdin_path) {
+    return path;
+  }
+
   if (!std::filesystem::exists(path)) {
     return std::unexpected{std::format("'{}': File not found", path_str)};
   }
 
-  if (!std::filesystem::is_regular_file(path)) {
+  if (std::filesystem::is_directory(path)) {
     return std::unexpected{std::format("'{}': Not a file", path_str)};
   }
 
+  // Pipes are only ever read from the front, and may not have a canonical path (e.g. /dev/fd/N)
+  if (!std::filesystem::is_regular_file(path)) {
+    return path;
+  }
+
   return std::filesystem::canonical(path);
 }
 }  // namespace
 
-#ifndef NANODIFF_TEST
-namespace {
+#ifdef NANODIFF_STATS
+// Allocations are counted by replacing the global allocation functions, including the over-aligned ones. Every variant
+// which the standard library implements in terms of others is replaced too, so that allocations and deallocations
+// always match.
+auto operator new(std::size_t size) -> void* {
+  ++thread_allocations;
+  thread_allocated_bytes += size;
+  if (void* ptr = std::malloc(size == 0 ? 1 : size)) {
+    return ptr;
+  }
+  throw std::bad_alloc{};
+}
+auto operator new[](std::size_t size) -> void* { return ::operator new(size); }
+auto operator new(std::size_t size, const std::nothrow_t&) noexcept -> void* {
+  try {
+    return ::operator new(size);
+  } catch (const std::bad_alloc&) {
+    return nullptr;
+  }
+}
+auto operator new[](std::size_t size, const std::nothrow_t&) noexcept -> void* {
+  return ::operator new(size, std::nothrow);
+}
+auto operator new(std::size_t size, std::align_val_t alignment) -> void* {
+  ++thread_allocations;
+  thread_allocated_bytes += size;
+  // `std::aligned_alloc` requires the size to be a multiple of the alignment
+  const auto align = static_cast<std::size_t>(alignment);
+  if (void* ptr = std::aligned_alloc(align, (std::max<std::size_t>(size, 1) + align - 1) / align * align)) {
+    return ptr;
+  }
+  throw std::bad_alloc{};
+}
+auto operator new[](std::size_t size, std::align_val_t alignment) -> void* { return ::operator new(size, alignment); }
+auto operator new(std::size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept -> void* {
+  try {
+    return ::operator new(size, alignment);
+  } catch (const std::bad_alloc&) {
+    return nullptr;
+  }
+}
+auto operator new[](std::size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept -> void* {
+  return ::operator new(size, alignment, std::nothrow);
+}
+// GCC does not know that the replaced `operator new` allocates with `std::malloc`
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
 #endif
+void operator delete(void* ptr) noexcept { std::free(ptr); }
+void operator delete[](void* ptr) noexcept { std::free(ptr); }
+void operator delete(void* ptr, std::size_t) noexcept { std::free(ptr); }
+void operator delete[](void* ptr, std::size_t) noexcept { std::free(ptr); }
+void operator delete(void* ptr, const std::nothrow_t&) noexcept { std::free(ptr); }
+void operator delete[](void* ptr, const std::nothrow_t&) noexcept { std::free(ptr); }
+void operator delete(void* ptr, std::align_val_t) noexcept { std::free(ptr); }
+void operator delete[](void* ptr, std::align_val_t) noexcept { std::free(ptr); }
+void operator delete(void* ptr, std::size_t, std::align_val_t) noexcept { std::free(ptr); }
+void operator delete[](void* ptr, std::size_t, std::align_val_t) noexcept { std::free(ptr); }
+void operator delete(void* ptr, std::align_val_t, const std::nothrow_t&) noexcept { std::free(ptr); }
+void operator delete[](void* ptr, std::align_val_t, const std::nothrow_t&) noexcept { std::free(ptr); }
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+#endif  // NANODIFF_STATS
 
-class file_differ {
- public:
-  file_differ() = default;
-  file_differ(const file_differ&) = default;
-  file_differ(file_differ&&) noexcept = default;
-
-  virtual ~file_differ() = default;
-
-  auto operator=(const file_differ&) -> file_differ& = default;
-  auto operator=(file_differ&&) noexcept -> file_differ& = default;
+namespace {
 
-  virtual auto do_diff(const diff_line_cb& line_callback) -> bool {
-    bool has_diff{};
+/**
+ * @brief Table of kernels used to split and compare lines.
+ *
+ * The implementation is selected once at startup based on the instruction sets supported by the CPU.
+ */
+struct text_kernels {
+  /**
+   * @brief Returns a pointer to the first newline character in @code [first, last) @endcode, or @code last @endcode if
+   * there are none.
+   */
+  auto (*find_newline)(const char* first, const char* last) -> const char*;
+  /**
+   * @brief Returns whether the first @code size @endcode bytes of @code lhs @endcode and @code rhs @endcode are equal.
+   */
+  auto (*equal)(const char* lhs, const char* rhs, std::size_t size) -> bool;
+};
 
-    // `+`
-    std::vector<std::string> only_actual{};
+/**
+ * @brief Compares two buffers of at most 16 bytes using overlapping scalar loads.
+ */
+inline auto equal_small(const char* lhs, const char* rhs, std::size_t size) -> bool {
+  auto load_equal = [lhs, rhs]<typename T>(std::size_t offset, T /*tag*/) {
+    T lhs_word{};
+    T rhs_word{};
+    std::memcpy(&lhs_word, lhs + offset, sizeof(T));
+    std::memcpy(&rhs_word, rhs + offset, sizeof(T));
+    return lhs_word == rhs_word;
+  };
 
-    auto output_diff = [&line_callback, &has_diff, &only_actual]() {
-      has_diff |= !only_actual.empty();
+  if (size >= 8) {
+    return load_equal(0, std::uint64_t{}) && load_equal(size - 8, std::uint64_t{});
+  }
+  if (size >= 4) {
+    return load_equal(0, std::uint32_t{}) && load_equal(size - 4, std::uint32_t{});
+  }
+  return size == 0 || (lhs[0] == rhs[0] && lhs[size / 2] == rhs[size / 2] && lhs[size - 1] == rhs[size - 1]);
+}
 
-      std::ranges::for_each(only_actual, [&line_callback](const auto& l) {
-        line_callback(diff_line{.line = l, .type = diff_line_type::actual_only});
-      });
-      only_actual.clear();
-    };
+[[maybe_unused]]
+auto find_newline_scalar(const char* first, const char* last) -> const char* {
+  if (first == last) {
+    return last;
+  }
 
-    // !! Vector of strings containing all lines that are not present in the expected file up to a given point
-    std::vector<std::string> actual_buffer;
+  const auto* const newline = static_cast<const char*>(std::memchr(first, '\n', static_cast<std::size_t>(last - first)));
+  return newline != nullptr ? newline : last;
+}
 
-    auto expected_line{read_expected_line()};
-    while (expected_line) {
-      auto matching_actual_it = std::ranges::find(actual_buffer, expected_line);
-      while (matching_actual_it == actual_buffer.end()) {
-        auto actual_line = read_actual_line();
-        if (!actual_line) {
-          break;
-        }
+[[maybe_unused]]
+auto equal_scalar(const char* lhs, const char* rhs, std::size_t size) -> bool {
+  return size == 0 || std::memcmp(lhs, rhs, size) == 0;
+}
 
-        actual_buffer.push_back(std::move(*actual_line));
+#ifdef NANODIFF_HAS_X86_SIMD
+// `find_newline` kernels never perform loads which cross a page boundary. Bytes outside of the searched range may
+// therefore be read, but are always masked out of the result.
 
-        matching_actual_it = std::ranges::find(actual_buffer.end() - 1, actual_buffer.end(), expected_line);
-      }
+constexpr std::uintptr_t min_page_size = 4096;
 
-      if (matching_actual_it != actual_buffer.end()) {
-        // We found a matching line in the actual buffer
-        const auto nlines = std::distance(actual_buffer.begin(), matching_actual_it);
+[[gnu::no_sanitize_address, gnu::no_sanitize_thread]]
+auto find_newline_sse2(const char* first, const char* last) -> const char* {
+  constexpr std::uintptr_t width = 16;
 
-        std::ranges::move(actual_buffer | std::views::take(nlines), std::back_inserter(only_actual));
+  if (first == last) {
+    return last;
+  }
 
-        output_diff();
-        if (has_diff) {
-          line_callback(diff_line{.line = *expected_line, .type = diff_line_type::context});
-        }
+  const auto newline = _mm_set1_epi8('\n');
+  const auto first_addr = reinterpret_cast<std::uintptr_t>(first);
+  const auto last_addr = reinterpret_cast<std::uintptr_t>(last);
 
-        // Erase all lines up to and including the matching line from `actual_buffer`
-        actual_buffer.erase(actual_buffer.begin(), matching_actual_it + 1);
-      } else {
-        has_diff = true;
-        line_callback(diff_line{.line = *expected_line, .type = diff_line_type::expected_only});
+  std::uintptr_t block_addr{};
+  unsigned mask{};
+  if ((first_addr % min_page_size) <= min_page_size - width) {
+    // Most lines are short, so check the bytes immediately following `first` first
+    mask = static_cast<unsigned>(
+        _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(first_addr)), newline)));
+    block_addr = first_addr;
+    if (mask == 0) {
+      block_addr = (first_addr + width) & ~(width - 1);
+      if (block_addr >= last_addr) {
+        return last;
       }
+      mask = static_cast<unsigned>(
+          _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_load_si128(reinterpret_cast<const __m128i*>(block_addr)), newline)));
+    }
+  } else {
+    block_addr = first_addr & ~(width - 1);
+    mask = static_cast<unsigned>(
+               _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_load_si128(reinterpret_cast<const __m128i*>(block_addr)), newline)))
+           & (0xFFFFU << (first_addr - block_addr));
+  }
 
-      expected_line = read_expected_line();
-    };
-
-    std::ranges::for_each(actual_buffer, [&line_callback](const auto& l) {
-      line_callback(diff_line{.line = l, .type = diff_line_type::actual_only});
-    });
-    actual_buffer.clear();
+  while (mask == 0) {
+    block_addr += width;
+    if (block_addr >= last_addr) {
+      return last;
+    }
+    mask = static_cast<unsigned>(
+        _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_load_si128(reinterpret_cast<const __m128i*>(block_addr)), newline)));
+  }
 
-    auto actual_line{read_actual_line()};
-    while (actual_line) {
-      line_callback(diff_line{.line = *actual_line, .type = diff_line_type::actual_only});
+  const auto newline_addr = block_addr + static_cast<std::uintptr_t>(std::countr_zero(mask));
+  return newline_addr < last_addr ? first + (newline_addr - first_addr) : last;
+}
 
-      actual_line = read_actual_line();
-    }
+inline auto equal_chunk_sse2(const char* lhs, const char* rhs) -> bool {
+  const auto lhs_chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(lhs));
+  const auto rhs_chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(rhs));
+  return _mm_movemask_epi8(_mm_cmpeq_epi8(lhs_chunk, rhs_chunk)) == 0xFFFF;
+}
 
-    return has_diff;
+auto equal_sse2(const char* lhs, const char* rhs, std::size_t size) -> bool {
+  if (size <= 16) {
+    return equal_small(lhs, rhs, size);
   }
 
- protected:
-  virtual auto read_expected_line() -> std::optional<std::string> = 0;
-  virtual auto read_actual_line() -> std::optional<std::string> = 0;
-};
+  for (std::size_t offset = 0; offset + 16 < size; offset += 16) {
+    if (!equal_chunk_sse2(lhs + offset, rhs + offset)) {
+      return false;
+    }
+  }
+  // The last chunk overlaps with the previous one instead of reading past the end of the buffers
+  return equal_chunk_sse2(lhs + size - 16, rhs + size - 16);
+}
 
-class eager_file_differ final : public file_differ {
- public:
-  eager_file_differ(const eager_file_differ&) = delete;
-  eager_file_differ(eager_file_differ&&) noexcept = default;
+[[gnu::target("avx2"), gnu::no_sanitize_address, gnu::no_sanitize_thread]]
+auto find_newline_avx2(const char* first, const char* last) -> const char* {
+  constexpr std::uintptr_t width = 32;
 
-  ~eager_file_differ() override = default;
+  if (first == last) {
+    return last;
+  }
 
-  auto operator=(const eager_file_differ&) -> eager_file_differ& = delete;
-  auto operator=(eager_file_differ&&) noexcept -> eager_file_differ& = default;
+  const auto newline = _mm256_set1_epi8('\n');
+  const auto first_addr = reinterpret_cast<std::uintptr_t>(first);
+  const auto last_addr = reinterpret_cast<std::uintptr_t>(last);
 
-  eager_file_differ(std::ifstream expected, std::ifstream actual) {
-    while (expected) {
-      std::string line{};
-      std::getline(expected, line);
-      _expected_content.emplace_back(std::move(line));
+  std::uintptr_t block_addr{};
+  unsigned mask{};
+  if ((first_addr % min_page_size) <= min_page_size - width) {
+    // Most lines are short, so check the bytes immediately following `first` first
+    mask = static_cast<unsigned>(_mm256_movemask_epi8(
+        _mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(first_addr)), newline)));
+    block_addr = first_addr;
+    if (mask == 0) {
+      block_addr = (first_addr + width) & ~(width - 1);
+      if (block_addr >= last_addr) {
+        return last;
+      }
+      mask = static_cast<unsigned>(_mm256_movemask_epi8(
+          _mm256_cmpeq_epi8(_mm256_load_si256(reinterpret_cast<const __m256i*>(block_addr)), newline)));
     }
-    _expected_it = _expected_content.cbegin();
+  } else {
+    block_addr = first_addr & ~(width - 1);
+    mask = static_cast<unsigned>(_mm256_movemask_epi8(
+               _mm256_cmpeq_epi8(_mm256_load_si256(reinterpret_cast<const __m256i*>(block_addr)), newline)))
+           & (0xFFFFFFFFU << (first_addr - block_addr));
+  }
 
-    while (actual) {
-      std::string line{};
-      std::getline(actual, line);
-      _actual_content.emplace_back(std::move(line));
+  while (mask == 0) {
+    block_addr += width;
+    if (block_addr >= last_addr) {
+      return last;
     }
-    _actual_it = _actual_content.cbegin();
+    mask = static_cast<unsigned>(_mm256_movemask_epi8(
+        _mm256_cmpeq_epi8(_mm256_load_si256(reinterpret_cast<const __m256i*>(block_addr)), newline)));
   }
 
- private:
-  auto read_expected_line() -> std::optional<std::string> override {
-    if (_expected_it == _expected_content.cend()) {
-      return std::nullopt;
-    }
-    return std::make_optional(*_expected_it++);
+  const auto newline_addr = block_addr + static_cast<std::uintptr_t>(std::countr_zero(mask));
+  return newline_addr < last_addr ? first + (newline_addr - first_addr) : last;
+}
+
+[[gnu::target("avx2")]]
+inline auto equal_chunk_avx2(const char* lhs, const char* rhs) -> bool {
+  const auto lhs_chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(lhs));
+  const auto rhs_chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(rhs));
+  return static_cast<unsigned>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(lhs_chunk, rhs_chunk))) == 0xFFFFFFFFU;
+}
+
+[[gnu::target("avx2")]]
+auto equal_avx2(const char* lhs, const char* rhs, std::size_t size) -> bool {
+  if (size <= 16) {
+    return equal_small(lhs, rhs, size);
   }
-  auto read_actual_line() -> std::optional<std::string> override {
-    if (_actual_it == _actual_content.cend()) {
-      return std::nullopt;
+  if (size <= 32) {
+    return equal_chunk_sse2(lhs, rhs) && equal_chunk_sse2(lhs + size - 16, rhs + size - 16);
+  }
+
+  for (std::size_t offset = 0; offset + 32 < size; offset += 32) {
+    if (!equal_chunk_avx2(lhs + offset, rhs + offset)) {
+      return false;
     }
-    return std::make_optional(*_actual_it++);
   }
+  // The last chunk overlaps with the previous one instead of reading past the end of the buffers
+  return equal_chunk_avx2(lhs + size - 32, rhs + size - 32);
+}
+#endif  // NANODIFF_HAS_X86_SIMD
 
-  std::vector<std::string> _expected_content;
-  decltype(_expected_content)::const_iterator _expected_it;
-  std::vector<std::string> _actual_content;
-  decltype(_actual_content)::const_iterator _actual_it;
+auto select_text_kernels() -> text_kernels {
+#ifdef NANODIFF_HAS_X86_SIMD
+  if (__builtin_cpu_supports("avx2")) {
+    return text_kernels{.find_newline = find_newline_avx2, .equal = equal_avx2};
+  }
+  return text_kernels{.find_newline = find_newline_sse2, .equal = equal_sse2};
+#else
+  return text_kernels{.find_newline = find_newline_scalar, .equal = equal_scalar};
+#endif  // NANODIFF_HAS_X86_SIMD
+}
+
+const text_kernels kernels{select_text_kernels()};
+
+/**
+ * @brief Returns whether two lines are equal.
+ *
+ * Short lines are compared inline, since they are the most common and do not benefit from vectorization.
+ */
+auto lines_equal(std::string_view lhs, std::string_view rhs) -> bool {
+  if (lhs.size() != rhs.size()) {
+    return false;
+  }
+  if (lhs.size() <= 16) {
+    return equal_small(lhs.data(), rhs.data(), lhs.size());
+  }
+  return kernels.equal(lhs.data(), rhs.data(), lhs.size());
+}
+
+/**
+ * @brief Any type which can be read line-by-line like a @code line_reader @endcode.
+ *
+ * Differs are instantiated with the concrete reader types, so that reading a line does not need a virtual call.
+ */
+template<typename Reader>
+concept line_source = requires(Reader& reader) {
+  { reader.read_line() } -> std::same_as<std::optional<std::string_view>>;
+};
+
+/**
+ * @brief Line reader which reads from a @code std::ifstream @endcode using @code std::getline @endcode.
+ */
+class istream_line_reader final : public line_reader {
+ public:
+  explicit istream_line_reader(std::ifstream stream) : _stream{std::move(stream)} {}
+
+  auto read_line() -> std::optional<std::string_view> override {
+    if (!_stream) {
+      return std::nullopt;
+    }
+
+    // `std::getline` does not clear the string if the stream is already at the end of the file
+    _line.clear();
+    std::getline(_stream, _line);
+    return _line;
+  }
+
+ private:
+  std::ifstream _stream;
+  std::string _line;
+};
+
+#ifndef NANODIFF_HAS_POSIX
+/**
+ * @brief Line reader which reads from @code std::cin @endcode using @code std::getline @endcode.
+ */
+class stdin_line_reader final : public line_reader {
+ public:
+  auto read_line() -> std::optional<std::string_view> override {
+    if (!std::cin) {
+      return std::nullopt;
+    }
+
+    _line.clear();
+    std::getline(std::cin, _line);
+    return _line;
+  }
+
+ private:
+  std::string _line;
+};
+#endif  // NANODIFF_HAS_POSIX
+
+/**
+ * @brief Offsets of the ends of all lines of a file, i.e. of the newline following each line or the end of the file
+ * for the last line, and the exact hash of each line.
+ */
+struct line_index_view {
+  std::span<const std::uint64_t> ends;
+  std::span<const std::uint64_t> hashes;
+};
+
+/**
+ * @brief Line reader which returns views into a contiguous buffer without copying.
+ *
+ * If the buffer has a line index, lines are split at the offsets in the index instead of searching for newlines.
+ */
+class memory_line_reader : public line_reader {
+ public:
+  explicit memory_line_reader(std::string_view contents, line_index_view index = {}) noexcept :
+      _contents{contents}, _index{index} {}
+  memory_line_reader(const memory_line_reader&) = delete;
+  memory_line_reader(memory_line_reader&&) noexcept = default;
+
+  ~memory_line_reader() override = default;
+
+  auto operator=(const memory_line_reader&) -> memory_line_reader& = delete;
+  auto operator=(memory_line_reader&&) noexcept -> memory_line_reader& = default;
+
+  auto read_line() -> std::optional<std::string_view> final {
+    if (_done) {
+      return std::nullopt;
+    }
+    ++_line;
+    if (_pos == _contents.size()) {
+      _done = true;
+      return _trimmed ? std::nullopt : std::optional{_contents.substr(_pos)};
+    }
+
+    const auto line_begin = _pos;
+    std::size_t newline_pos{};
+    if (!_index.ends.empty()) {
+      newline_pos = std::min(static_cast<std::size_t>(_index.ends[_line - 1]), _contents.size());
+    } else {
+      const auto* const contents_end = _contents.data() + _contents.size();
+      newline_pos = static_cast<std::size_t>(kernels.find_newline(_contents.data() + line_begin, contents_end) -
+                                             _contents.data());
+    }
+    if (newline_pos == _contents.size()) {
+      _pos = _contents.size();
+      return _contents.substr(line_begin);
+    }
+
+    _pos = newline_pos + 1;
+    return _contents.substr(line_begin, newline_pos - line_begin);
+  }
+
+  /**
+   * @brief Returns the exact hash of the last line returned by @code read_line() @endcode, if the buffer has a line
+   * index.
+   */
+  [[nodiscard]] auto last_line_hash() const noexcept -> std::optional<std::uint64_t> {
+    if (_index.hashes.empty() || _line == 0) {
+      return std::nullopt;
+    }
+    return _index.hashes[_line - 1];
+  }
+
+  [[nodiscard]] auto is_persistent() const noexcept -> bool override { return true; }
+
+  [[nodiscard]] auto contents() const noexcept -> std::optional<std::string_view> override {
+    return _done ? std::string_view{} : _contents.substr(_pos);
+  }
+
+  [[nodiscard]] auto is_trimmable() const noexcept -> bool override { return true; }
+
+  void trim(std::size_t prefix, std::size_t suffix) override {
+    assert(!_done && prefix + suffix <= _contents.size() - _pos);
+
+    _pos += prefix;
+    _contents.remove_suffix(suffix);
+    _trimmed = _trimmed || suffix != 0;
+    if (!_index.ends.empty()) {
+      // The line starting at `_pos` is the first which ends at or after it
+      _line = static_cast<std::size_t>(std::ranges::lower_bound(_index.ends, _pos) - _index.ends.begin());
+    }
+  }
+
+ protected:
+  /**
+   * @brief Sets the line index of the buffer, before any lines are read.
+   */
+  void set_index(line_index_view index) noexcept {
+    assert(_pos == 0 && _line == 0);
+    _index = index;
+  }
+
+ private:
+  std::string_view _contents;
+  line_index_view _index;
+  std::size_t _pos{};
+  // Number of lines returned so far, including those skipped by `trim`
+  std::size_t _line{};
+  bool _done{};
+  bool _trimmed{};
+};
+
+/**
+ * @brief How much of a file descriptor was read, which is shared between its reader and the process writing into it.
+ *
+ * Readers are moved into the differs, so this is also how the caller learns whether reading failed.
+ */
+struct read_progress {
+  // Maximum number of bytes which are read, after which the rest of the input is ignored
+  std::size_t max_bytes{std::numeric_limits<std::size_t>::max()};
+  std::size_t bytes{};
+  // Whether the input was longer than `max_bytes`
+  bool limit_exceeded{};
+  // Whether the end of the input was reached
+  bool end_of_file{};
+  // Value of `errno` if reading the input failed, in which case the reader stops as if the input ended there
+  int error{};
+};
+
+/**
+ * @brief Returns the message for an input at the given path which could not be read due to @code error @endcode.
+ */
+auto read_error_message(const std::filesystem::path& path, int error) -> std::string {
+  return std::format("Unable to read file '{}': {}", path.string(), std::strerror(error));
+}
+
+#ifdef NANODIFF_HAS_POSIX
+/**
+ * @brief Owning wrapper around a POSIX file descriptor.
+ */
+class unique_fd {
+ public:
+  explicit unique_fd(int fd) noexcept : _fd{fd} {}
+  unique_fd(const unique_fd&) = delete;
+  unique_fd(unique_fd&& other) noexcept : _fd{std::exchange(other._fd, -1)} {}
+
+  ~unique_fd() {
+    if (_fd >= 0) {
+      ::close(_fd);
+    }
+  }
+
+  auto operator=(const unique_fd&) -> unique_fd& = delete;
+  auto operator=(unique_fd&& other) noexcept -> unique_fd& {
+    std::swap(_fd, other._fd);
+    return *this;
+  }
+
+  [[nodiscard]] auto get() const noexcept -> int { return _fd; }
+  explicit operator bool() const noexcept { return _fd >= 0; }
+
+ private:
+  int _fd;
+};
+
+/**
+ * @brief Owner of a line index, which is either memory-mapped from a file or built in memory.
+ */
+class line_index {
+ public:
+  line_index() = default;
+  /**
+   * @brief Creates an index from the line ends followed by the line hashes in @code words @endcode, starting at
+   * @code offset @endcode.
+   */
+  line_index(std::vector<std::uint64_t> words, std::size_t offset) noexcept : _words{std::move(words)} {
+    _view = split(std::span<const std::uint64_t>{_words}.subspan(offset));
+  }
+  /**
+   * @brief Creates an index which owns the mapping @code [addr, addr + size) @endcode, of which @code view @endcode
+   * is a part.
+   */
+  line_index(void* addr, std::size_t size, line_index_view view) noexcept : _addr{addr}, _size{size}, _view{view} {}
+  line_index(const line_index&) = delete;
+  line_index(line_index&& other) noexcept :
+      _words{std::move(other._words)},
+      _addr{std::exchange(other._addr, nullptr)},
+      _size{other._size},
+      _view{std::exchange(other._view, {})} {}
+
+  ~line_index() {
+    if (_addr != nullptr) {
+      ::munmap(_addr, _size);
+    }
+  }
+
+  auto operator=(const line_index&) -> line_index& = delete;
+  auto operator=(line_index&& other) noexcept -> line_index& {
+    std::swap(_words, other._words);
+    std::swap(_addr, other._addr);
+    std::swap(_size, other._size);
+    std::swap(_view, other._view);
+    return *this;
+  }
+
+  [[nodiscard]] auto view() const noexcept -> line_index_view { return _view; }
+
+  /**
+   * @brief Splits the line ends followed by the line hashes into their views.
+   */
+  static auto split(std::span<const std::uint64_t> words) noexcept -> line_index_view {
+    return {.ends = words.first(words.size() / 2), .hashes = words.subspan(words.size() / 2)};
+  }
+
+ private:
+  std::vector<std::uint64_t> _words;
+  void* _addr{};
+  std::size_t _size{};
+  line_index_view _view;
+};
+
+/**
+ * @brief Returns the modification time in @code file_stat @endcode in nanoseconds since the epoch.
+ */
+auto stat_mtime(const struct stat& file_stat) noexcept -> std::int64_t {
+#ifdef __APPLE__
+  const auto& mtime = file_stat.st_mtimespec;
+#else
+  const auto& mtime = file_stat.st_mtim;
+#endif  // __APPLE__
+  return static_cast<std::int64_t>(mtime.tv_sec) * 1'000'000'000 + static_cast<std::int64_t>(mtime.tv_nsec);
+}
+
+/**
+ * @brief Line reader which memory-maps a regular file, and returns views into the mapping without copying.
+ */
+class mapped_line_reader final : public memory_line_reader {
+ public:
+  /**
+   * @param mtime Modification time of the file, which must be taken from the descriptor that was mapped before mapping
+   * it, so that it never belongs to older contents than those mapped.
+   */
+  mapped_line_reader(void* addr, std::size_t size, std::int64_t mtime) noexcept :
+      memory_line_reader{std::string_view{static_cast<const char*>(addr), size}},
+      _addr{addr},
+      _size{size},
+      _mtime{mtime} {}
+  mapped_line_reader(const mapped_line_reader&) = delete;
+  mapped_line_reader(mapped_line_reader&& other) noexcept :
+      memory_line_reader{std::move(other)},
+      _addr{std::exchange(other._addr, nullptr)},
+      _size{other._size},
+      _mtime{other._mtime},
+      _index{std::move(other._index)} {}
+
+  ~mapped_line_reader() override {
+    if (_addr != nullptr) {
+      ::munmap(_addr, _size);
+    }
+  }
+
+  auto operator=(const mapped_line_reader&) -> mapped_line_reader& = delete;
+  auto operator=(mapped_line_reader&&) noexcept -> mapped_line_reader& = delete;
+
+  /**
+   * @brief Splits the file at the line ends of @code index @endcode, which must be the index of the whole file, instead
+   * of searching for newlines.
+   */
+  void set_index(line_index index) noexcept {
+    _index = std::move(index);
+    memory_line_reader::set_index(_index.view());
+  }
+
+  [[nodiscard]] auto index() const noexcept -> line_index_view { return _index.view(); }
+
+  /**
+   * @brief Modification time of the mapped file in nanoseconds since the epoch, as it was before the file was mapped.
+   */
+  [[nodiscard]] auto mtime() const noexcept -> std::int64_t { return _mtime; }
+
+ private:
+  void* _addr;
+  std::size_t _size;
+  std::int64_t _mtime;
+  line_index _index;
+};
+
+/**
+ * @brief Line reader which reads from a file descriptor in large blocks using @code read() @endcode.
+ *
+ * This is used for inputs which cannot be memory-mapped, such as pipes and FIFOs. Only the current line and the
+ * remainder of the last block are kept in memory.
+ */
+class fd_line_reader final : public line_reader {
+ public:
+  /**
+   * @brief Constructs a reader which stops reading after @code progress.max_bytes @endcode bytes, as if the input
+   * ended there, and keeps @code progress @endcode up to date. @code progress @endcode must outlive the reader.
+   */
+  fd_line_reader(unique_fd fd, read_progress& progress) :
+      _fd{std::move(fd)}, _buffer(initial_buffer_size), _progress{&progress} {}
+
+  auto read_line() -> std::optional<std::string_view> override {
+    if (_done) {
+      return std::nullopt;
+    }
+
+    std::size_t search_pos = _begin;
+    while (true) {
+      const auto* const buffer_end = _buffer.data() + _end;
+      const auto* const newline = kernels.find_newline(_buffer.data() + search_pos, buffer_end);
+      if (newline != buffer_end) {
+        const auto newline_pos = static_cast<std::size_t>(newline - _buffer.data());
+        const std::string_view line{_buffer.data() + _begin, newline_pos - _begin};
+        _begin = newline_pos + 1;
+        return line;
+      }
+
+      search_pos = _end;
+      if (_eof) {
+        break;
+      }
+      search_pos -= fill_buffer();
+    }
+
+    // The final line is not terminated by a newline, and is always followed by an empty line
+    if (_begin == _end) {
+      _done = true;
+      return std::string_view{};
+    }
+
+    const std::string_view line{_buffer.data() + _begin, _end - _begin};
+    _begin = _end;
+    return line;
+  }
+
+ private:
+  static constexpr std::size_t initial_buffer_size = 1U << 16U;
+
+  /**
+   * @brief Reads the next block from the file descriptor into the buffer.
+   *
+   * @return The number of bytes by which the unconsumed contents of the buffer were moved towards its beginning.
+   */
+  auto fill_buffer() -> std::size_t {
+    const auto shift = _begin;
+    if (_begin != 0) {
+      std::memmove(_buffer.data(), _buffer.data() + _begin, _end - _begin);
+      _end -= _begin;
+      _begin = 0;
+    }
+    if (_end == _buffer.size()) {
+      _buffer.resize(_buffer.size() * 2);
+    }
+
+    // Read one byte past the limit, to tell whether the input ends right at the limit
+    auto max_read = _buffer.size() - _end;
+    if (const auto remaining = _progress->max_bytes - _progress->bytes; remaining < max_read) {
+      max_read = remaining + 1;
+    }
+
+    const auto prev_end = _end;
+    while (true) {
+      const auto nread = ::read(_fd.get(), _buffer.data() + _end, max_read);
+      if (nread > 0) {
+        _end += static_cast<std::size_t>(nread);
+        break;
+      }
+      if (nread == 0) {
+        _eof = true;
+        break;
+      }
+      if (errno != EINTR) {
+        // Stop reading, and leave it to the caller to report the error instead of the diff of a truncated input
+        _eof = true;
+        _progress->error = errno;
+        break;
+      }
+    }
+
+    _progress->bytes += _end - prev_end;
+    if (_progress->bytes > _progress->max_bytes) {
+      _end -= _progress->bytes - _progress->max_bytes;
+      _progress->bytes = _progress->max_bytes;
+      _progress->limit_exceeded = true;
+      _eof = true;
+    }
+    _progress->end_of_file = _eof && !_progress->limit_exceeded && _progress->error == 0;
+
+    return shift;
+  }
+
+  unique_fd _fd;
+  std::vector<char> _buffer;
+  std::size_t _begin{};
+  std::size_t _end{};
+  bool _eof{};
+  bool _done{};
+  // Never null, but a pointer so that the reader can be moved
+  read_progress* _progress;
+};
+#endif  // NANODIFF_HAS_POSIX
+
+/**
+ * @brief Block of complete lines read from a file, which is passed from the thread reading the file to the differ.
+ */
+struct line_batch {
+  std::vector<char> data;
+  // Number of bytes at the start of `data` which hold lines
+  std::size_t size{};
+  // Whether this is the last batch, whose last line may not be terminated by a newline
+  bool last{};
+  // Value of `errno` if reading the file failed, in which case this is the last batch
+  int error{};
+};
+
+/**
+ * @brief Bounded lock-free ring of line batches, which is filled by one thread and drained by another.
+ *
+ * Slots are reused, so that the buffers of the batches are only allocated while the ring first fills up. The producer
+ * blocks while the ring is full, and the consumer blocks while it is empty.
+ */
+class line_batch_ring {
+ public:
+  explicit line_batch_ring(std::size_t capacity) : _slots(capacity) {}
+
+  /**
+   * @brief Waits for a free slot, and returns it to be filled by the producer.
+   *
+   * @return The free slot, or @code nullptr @endcode if the consumer has closed the ring.
+   */
+  auto acquire() -> line_batch* {
+    const auto tail = _tail.load(std::memory_order_relaxed);
+    // Loaded before checking the state, so that a pop or close in between ends the wait right away
+    auto wakeups = _producer_wakeups.load(std::memory_order_acquire);
+    while (!_closed.load(std::memory_order_acquire)) {
+      if (tail - _head.load(std::memory_order_acquire) < _slots.size()) {
+        return &_slots[tail % _slots.size()];
+      }
+      _producer_wakeups.wait(wakeups, std::memory_order_acquire);
+      wakeups = _producer_wakeups.load(std::memory_order_acquire);
+    }
+    return nullptr;
+  }
+
+  /**
+   * @brief Passes the slot returned by @code acquire() @endcode to the consumer.
+   */
+  void publish() {
+    _tail.fetch_add(1, std::memory_order_release);
+    _tail.notify_one();
+  }
+
+  /**
+   * @brief Waits for and returns the oldest batch which was published and not popped yet.
+   */
+  auto front() -> const line_batch& {
+    const auto head = _head.load(std::memory_order_relaxed);
+    auto tail = _tail.load(std::memory_order_acquire);
+    while (tail == head) {
+      _tail.wait(tail, std::memory_order_acquire);
+      tail = _tail.load(std::memory_order_acquire);
+    }
+    return _slots[head % _slots.size()];
+  }
+
+  /**
+   * @brief Returns the slot of the batch returned by @code front() @endcode to the producer.
+   */
+  void pop() {
+    _head.fetch_add(1, std::memory_order_release);
+    wake_producer();
+  }
+
+  /**
+   * @brief Stops the producer once the consumer no longer reads any batches.
+   */
+  void close() {
+    _closed.store(true, std::memory_order_release);
+    wake_producer();
+  }
+
+ private:
+  /**
+   * @brief Wakes the producer if it is waiting for a free slot.
+   */
+  void wake_producer() {
+    _producer_wakeups.fetch_add(1, std::memory_order_release);
+    _producer_wakeups.notify_one();
+  }
+
+  std::vector<line_batch> _slots;
+  std::atomic<std::size_t> _head{};
+  std::atomic<std::size_t> _tail{};
+  std::atomic<bool> _closed{};
+  // Changed whenever a slot is freed or the ring is closed, which is what the producer waits for
+  std::atomic<std::uint32_t> _producer_wakeups{};
+};
+
+/**
+ * @brief Line reader which reads a file on a separate thread, so that waiting for the file to be read overlaps with
+ * diffing the lines which were already read.
+ *
+ * The reading thread splits the file into batches of complete lines, and stays up to a fixed number of batches ahead
+ * of the differ. A batch is passed on as soon as a read returns less than was requested, so that lines written into a
+ * pipe or FIFO are diffed without waiting for the batch to fill up.
+ *
+ * If reading the file fails, the lines read before are returned as if the file ended there, and the error is stored in
+ * the @code read_progress @endcode given to the reader, which must outlive it.
+ */
+class prefetch_line_reader final : public line_reader {
+ public:
+#ifdef NANODIFF_HAS_POSIX
+  using source_type = unique_fd;
+#else
+  using source_type = std::ifstream;
+#endif  // NANODIFF_HAS_POSIX
+
+#ifdef NANODIFF_HAS_POSIX
+  prefetch_line_reader(source_type source, std::size_t depth, read_progress& progress) :
+      prefetch_line_reader{std::move(source), depth, progress, make_wake_pipe()} {}
+#else
+  prefetch_line_reader(source_type source, std::size_t depth, read_progress& progress) :
+      _ring{std::make_unique<line_batch_ring>(depth)},
+      _producer{[ring = _ring.get()](source_type source) { produce(*ring, std::move(source), wake_type{}); },
+                std::move(source)},
+      _progress{&progress} {}
+#endif  // NANODIFF_HAS_POSIX
+  prefetch_line_reader(const prefetch_line_reader&) = delete;
+  prefetch_line_reader(prefetch_line_reader&&) noexcept = default;
+
+  ~prefetch_line_reader() override {
+    // The producer is joined before the ring is destroyed
+    if (_ring) {
+      _ring->close();
+    }
+#ifdef NANODIFF_HAS_POSIX
+    // Closing the write end of the wake-up pipe wakes the producer if it is waiting for input which may never come
+    _wake = unique_fd{-1};
+#endif  // NANODIFF_HAS_POSIX
+  }
+
+  auto operator=(const prefetch_line_reader&) -> prefetch_line_reader& = delete;
+  auto operator=(prefetch_line_reader&&) noexcept -> prefetch_line_reader& = delete;
+
+  auto read_line() -> std::optional<std::string_view> override {
+    if (_done) {
+      return std::nullopt;
+    }
+
+    while (true) {
+      if (_batch != nullptr) {
+        const auto* const batch_begin = _batch->data.data();
+        const auto* const line_begin = batch_begin + _pos;
+        const auto* const batch_end = batch_begin + _batch->size;
+        if (line_begin != batch_end) {
+          const auto* const newline = kernels.find_newline(line_begin, batch_end);
+          _pos = static_cast<std::size_t>(newline - batch_begin) + (newline == batch_end ? 0 : 1);
+          return std::string_view{line_begin, newline};
+        }
+
+        // The final line is not terminated by a newline, and is always followed by an empty line
+        if (_batch->last) {
+          _done = true;
+          if (_batch->error != 0) {
+            _progress->error = _batch->error;
+          }
+          return std::string_view{};
+        }
+        _ring->pop();
+      }
+
+      _batch = &_ring->front();
+      _pos = 0;
+    }
+  }
+
+ private:
+  static constexpr std::size_t batch_size = 1U << 18U;
+
+  /**
+   * @brief Read end of the pipe which wakes the producer while it is waiting for input, if the input can be waited for
+   * together with it.
+   */
+#ifdef NANODIFF_HAS_POSIX
+  using wake_type = unique_fd;
+#else
+  using wake_type = std::monostate;
+#endif  // NANODIFF_HAS_POSIX
+
+#ifdef NANODIFF_HAS_POSIX
+  prefetch_line_reader(source_type source,
+                       std::size_t depth,
+                       read_progress& progress,
+                       std::array<unique_fd, 2> wake) :
+      _ring{std::make_unique<line_batch_ring>(depth)},
+      _wake{std::move(wake[1])},
+      _producer{[ring = _ring.get()](source_type source,
+                                     unique_fd wake) { produce(*ring, std::move(source), std::move(wake)); },
+                std::move(source), std::move(wake[0])},
+      _progress{&progress} {}
+
+  /**
+   * @brief Creates the pipe whose write end is closed to wake the producer once the reader is destroyed.
+   *
+   * @return The read and write ends of the pipe, which are both invalid if it cannot be created, in which case the
+   * reader waits for the pending read of the producer to complete when it is destroyed.
+   */
+  static auto make_wake_pipe() -> std::array<unique_fd, 2> {
+    std::array<int, 2> pipe_fds{-1, -1};
+    if (::pipe(pipe_fds.data()) != 0) {
+      return {unique_fd{-1}, unique_fd{-1}};
+    }
+    ::fcntl(pipe_fds[0], F_SETFD, FD_CLOEXEC);
+    ::fcntl(pipe_fds[1], F_SETFD, FD_CLOEXEC);
+    return {unique_fd{pipe_fds[0]}, unique_fd{pipe_fds[1]}};
+  }
+#endif  // NANODIFF_HAS_POSIX
+
+  /**
+   * @brief Reads up to @code size @endcode bytes from the source into @code buffer @endcode.
+   *
+   * @return The number of bytes read, which is only 0 at the end of the file, or once the read end of the wake-up pipe
+   * becomes readable because the reader was destroyed, or the value of @code errno @endcode if reading failed.
+   */
+#ifdef NANODIFF_HAS_POSIX
+  static auto read_some(source_type& source, const wake_type& wake, char* buffer, std::size_t size)
+      -> std::expected<std::size_t, int> {
+    // Negative descriptors are ignored by `poll`, so a missing wake-up pipe only makes the wait uninterruptible
+    std::array<::pollfd, 2> fds{{{.fd = source.get(), .events = POLLIN, .revents = 0},
+                                  {.fd = wake.get(), .events = POLLIN, .revents = 0}}};
+    while (true) {
+      if (::poll(fds.data(), fds.size(), -1) < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        return std::unexpected{errno};
+      }
+      if (fds[1].revents != 0) {
+        return 0;
+      }
+
+      const auto nread = ::read(source.get(), buffer, size);
+      if (nread >= 0) {
+        return static_cast<std::size_t>(nread);
+      }
+      if (errno != EINTR) {
+        return std::unexpected{errno};
+      }
+    }
+  }
+#else
+  static auto read_some(source_type& source, const wake_type& /*wake*/, char* buffer, std::size_t size)
+      -> std::expected<std::size_t, int> {
+    source.read(buffer, static_cast<std::streamsize>(size));
+    if (source.bad()) {
+      return std::unexpected{EIO};
+    }
+    return static_cast<std::size_t>(source.gcount());
+  }
+#endif  // NANODIFF_HAS_POSIX
+
+  /**
+   * @brief Reads the whole source into batches until the end of the file is reached, or the ring is closed.
+   */
+  static void produce(line_batch_ring& ring, source_type source, wake_type wake) {
+    // The incomplete line at the end of the previous batch, which starts the next one
+    std::vector<char> carry{};
+    bool eof{};
+    int error{};
+    while (!eof) {
+      auto* const batch = ring.acquire();
+      if (batch == nullptr) {
+        return;
+      }
+
+      auto& data = batch->data;
+      data.resize(std::max({data.size(), batch_size, carry.size() * 2}));
+      std::ranges::copy(carry, data.begin());
+      auto size = carry.size();
+
+      // Fill the buffer, and only grow it if it does not contain a single complete line yet. A short read means that
+      // no more input is available for now, in which case the complete lines are passed on without waiting for more.
+      // The carried line is incomplete, so only the bytes read into this batch are searched for a newline.
+      bool has_line{};
+      while (true) {
+        if (size == data.size()) {
+          if (has_line) {
+            break;
+          }
+          data.resize(data.size() * 2);
+        }
+
+        const auto requested = data.size() - size;
+        const auto nread_or_err = read_some(source, wake, data.data() + size, requested);
+        if (!nread_or_err || *nread_or_err == 0) {
+          eof = true;
+          error = nread_or_err ? 0 : nread_or_err.error();
+          break;
+        }
+        const auto nread = *nread_or_err;
+
+        const auto* const read_begin = data.data() + size;
+        const auto* const read_end = read_begin + nread;
+        size += nread;
+        has_line = has_line || kernels.find_newline(read_begin, read_end) != read_end;
+        if (has_line && nread < requested) {
+          break;
+        }
+      }
+
+      batch->size = size;
+      batch->last = eof;
+      batch->error = error;
+      if (!eof) {
+        batch->size = std::string_view{data.data(), size}.rfind('\n') + 1;
+        carry.assign(data.begin() + static_cast<std::ptrdiff_t>(batch->size),
+                     data.begin() + static_cast<std::ptrdiff_t>(size));
+      }
+      ring.publish();
+    }
+  }
+
+  std::unique_ptr<line_batch_ring> _ring;
+#ifdef NANODIFF_HAS_POSIX
+  // Write end of the pipe which wakes the producer once closed
+  unique_fd _wake{-1};
+#endif  // NANODIFF_HAS_POSIX
+  std::jthread _producer;
+  const line_batch* _batch{};
+  std::size_t _pos{};
+  bool _done{};
+  // Never null, but a pointer so that the reader can be moved
+  read_progress* _progress;
+};
+
+/**
+ * @brief Any of the line readers which may be returned by @code open_line_reader @endcode.
+ */
+#ifdef NANODIFF_HAS_POSIX
+using file_line_reader = std::variant<mapped_line_reader, fd_line_reader, prefetch_line_reader>;
+#else
+using file_line_reader = std::variant<istream_line_reader, stdin_line_reader, prefetch_line_reader>;
+#endif  // NANODIFF_HAS_POSIX
+
+/**
+ * @brief Opens the file at the given path for reading line-by-line.
+ *
+ * If @code read_ahead @endcode is non-zero, the file is read on a separate thread which stays up to that many batches
+ * of lines ahead of the differ. Otherwise, regular files are memory-mapped where possible, and all other files
+ * (including the standard input if @code path @endcode is @code stdin_path @endcode) are read in large blocks.
+ *
+ * If reading the file fails after it was opened, the error is stored in @code progress @endcode, which must outlive the
+ * reader.
+ */
+auto open_line_reader(const std::filesystem::path& path, std::size_t read_ahead, read_progress& progress)
+    -> std::expected<file_line_reader, std::string> {
+  const auto is_stdin = path.string() == stdin_path;
+#ifdef NANODIFF_HAS_POSIX
+  unique_fd fd{is_stdin ? ::fcntl(STDIN_FILENO, F_DUPFD_CLOEXEC, 0) : ::open(path.c_str(), O_RDONLY | O_CLOEXEC)};
+  if (!fd) {
+    return std::unexpected{std::format("Unable to open file '{}'", path.string())};
+  }
+
+  if (read_ahead != 0) {
+    return file_line_reader{std::in_place_type<prefetch_line_reader>, std::move(fd), read_ahead, progress};
+  }
+
+  struct stat file_stat {};
+  if (::fstat(fd.get(), &file_stat) != 0) {
+    return std::unexpected{std::format("Unable to stat file '{}'", path.string())};
+  }
+
+  // The standard input may be a regular file which was already partially read, in which case only the rest is read
+  if (S_ISREG(file_stat.st_mode) && (!is_stdin || ::lseek(fd.get(), 0, SEEK_CUR) == 0)) {
+    const auto size = static_cast<std::size_t>(file_stat.st_size);
+    if (size == 0) {
+      return file_line_reader{std::in_place_type<mapped_line_reader>, nullptr, 0, stat_mtime(file_stat)};
+    }
+
+    // NOLINTNEXTLINE(cppcoreguidelines-pro-type-cstyle-cast,performance-no-int-to-ptr)
+    if (void* addr = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd.get(), 0); addr != MAP_FAILED) {
+      ::madvise(addr, size, MADV_SEQUENTIAL);
+      return file_line_reader{std::in_place_type<mapped_line_reader>, addr, size, stat_mtime(file_stat)};
+    }
+  }
+
+  return file_line_reader{std::in_place_type<fd_line_reader>, std::move(fd), progress};
+#else
+  if (is_stdin) {
+    return file_line_reader{std::in_place_type<stdin_line_reader>};
+  }
+
+  std::ifstream stream{path};
+  if (!stream) {
+    return std::unexpected{std::format("Unable to open file '{}'", path.string())};
+  }
+
+  if (read_ahead != 0) {
+    return file_line_reader{std::in_place_type<prefetch_line_reader>, std::move(stream), read_ahead, progress};
+  }
+  return file_line_reader{std::in_place_type<istream_line_reader>, std::move(stream)};
+#endif  // NANODIFF_HAS_POSIX
+}
+
+/**
+ * @brief Computes a 64-bit hash of the contents of a line.
+ */
+auto hash_line(std::string_view line) -> std::uint64_t {
+  constexpr std::uint64_t multiplier = 0x9E3779B97F4A7C15ULL;
+
+  auto mix = [](std::uint64_t h) {
+    h ^= h >> 33U;
+    h *= 0xFF51AFD7ED558CCDULL;
+    h ^= h >> 33U;
+    h *= 0xC4CEB9FE1A85EC53ULL;
+    h ^= h >> 33U;
+    return h;
+  };
+
+  std::uint64_t h = line.size() * multiplier;
+  for (; line.size() >= sizeof(std::uint64_t); line.remove_prefix(sizeof(std::uint64_t))) {
+    std::uint64_t word{};
+    std::memcpy(&word, line.data(), sizeof(word));
+    h = std::rotl(h ^ mix(word), 27) * multiplier;
+  }
+  if (!line.empty()) {
+    std::uint64_t word{};
+    std::memcpy(&word, line.data(), line.size());
+    h = std::rotl(h ^ mix(word), 27) * multiplier;
+  }
+
+  return mix(h);
+}
+
+#ifdef NANODIFF_HAS_POSIX
+/**
+ * @brief Header of a line index file, which is followed by the line ends and then the line hashes of the indexed file.
+ *
+ * All fields are stored in the byte order of the machine which wrote the index, so that indexes written on machines
+ * with another byte order are rejected by their magic number.
+ */
+struct line_index_header {
+  std::uint64_t magic;
+  // Hash of a fixed string, so that indexes are rebuilt whenever `hash_line` changes
+  std::uint64_t hash_probe;
+  std::uint64_t file_size;
+  std::int64_t file_mtime;
+  // Hash of the whole contents of the file, which is checked if its modification time changed
+  std::uint64_t fingerprint;
+  std::uint64_t line_count;
+  // Hash of the line ends and hashes following the header
+  std::uint64_t checksum;
+};
+
+constexpr std::size_t line_index_header_words = sizeof(line_index_header) / sizeof(std::uint64_t);
+constexpr std::uint64_t line_index_magic =
+    std::bit_cast<std::uint64_t>(std::array{'N', 'D', 'L', 'N', 'I', 'D', 'X', '1'});
+
+auto line_index_hash_probe() -> std::uint64_t { return hash_line("nanodiff line index"); }
+
+auto hash_words(std::span<const std::uint64_t> words) -> std::uint64_t {
+  // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
+  return hash_line(std::string_view{reinterpret_cast<const char*>(words.data()), words.size_bytes()});
+}
+
+/**
+ * @brief Returns the path of the file holding the line index of the file at @code path @endcode, which is stored next
+ * to the file, or if @code index_dir @endcode is not empty, in that directory under a name derived from the path.
+ */
+auto line_index_path(const std::filesystem::path& path, const std::filesystem::path& index_dir)
+    -> std::filesystem::path {
+  if (index_dir.empty()) {
+    auto index_path = path;
+    index_path += ".ndindex";
+    return index_path;
+  }
+
+  std::error_code ec{};
+  const auto absolute = std::filesystem::absolute(path, ec).lexically_normal();
+  return index_dir / std::format("{:016x}.ndindex", hash_line((ec ? path : absolute).string()));
+}
+
+/**
+ * @brief Splits @code contents @endcode into lines in the same way as @code memory_line_reader @endcode, and returns
+ * the end and hash of each line in the layout of a line index file.
+ */
+auto build_line_index(std::string_view contents, std::int64_t mtime) -> std::vector<std::uint64_t> {
+  std::vector<std::uint64_t> ends{};
+  std::vector<std::uint64_t> hashes{};
+  const auto* const last = contents.data() + contents.size();
+  for (const auto* begin = contents.data();;) {
+    const auto* const newline = kernels.find_newline(begin, last);
+    ends.push_back(static_cast<std::uint64_t>(newline - contents.data()));
+    hashes.push_back(hash_line(std::string_view{begin, newline}));
+    if (newline == last) {
+      break;
+    }
+    begin = newline + 1;
+  }
+
+  std::vector<std::uint64_t> words(line_index_header_words);
+  words.reserve(line_index_header_words + ends.size() + hashes.size());
+  words.insert(words.end(), ends.begin(), ends.end());
+  words.insert(words.end(), hashes.begin(), hashes.end());
+  const auto header = line_index_header{
+      .magic = line_index_magic,
+      .hash_probe = line_index_hash_probe(),
+      .file_size = contents.size(),
+      .file_mtime = mtime,
+      .fingerprint = hash_line(contents),
+      .line_count = ends.size(),
+      .checksum = hash_words(std::span{words}.subspan(line_index_header_words)),
+  };
+  std::memcpy(words.data(), &header, sizeof(header));
+  return words;
+}
+
+/**
+ * @brief Validates the contents of a line index file against the file it indexes, and returns the index if it is
+ * intact and up to date.
+ *
+ * An index is up to date if the size of the file is unchanged and either its modification time or the hash of its
+ * contents is unchanged. Every line end is checked to be within the file, so that an index which passes these checks
+ * but does not match the file can still never cause lines to be read out of bounds.
+ */
+auto validate_line_index(std::span<const std::uint64_t> words, std::string_view contents, std::int64_t mtime)
+    -> std::optional<line_index_view> {
+  if (words.size() < line_index_header_words) {
+    return std::nullopt;
+  }
+  line_index_header header{};
+  std::memcpy(&header, words.data(), sizeof(header));
+  const auto body = words.subspan(line_index_header_words);
+  if (header.magic != line_index_magic || header.hash_probe != line_index_hash_probe() ||
+      header.file_size != contents.size() || header.line_count == 0 || body.size() / 2 != header.line_count ||
+      body.size() % 2 != 0 || hash_words(body) != header.checksum) {
+    return std::nullopt;
+  }
+
+  const auto index = line_index::split(body);
+  for (std::size_t i = 0; i < index.ends.size(); ++i) {
+    if (index.ends[i] > contents.size() || (i != 0 && index.ends[i] <= index.ends[i - 1])) {
+      return std::nullopt;
+    }
+  }
+  if (index.ends.back() != contents.size()) {
+    return std::nullopt;
+  }
+
+  if (header.file_mtime != mtime && header.fingerprint != hash_line(contents)) {
+    return std::nullopt;
+  }
+  return index;
+}
+
+/**
+ * @brief Updates the modification time stored in the line index file at @code index_path @endcode, once the contents
+ * of the indexed file are known to be unchanged, so that later runs need not hash them again.
+ *
+ * Only the field itself is overwritten, so that concurrent readers see either time, with which the index is valid in
+ * both cases. Errors are ignored, since the index is only a cache.
+ */
+void update_line_index_mtime(const std::filesystem::path& index_path, std::int64_t mtime) {
+  const unique_fd fd{::open(index_path.c_str(), O_WRONLY | O_CLOEXEC)};
+  if (fd) {
+    static_cast<void>(::pwrite(fd.get(), &mtime, sizeof(mtime), offsetof(line_index_header, file_mtime)));
+  }
+}
+
+/**
+ * @brief Memory-maps the line index file at @code index_path @endcode, and returns it if it is valid for a file with
+ * the given contents and modification time.
+ *
+ * If the index is only valid because the contents of the file are unchanged, its modification time is updated.
+ */
+auto load_line_index(const std::filesystem::path& index_path, std::string_view contents, std::int64_t mtime)
+    -> std::optional<line_index> {
+  const unique_fd fd{::open(index_path.c_str(), O_RDONLY | O_CLOEXEC)};
+  struct stat index_stat {};
+  if (!fd || ::fstat(fd.get(), &index_stat) != 0 || !S_ISREG(index_stat.st_mode) ||
+      static_cast<std::size_t>(index_stat.st_size) < sizeof(line_index_header) ||
+      index_stat.st_size % sizeof(std::uint64_t) != 0) {
+    return std::nullopt;
+  }
+
+  const auto size = static_cast<std::size_t>(index_stat.st_size);
+  void* addr = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd.get(), 0);
+  if (addr == MAP_FAILED) {
+    return std::nullopt;
+  }
+  const auto view = validate_line_index(
+      std::span{static_cast<const std::uint64_t*>(addr), size / sizeof(std::uint64_t)}, contents, mtime);
+  if (!view) {
+    ::munmap(addr, size);
+    return std::nullopt;
+  }
+
+  line_index_header header{};
+  std::memcpy(&header, addr, sizeof(header));
+  if (header.file_mtime != mtime) {
+    update_line_index_mtime(index_path, mtime);
+  }
+  return line_index{addr, size, *view};
+}
+
+/**
+ * @brief Writes a line index file, replacing any existing one at once, so that concurrent readers never see a
+ * partially written index.
+ *
+ * Errors are ignored, since the index is only a cache.
+ */
+void save_line_index(const std::filesystem::path& index_path, std::span<const std::uint64_t> words) {
+  std::error_code ec{};
+  if (index_path.has_parent_path()) {
+    std::filesystem::create_directories(index_path.parent_path(), ec);
+  }
+
+  auto temp_path = index_path;
+  temp_path += std::format(".{}.{:x}.tmp", ::getpid(), std::hash<std::thread::id>{}(std::this_thread::get_id()));
+  {
+    std::ofstream stream{temp_path, std::ios::binary | std::ios::trunc};
+    // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
+    stream.write(reinterpret_cast<const char*>(words.data()), static_cast<std::streamsize>(words.size_bytes()));
+    if (stream.close(); !stream) {
+      std::filesystem::remove(temp_path, ec);
+      return;
+    }
+  }
+  std::filesystem::rename(temp_path, index_path, ec);
+  if (ec) {
+    std::filesystem::remove(temp_path, ec);
+  }
+}
+#endif  // NANODIFF_HAS_POSIX
+
+/**
+ * @brief Splits the file read by @code reader @endcode using the line index in its index file, or if it is missing,
+ * corrupt or stale, builds the index and saves it for later runs.
+ *
+ * Only memory-mapped files are indexed. If the index cannot be loaded or saved, the file is still read correctly.
+ */
+void attach_line_index([[maybe_unused]] file_line_reader& reader,
+                       [[maybe_unused]] const std::filesystem::path& path,
+                       [[maybe_unused]] const std::filesystem::path& index_dir) {
+#ifdef NANODIFF_HAS_POSIX
+  auto* const mapped = std::get_if<mapped_line_reader>(&reader);
+  if (mapped == nullptr || path.string() == stdin_path || mapped->contents().value_or("").empty()) {
+    return;
+  }
+
+  // The size and modification time were taken from the mapped descriptor before mapping it, so that an index built
+  // from contents written after that is never tagged with a time at which they were already current
+  const auto mtime = mapped->mtime();
+  const auto contents = *mapped->contents();
+  const auto index_path = line_index_path(path, index_dir);
+  if (auto index = load_line_index(index_path, contents, mtime)) {
+    mapped->set_index(std::move(*index));
+    return;
+  }
+
+  auto words = build_line_index(contents, mtime);
+  save_line_index(index_path, words);
+  mapped->set_index(line_index{std::move(words), line_index_header_words});
+#endif  // NANODIFF_HAS_POSIX
+}
+
+/**
+ * @brief Compares and hashes lines, ignoring the differences between lines selected in the diff options.
+ *
+ * Lines which are equal under the comparison always have equal hashes, so that lines can be matched by their hashes,
+ * and only lines with equal hashes need to be compared. If numbers are compared with a tolerance, this is achieved by
+ * hashing every number as the same placeholder.
+ */
+class line_comparator {
+ public:
+  explicit line_comparator(const diff_options& options) noexcept :
+      _abs_tolerance{options.abs_tolerance},
+      _rel_tolerance{options.rel_tolerance},
+      _ignore_trailing_space{options.ignore_trailing_space || options.ignore_all_space},
+      _ignore_all_space{options.ignore_all_space},
+      _ignore_case{options.ignore_case},
+      _ignore_blank_lines{options.ignore_blank_lines} {}
+
+  /**
+   * @brief Whether lines are only equal if they are identical.
+   */
+  [[nodiscard]] auto is_exact() const noexcept -> bool {
+    return !_ignore_trailing_space && !_ignore_case && !has_tolerance();
+  }
+
+  /**
+   * @brief Whether numbers are compared with a tolerance.
+   *
+   * This makes the comparison intransitive, i.e. lines cannot be grouped into classes of equal lines.
+   */
+  [[nodiscard]] auto has_tolerance() const noexcept -> bool { return _abs_tolerance > 0 || _rel_tolerance > 0; }
+
+  /**
+   * @brief Returns a comparator which compares numbers as text, but otherwise compares lines like this one.
+   */
+  [[nodiscard]] auto without_tolerance() const noexcept -> line_comparator {
+    auto comparator = *this;
+    comparator._abs_tolerance = 0;
+    comparator._rel_tolerance = 0;
+    return comparator;
+  }
+
+  /**
+   * @brief Whether any lines are skipped instead of being compared.
+   */
+  [[nodiscard]] auto ignores_lines() const noexcept -> bool { return _ignore_blank_lines; }
+
+  /**
+   * @brief Whether @code line @endcode is skipped in both files instead of being compared.
+   */
+  [[nodiscard]] auto is_ignored(std::string_view line) const noexcept -> bool {
+    return _ignore_blank_lines && std::ranges::all_of(line, is_space);
+  }
+
+  [[nodiscard]] auto equal(std::string_view lhs, std::string_view rhs) const noexcept -> bool {
+    if (is_exact()) {
+      return lines_equal(lhs, rhs);
+    }
+    // Identical lines are equal under any comparison, so only lines which differ are split into tokens
+    if (lines_equal(lhs, rhs)) {
+      return true;
+    }
+
+    lhs = strip(lhs);
+    rhs = strip(rhs);
+    if (!has_tolerance()) {
+      auto lhs_it = lhs.begin();
+      auto rhs_it = rhs.begin();
+      while (true) {
+        if (_ignore_all_space) {
+          lhs_it = std::find_if_not(lhs_it, lhs.end(), is_space);
+          rhs_it = std::find_if_not(rhs_it, rhs.end(), is_space);
+        }
+        if (lhs_it == lhs.end() || rhs_it == rhs.end()) {
+          return lhs_it == lhs.end() && rhs_it == rhs.end();
+        }
+        if (fold(*lhs_it++) != fold(*rhs_it++)) {
+          return false;
+        }
+      }
+    }
+
+    line_cursor lhs_cursor{.line = lhs};
+    line_cursor rhs_cursor{.line = rhs};
+    while (true) {
+      const auto lhs_token = next_token(lhs_cursor);
+      const auto rhs_token = next_token(rhs_cursor);
+      if (!lhs_token || !rhs_token) {
+        return !lhs_token && !rhs_token;
+      }
+      if (lhs_token->is_number != rhs_token->is_number) {
+        return false;
+      }
+      if (lhs_token->is_number ? !numbers_equal(*lhs_token, *rhs_token)
+                               : fold(lhs_token->text.front()) != fold(rhs_token->text.front())) {
+        return false;
+      }
+    }
+  }
+
+  [[nodiscard]] auto hash(std::string_view line) const noexcept -> std::uint64_t {
+    if (is_exact()) {
+      return hash_line(line);
+    }
+
+    // The normalized line is hashed in fixed-size chunks, so that it never needs to be stored in full
+    std::array<char, 256> chunk{};
+    std::size_t chunk_size{};
+    std::uint64_t h{};
+    auto append = [&](char c) {
+      if (chunk_size == chunk.size()) {
+        h = std::rotl(h, 31) ^ hash_line(std::string_view{chunk.data(), chunk_size});
+        chunk_size = 0;
+      }
+      chunk[chunk_size++] = c;
+    };
+    if (has_tolerance()) {
+      line_cursor cursor{.line = strip(line)};
+      while (const auto token = next_token(cursor)) {
+        append(token->is_number ? number_placeholder : fold(token->text.front()));
+      }
+    } else {
+      for (const auto c : strip(line)) {
+        if (!_ignore_all_space || !is_space(c)) {
+          append(fold(c));
+        }
+      }
+    }
+
+    return std::rotl(h, 31) ^ hash_line(std::string_view{chunk.data(), chunk_size});
+  }
+
+ private:
+  // Character which replaces every number when hashing a line, so that numbers within the tolerance hash equally
+  static constexpr char number_placeholder = '\0';
+
+  /**
+   * @brief Position within a line which is being split into tokens.
+   */
+  struct line_cursor {
+    std::string_view line;
+    std::size_t pos{};
+    // Last character of the previous token, or a space at the start of the line
+    char prev{' '};
+  };
+
+  /**
+   * @brief Either a single character or a number of a line in which numbers are compared with a tolerance.
+   */
+  struct line_token {
+    std::string_view text;
+    bool is_number;
+    // Whether `value` holds the parsed number, which is not the case if it is out of range
+    bool is_parsed;
+    double value;
+  };
+
+  static auto is_space(char c) noexcept -> bool {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+  }
+
+  static auto is_digit(char c) noexcept -> bool { return c >= '0' && c <= '9'; }
+
+  /**
+   * @brief Reads the next token of the normalized line at @code cursor @endcode, without allocating.
+   *
+   * Numbers start with a digit, a `.` followed by a digit, or a `-` followed by either, and are only recognized if
+   * they are not preceded by a letter, digit, `_` or `.`, so that e.g. the digits of `x86` or the parts of a version
+   * `1.2.3` after the first number are compared as text. The extent of a number is determined by @code std::from_chars @endcode.
+   */
+  [[nodiscard]] auto next_token(line_cursor& cursor) const noexcept -> std::optional<line_token> {
+    const auto line = cursor.line;
+    if (_ignore_all_space) {
+      // Skipped spaces still separate a number from the word before it
+      while (cursor.pos < line.size() && is_space(line[cursor.pos])) {
+        cursor.prev = line[cursor.pos++];
+      }
+    }
+    if (cursor.pos == line.size()) {
+      return std::nullopt;
+    }
+
+    const auto c = line[cursor.pos];
+    const auto prev = std::exchange(cursor.prev, c);
+    const bool is_word_prev = is_digit(prev) || prev == '_' || prev == '.' || (prev >= 'a' && prev <= 'z') ||
+                              (prev >= 'A' && prev <= 'Z');
+    auto is_digit_at = [line](std::size_t pos) { return pos < line.size() && is_digit(line[pos]); };
+    const auto after_sign = c == '-' ? cursor.pos + 1 : cursor.pos;
+    const bool starts_number =
+        is_digit_at(after_sign) || (after_sign < line.size() && line[after_sign] == '.' && is_digit_at(after_sign + 1));
+    if (is_word_prev || !starts_number) {
+      return line_token{.text = line.substr(cursor.pos++, 1), .is_number = false, .is_parsed = false, .value = 0};
+    }
+
+    double value{};
+    const auto* const first = line.data() + cursor.pos;
+    const auto [ptr, ec] = std::from_chars(first, line.data() + line.size(), value);
+    const auto text = line.substr(cursor.pos, static_cast<std::size_t>(ptr - first));
+    cursor.pos += text.size();
+    cursor.prev = '0';
+    return line_token{.text = text, .is_number = true, .is_parsed = ec == std::errc{}, .value = value};
+  }
+
+  [[nodiscard]] auto numbers_equal(const line_token& lhs, const line_token& rhs) const noexcept -> bool {
+    if (lhs.text == rhs.text) {
+      return true;
+    }
+    if (!lhs.is_parsed || !rhs.is_parsed) {
+      return false;
+    }
+
+    const auto difference = std::abs(lhs.value - rhs.value);
+    return difference <= _abs_tolerance ||
+           difference <= _rel_tolerance * std::max(std::abs(lhs.value), std::abs(rhs.value));
+  }
+
+  /**
+   * @brief Removes the trailing whitespace of @code line @endcode if it is ignored.
+   */
+  [[nodiscard]] auto strip(std::string_view line) const noexcept -> std::string_view {
+    if (_ignore_trailing_space) {
+      while (!line.empty() && is_space(line.back())) {
+        line.remove_suffix(1);
+      }
+    }
+    return line;
+  }
+
+  [[nodiscard]] auto fold(char c) const noexcept -> char {
+    return _ignore_case && c >= 'A' && c <= 'Z' ? static_cast<char>(c - 'A' + 'a') : c;
+  }
+
+  double _abs_tolerance;
+  double _rel_tolerance;
+  bool _ignore_trailing_space;
+  bool _ignore_all_space;
+  bool _ignore_case;
+  bool _ignore_blank_lines;
+};
+
+/**
+ * @brief Adds @code count @endcode to a counter of @code stats @endcode, if statistics are collected.
+ */
+void count_stat(diff_stats* stats, std::size_t diff_stats::* counter, std::size_t count = 1) {
+  if constexpr (stats_enabled) {
+    if (stats != nullptr) {
+      stats->*counter += count;
+    }
+  }
+}
+
+/**
+ * @brief Invokes @code fn @endcode, and adds the time it takes to a timer of @code stats @endcode if statistics are
+ * collected.
+ */
+template<std::invocable Fn>
+auto time_stat(diff_stats* stats, std::chrono::nanoseconds diff_stats::* timer, Fn&& fn) -> std::invoke_result_t<Fn> {
+  if constexpr (stats_enabled) {
+    if (stats != nullptr) {
+      const auto start = std::chrono::steady_clock::now();
+      const auto add_elapsed = [&] {
+        stats->*timer += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+      };
+      if constexpr (std::is_void_v<std::invoke_result_t<Fn>>) {
+        std::invoke(std::forward<Fn>(fn));
+        add_elapsed();
+        return;
+      } else {
+        auto result = std::invoke(std::forward<Fn>(fn));
+        add_elapsed();
+        return result;
+      }
+    }
+  }
+  return std::invoke(std::forward<Fn>(fn));
+}
+
+/**
+ * @brief Adds the statistics of a part of a comparison to those of the whole comparison.
+ */
+void merge_stats(diff_stats& stats, const diff_stats& part) {
+  stats.expected_lines += part.expected_lines;
+  stats.expected_bytes += part.expected_bytes;
+  stats.actual_lines += part.actual_lines;
+  stats.actual_bytes += part.actual_bytes;
+  stats.skipped_bytes += part.skipped_bytes;
+  stats.buffer_peak_lines = std::max(stats.buffer_peak_lines, part.buffer_peak_lines);
+  stats.buffer_peak_bytes = std::max(stats.buffer_peak_bytes, part.buffer_peak_bytes);
+  stats.buffer_samples += part.buffer_samples;
+  stats.buffer_total_lines += part.buffer_total_lines;
+  stats.line_comparisons += part.line_comparisons;
+  stats.hash_probes += part.hash_probes;
+  stats.allocations += part.allocations;
+  stats.allocated_bytes += part.allocated_bytes;
+  stats.total_time += part.total_time;
+  stats.io_time += part.io_time;
+  stats.output_time += part.output_time;
+}
+
+/**
+ * @brief Returns the time of a comparison spent matching lines, i.e. neither reading nor outputting them.
+ */
+auto match_time(const diff_stats& stats) -> std::chrono::nanoseconds {
+  // Reading and outputting lines may take longer than the whole comparison if segments are compared concurrently
+  return std::max(stats.total_time - stats.io_time - stats.output_time, std::chrono::nanoseconds{});
+}
+
+/**
+ * @brief Adds the time taken and the allocations made on this thread during its lifetime to @code stats @endcode, if
+ * statistics are collected.
+ */
+class stats_scope {
+ public:
+  explicit stats_scope([[maybe_unused]] diff_stats* stats) noexcept {
+#ifdef NANODIFF_STATS
+    _stats = stats;
+    if (_stats != nullptr) {
+      _start = std::chrono::steady_clock::now();
+      _allocations = thread_allocations;
+      _allocated_bytes = thread_allocated_bytes;
+    }
+#endif  // NANODIFF_STATS
+  }
+  stats_scope(const stats_scope&) = delete;
+  stats_scope(stats_scope&&) noexcept = delete;
+
+  ~stats_scope() {
+#ifdef NANODIFF_STATS
+    if (_stats != nullptr) {
+      _stats->total_time +=
+          std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - _start);
+      _stats->allocations += thread_allocations - _allocations;
+      _stats->allocated_bytes += thread_allocated_bytes - _allocated_bytes;
+    }
+#endif  // NANODIFF_STATS
+  }
+
+  auto operator=(const stats_scope&) -> stats_scope& = delete;
+  auto operator=(stats_scope&&) noexcept -> stats_scope& = delete;
+
+ private:
+#ifdef NANODIFF_STATS
+  diff_stats* _stats{};
+  std::chrono::steady_clock::time_point _start{};
+  std::size_t _allocations{};
+  std::size_t _allocated_bytes{};
+#endif  // NANODIFF_STATS
+};
+
+/**
+ * @brief Buffer of look-ahead lines read from the actual file, which are indexed by the hash of each line.
+ *
+ * Lines with the same hash are chained in the order they are pushed, so that the earliest line matching a given line
+ * can be found in expected O(1) time.
+ */
+class actual_line_buffer {
+ public:
+  /**
+   * @brief Creates a buffer which copies the lines pushed into it, unless they are @code borrowed @endcode from an
+   * input which outlives the buffer.
+   */
+  explicit actual_line_buffer(bool borrowed) noexcept : _borrowed{borrowed} {}
+
+  [[nodiscard]] auto empty() const -> bool { return _lines.empty(); }
+  [[nodiscard]] auto size() const -> std::size_t { return _lines.size(); }
+  // Total size of all buffered lines
+  [[nodiscard]] auto bytes() const -> std::size_t { return _bytes; }
+  [[nodiscard]] auto operator[](std::size_t idx) const -> std::string_view { return _lines[idx].line; }
+
+  void push_back(std::string_view line, std::uint64_t hash) {
+    const auto pos = _front_pos + _lines.size();
+
+    if (const auto [chain_it, inserted] = _index.try_emplace(hash, hash_chain{.head = pos, .tail = pos}); !inserted) {
+      _lines[chain_it->second.tail - _front_pos].next = pos;
+      chain_it->second.tail = pos;
+    }
+
+    if (!_borrowed) {
+      // Elements of a deque are never moved by adding or removing elements at either end
+      line = _copies.emplace_back(line);
+    }
+    _bytes += line.size();
+    _lines.emplace_back(buffered_line{.line = line, .hash = hash, .next = npos});
+  }
+
+  /**
+   * @brief Finds the earliest buffered line which is equal to @code line @endcode under @code comparator @endcode.
+   *
+   * Lines must have been pushed with their hash under the same comparator.
+   *
+   * @return Index of the matching line relative to the front of the buffer, or @code std::nullopt @endcode if no lines
+   * in the buffer match.
+   */
+  [[nodiscard]] auto find(std::string_view line,
+                          std::uint64_t hash,
+                          const line_comparator& comparator,
+                          diff_stats* stats = nullptr) const -> std::optional<std::size_t> {
+    count_stat(stats, &diff_stats::hash_probes);
+    const auto chain_it = _index.find(hash);
+    if (chain_it == _index.end()) {
+      return std::nullopt;
+    }
+
+    for (auto pos = chain_it->second.head; pos != npos; pos = _lines[pos - _front_pos].next) {
+      count_stat(stats, &diff_stats::line_comparisons);
+      if (comparator.equal(_lines[pos - _front_pos].line, line)) {
+        return pos - _front_pos;
+      }
+    }
+
+    return std::nullopt;
+  }
+
+  /**
+   * @brief Removes the first @code count @endcode lines from the buffer.
+   */
+  void erase_front(std::size_t count) {
+    for (std::size_t i = 0; i < count; ++i) {
+      const auto& front = _lines.front();
+
+      // Lines are always removed in the order they are pushed, so the front line is always the head of its chain
+      const auto chain_it = _index.find(front.hash);
+      assert(chain_it != _index.end() && chain_it->second.head == _front_pos);
+      if (front.next == npos) {
+        _index.erase(chain_it);
+      } else {
+        chain_it->second.head = front.next;
+      }
+
+      _bytes -= front.line.size();
+      _lines.pop_front();
+      if (!_borrowed) {
+        _copies.pop_front();
+      }
+      ++_front_pos;
+    }
+  }
+
+ private:
+  static constexpr std::size_t npos = std::numeric_limits<std::size_t>::max();
+
+  struct buffered_line {
+    std::string_view line;
+    std::uint64_t hash;
+    // Absolute position of the next buffered line with the same hash
+    std::size_t next;
+  };
+
+  struct hash_chain {
+    std::size_t head;
+    std::size_t tail;
+  };
+
+  bool _borrowed;
+  std::deque<buffered_line> _lines;
+  // Copies of the lines in `_lines`, unless they are borrowed
+  std::deque<std::string> _copies;
+  // Absolute position of the line at the front of `_lines`
+  std::size_t _front_pos{};
+  std::size_t _bytes{};
+  std::unordered_map<std::uint64_t, hash_chain> _index;
+};
+
+/**
+ * @brief Contiguous storage for all lines of a file, which are indexed by the offset of the end of each line.
+ *
+ * Each line is stored followed by a newline, so that the start of each line is implied by the end of the previous
+ * line, and only 8 bytes of index are needed per line. The bytes are either copied into a single buffer owned by the
+ * arena, or borrowed from the contents of a reader if they stay in memory.
+ */
+class line_arena {
+ public:
+  line_arena() = default;
+  /**
+   * @brief Creates an arena whose lines are all views into @code contents @endcode, which must outlive the arena.
+   */
+  explicit line_arena(std::string_view contents) : _contents{contents}, _is_borrowed{true} {}
+  line_arena(const line_arena&) = delete;
+  line_arena(line_arena&&) noexcept = default;
+
+  ~line_arena() = default;
+
+  auto operator=(const line_arena&) -> line_arena& = delete;
+  auto operator=(line_arena&&) noexcept -> line_arena& = default;
+
+  [[nodiscard]] auto size() const noexcept -> std::size_t { return _ends.size(); }
+  // Total size of all lines, including the newlines between them
+  [[nodiscard]] auto bytes() const noexcept -> std::size_t { return _ends.empty() ? 0 : _ends.back(); }
+
+  [[nodiscard]] auto operator[](std::size_t idx) const noexcept -> std::string_view {
+    // The empty line following an unterminated last line is not preceded by a newline
+    const auto begin = idx == 0 ? 0 : std::min(_ends[idx - 1] + 1, _ends[idx]);
+    return std::string_view{_is_borrowed ? _contents.data() : _buffer.data(), _ends[idx]}.substr(begin);
+  }
+
+  void reserve(std::size_t nlines) { _ends.reserve(nlines); }
+
+  /**
+   * @brief Appends a line to the arena.
+   *
+   * If the arena borrows its contents, @code line @endcode must be a view into them, which immediately follows the
+   * previous line.
+   */
+  void push_back(std::string_view line) {
+    if (_is_borrowed) {
+      assert(line.data() >= _contents.data() && line.data() + line.size() <= _contents.data() + _contents.size());
+      _ends.push_back(static_cast<std::size_t>(line.data() - _contents.data()) + line.size());
+      return;
+    }
+
+    _buffer.append(line);
+    _ends.push_back(_buffer.size());
+    _buffer.push_back('\n');
+  }
+
+ private:
+  std::string_view _contents;
+  std::string _buffer;
+  std::vector<std::size_t> _ends;
+  bool _is_borrowed{};
+};
+
+/**
+ * @brief Any callable which receives the lines of a diff, such as @code output_sink @endcode or @code diff_line_cb
+ * @endcode.
+ */
+template<typename Sink>
+concept diff_line_sink = std::invocable<Sink&, const diff_line&>;
+
+/**
+ * @brief Wrapper around a function reading the lines of a file, which holds back the empty line following the final
+ * newline of the file.
+ *
+ * This line is not a line of the file, so the greedy algorithm only matches it against that of the other file, after
+ * all other lines. It is told apart from other empty lines by reading one line ahead after each empty line. This may
+ * invalidate the view of the empty line, which is never read through as it is empty.
+ */
+template<typename ReadLine>
+class final_line_holder {
+ public:
+  explicit final_line_holder(ReadLine read_line) : _read_line{std::move(read_line)} {}
+
+  /**
+   * @return The next line, or @code std::nullopt @endcode once only the final empty line, if any, is left.
+   */
+  auto operator()() -> std::optional<std::string_view> {
+    const auto line = _next ? *std::exchange(_next, std::nullopt) : _read_line();
+    if (!line || !line->empty()) {
+      return line;
+    }
+
+    _next = _read_line();
+    if (!*_next) {
+      _final_line = line;
+      return std::nullopt;
+    }
+    return line;
+  }
+
+  /**
+   * @brief Returns the final empty line if it was held back.
+   */
+  [[nodiscard]] auto final_line() const noexcept -> std::optional<std::string_view> { return _final_line; }
+
+ private:
+  ReadLine _read_line;
+  // Line read ahead after an empty line, which is returned next
+  std::optional<std::optional<std::string_view>> _next{};
+  std::optional<std::string_view> _final_line{};
+};
+
+/**
+ * @brief Base class of differs, which implements the greedy diff algorithm over the lines returned by the
+ * @code read_expected_line() @endcode and @code read_actual_line() @endcode functions of @code Derived @endcode.
+ *
+ * Actual lines are only copied while looking ahead if @code actual_lines_persist() @endcode of @code Derived @endcode
+ * is false, i.e. the views returned by @code read_actual_line() @endcode may be invalidated by reading further.
+ *
+ * Both functions and the sink are resolved at compile time, so that the whole loop can be inlined.
+ */
+template<typename Derived>
+class file_differ {
+ public:
+  /**
+   * @brief Whether removing the common trailing lines of both files before diffing, and outputting them as context
+   * lines afterwards, produces the same diff.
+   *
+   * The greedy algorithm may match a line against one in the common suffix, so it must see the whole file.
+   */
+  static constexpr bool preserves_common_suffix = false;
+
+  /**
+   * @brief Number of expected lines which were output as missing because the look-ahead limit was reached before a
+   * matching actual line was found.
+   */
+  [[nodiscard]] auto lookahead_exceeded() const noexcept -> std::size_t { return _lookahead_exceeded; }
+
+  /**
+   * @brief Compares the files, and outputs the diff to @code line_callback @endcode.
+   *
+   * @param has_diff Whether changes were already output before the lines read by this differ, in which case the
+   * context lines before the first change are output too. This allows the diff of a part of a file to continue the
+   * diff of the part before it.
+   * @return Whether any changes were output, including before the lines read by this differ.
+   */
+  template<diff_line_sink Sink>
+  auto do_diff(Sink& line_callback, bool has_diff = false) -> bool {
+    // !! Buffer containing all lines that are not present in the expected file up to a given point
+    actual_line_buffer actual_buffer{self().actual_lines_persist()};
+
+    // Number of context lines output since the last change
+    std::size_t context_run{};
+    // Whether the last expected line was output as `-` because the look-ahead limit was reached
+    bool lookahead_missed{};
+
+    auto* const stats = _options.stats;
+    auto emit = [&line_callback, stats](const diff_line& line) {
+      time_stat(stats, &diff_stats::output_time, [&] { line_callback(line); });
+    };
+
+    // Outputs the first `nlines` lines of `actual_buffer` as `+`
+    auto output_diff = [&emit, &has_diff, &context_run, &actual_buffer](std::size_t nlines) {
+      has_diff |= nlines != 0;
+      context_run = nlines != 0 ? 0 : context_run;
+
+      for (std::size_t i = 0; i < nlines; ++i) {
+        emit(diff_line{.line = actual_buffer[i], .type = diff_line_type::actual_only});
+      }
+    };
+
+    // Ignored lines are skipped as soon as they are read, and the final empty line of each file is held back
+    final_line_holder read_expected_line{[this] {
+      auto line = self().read_expected_line();
+      while (line && _comparator.is_ignored(*line)) {
+        line = self().read_expected_line();
+      }
+      return line;
+    }};
+    final_line_holder read_actual_line{[this] {
+      auto line = self().read_actual_line();
+      while (line && _comparator.is_ignored(*line)) {
+        line = self().read_actual_line();
+      }
+      return line;
+    }};
+
+    auto expected_line{read_expected_line()};
+    while (expected_line) {
+      // Each line is hashed at most once, and only if it is not identical to the line it is first compared against.
+      // Unless lines are compared exactly, lines are only compared further if their hashes are equal.
+      std::optional<std::uint64_t> expected_hash{};
+      auto get_expected_hash = [&] {
+        if (!expected_hash) {
+          expected_hash = self().expected_line_hash(*expected_line);
+        }
+        return *expected_hash;
+      };
+
+      std::optional<std::size_t> matching_actual_idx{};
+      if (!actual_buffer.empty()) {
+        matching_actual_idx = actual_buffer.find(*expected_line, get_expected_hash(), _comparator, stats);
+      }
+
+      // If the previous expected line was not found in a full buffer either, the actual file may contain more inserted
+      // lines than fit into it, so the oldest buffered lines are output as `+` to look further ahead. The buffer moves
+      // by one line more than it holds, so that it catches up with the expected file for every line given up on.
+      std::size_t evictable_lines = lookahead_missed ? actual_buffer.size() + 1 : 0;
+      lookahead_missed = false;
+      while (!matching_actual_idx) {
+        if (actual_buffer.size() >= _options.max_lookahead_lines ||
+            actual_buffer.bytes() >= _options.max_lookahead_bytes) {
+          // Give up on this line rather than buffering more of the actual file, which may be arbitrarily large
+          if (actual_buffer.empty() || evictable_lines == 0) {
+            ++_lookahead_exceeded;
+            lookahead_missed = true;
+            break;
+          }
+
+          output_diff(1);
+          actual_buffer.erase_front(1);
+          --evictable_lines;
+          continue;
+        }
+
+        auto actual_line = read_actual_line();
+        if (!actual_line) {
+          break;
+        }
+
+        // Lines which match immediately are never buffered, and identical lines are never hashed
+        count_stat(stats, &diff_stats::line_comparisons);
+        if (lines_equal(*actual_line, *expected_line)) {
+          matching_actual_idx = actual_buffer.size();
+          break;
+        }
+        const auto actual_hash = _comparator.hash(*actual_line);
+        if (!_comparator.is_exact() && actual_hash == get_expected_hash()) {
+          count_stat(stats, &diff_stats::line_comparisons);
+          if (_comparator.equal(*actual_line, *expected_line)) {
+            matching_actual_idx = actual_buffer.size();
+            break;
+          }
+        }
+
+        // Either this line is output as `+`, or the expected line is output as `-`
+        if (_options.stop == diff_stop::at_first_difference) {
+          return true;
+        }
+
+        actual_buffer.push_back(*actual_line, actual_hash);
+      }
+
+      if constexpr (stats_enabled) {
+        if (stats != nullptr) {
+          ++stats->buffer_samples;
+          stats->buffer_total_lines += actual_buffer.size();
+          stats->buffer_peak_lines = std::max(stats->buffer_peak_lines, actual_buffer.size());
+          stats->buffer_peak_bytes = std::max(stats->buffer_peak_bytes, actual_buffer.bytes());
+        }
+      }
+
+      if (matching_actual_idx) {
+        // We found a matching line in the actual buffer
+        output_diff(*matching_actual_idx);
+        if (has_diff || _options.context_lines) {
+          // The first hunk ends once more context lines follow a change than any hunk includes
+          if (has_diff && _options.stop != diff_stop::never &&
+              context_run++ == 2 * _options.context_lines.value_or(0)) {
+            return true;
+          }
+          emit(diff_line{.line = *expected_line, .type = diff_line_type::context});
+        }
+
+        // Erase all lines up to and including the matching line from `actual_buffer`
+        actual_buffer.erase_front(std::min(*matching_actual_idx + 1, actual_buffer.size()));
+      } else {
+        has_diff = true;
+        context_run = 0;
+        if (_options.stop == diff_stop::at_first_difference) {
+          return true;
+        }
+        emit(diff_line{.line = *expected_line, .type = diff_line_type::expected_only});
+      }
+
+      expected_line = read_expected_line();
+    };
+
+    output_diff(actual_buffer.size());
+    actual_buffer.erase_front(actual_buffer.size());
+
+    auto actual_line{read_actual_line()};
+    while (actual_line) {
+      has_diff = true;
+      context_run = 0;
+      if (_options.stop == diff_stop::at_first_difference) {
+        return true;
+      }
+      emit(diff_line{.line = *actual_line, .type = diff_line_type::actual_only});
+
+      actual_line = read_actual_line();
+    }
+
+    // The final empty lines of both files match each other, and are otherwise missing from or extra in the actual file
+    const auto expected_final = read_expected_line.final_line();
+    const auto actual_final = read_actual_line.final_line();
+    if (expected_final && actual_final) {
+      if (has_diff || _options.context_lines) {
+        if (has_diff && _options.stop != diff_stop::never &&
+            context_run == 2 * _options.context_lines.value_or(0)) {
+          return true;
+        }
+        emit(diff_line{.line = *expected_final, .type = diff_line_type::context});
+      }
+    } else if (expected_final || actual_final) {
+      has_diff = true;
+      if (_options.stop == diff_stop::at_first_difference) {
+        return true;
+      }
+      emit(expected_final ? diff_line{.line = *expected_final, .type = diff_line_type::expected_only}
+                          : diff_line{.line = *actual_final, .type = diff_line_type::actual_only});
+    }
+
+    return has_diff;
+  }
+
+ protected:
+  explicit file_differ(const diff_options& options) : _options{options}, _comparator{options} {}
+  file_differ(const file_differ&) = default;
+  file_differ(file_differ&&) noexcept = default;
+
+  ~file_differ() = default;
+
+  auto operator=(const file_differ&) -> file_differ& = default;
+  auto operator=(file_differ&&) noexcept -> file_differ& = default;
+
+  /**
+   * @brief Hashes the last line returned by @code read_expected_line() @endcode, which @code Derived @endcode may
+   * override if the hash is already known.
+   */
+  [[nodiscard]] auto expected_line_hash(std::string_view line) const -> std::uint64_t { return _comparator.hash(line); }
+
+  diff_options _options;
+  line_comparator _comparator;
+
+ private:
+  auto self() -> Derived& { return static_cast<Derived&>(*this); }
+
+  std::size_t _lookahead_exceeded{};
+};
+
+template<line_source ExpectedReader, line_source ActualReader>
+class eager_file_differ : public file_differ<eager_file_differ<ExpectedReader, ActualReader>> {
+ public:
+  eager_file_differ(const eager_file_differ&) = delete;
+  eager_file_differ(eager_file_differ&&) noexcept = default;
+
+  ~eager_file_differ() = default;
+
+  auto operator=(const eager_file_differ&) -> eager_file_differ& = delete;
+  auto operator=(eager_file_differ&&) noexcept -> eager_file_differ& = default;
+
+  eager_file_differ(ExpectedReader expected, ActualReader actual, const diff_options& options = {}) :
+      file_differ<eager_file_differ>{options},
+      _expected_reader{std::move(expected)},
+      _actual_reader{std::move(actual)},
+      _expected_content{read_all_lines(_expected_reader,
+                                       this->_comparator,
+                                       options.stats,
+                                       &diff_stats::expected_lines,
+                                       &diff_stats::expected_bytes)},
+      _actual_content{read_all_lines(
+          _actual_reader, this->_comparator, options.stats, &diff_stats::actual_lines, &diff_stats::actual_bytes)} {}
+
+ private:
+  friend class file_differ<eager_file_differ>;
+
+  auto read_expected_line() -> std::optional<std::string_view> {
+    if (_expected_pos == _expected_content.size()) {
+      return std::nullopt;
+    }
+    return _expected_content[_expected_pos++];
+  }
+  auto read_actual_line() -> std::optional<std::string_view> {
+    if (_actual_pos == _actual_content.size()) {
+      return std::nullopt;
+    }
+    return _actual_content[_actual_pos++];
+  }
+  [[nodiscard]] static auto actual_lines_persist() noexcept -> bool { return true; }
+
+  /**
+   * @brief Overload of @code read_all_lines @endcode which adds the time taken, and the number of lines and bytes read
+   * to the given counters of @code stats @endcode.
+   */
+  template<line_source Reader>
+  static auto read_all_lines(Reader& reader,
+                             const line_comparator& comparator,
+                             diff_stats* stats,
+                             std::size_t diff_stats::* lines_counter,
+                             std::size_t diff_stats::* bytes_counter) -> line_arena {
+    auto lines = time_stat(stats, &diff_stats::io_time, [&] { return read_all_lines(reader, comparator); });
+    count_stat(stats, lines_counter, lines.size());
+    // Like the lines returned by a reader, each line is counted with a newline
+    count_stat(stats, bytes_counter, lines.size() == 0 ? 0 : lines.bytes() + 1);
+    return lines;
+  }
+
+  /**
+   * @brief Reads all lines which are not ignored by @code comparator @endcode from @code reader @endcode into an arena.
+   *
+   * Lines are only copied into the arena if the views returned by the reader are not persistent, or some lines are
+   * ignored.
+   */
+  template<line_source Reader>
+  static auto read_all_lines(Reader& reader, const line_comparator& comparator) -> line_arena {
+    const auto contents = reader.contents();
+    const auto borrow = contents && reader.is_persistent() && !comparator.ignores_lines();
+    line_arena lines = borrow ? line_arena{*contents} : line_arena{};
+    if (contents) {
+      // Size the index exactly, so that it never needs to be regrown
+      std::size_t nlines{1};
+      const auto* const last = contents->data() + contents->size();
+      for (const auto* it = contents->data(); (it = kernels.find_newline(it, last)) != last; ++it) {
+        ++nlines;
+      }
+      lines.reserve(nlines);
+    }
+
+    auto line = reader.read_line();
+    while (line) {
+      if (!comparator.is_ignored(*line)) {
+        lines.push_back(*line);
+      }
+      line = reader.read_line();
+    }
+
+    return lines;
+  }
+
+  ExpectedReader _expected_reader;
+  ActualReader _actual_reader;
+
+ protected:
+  line_arena _expected_content;
+  line_arena _actual_content;
+  // Number of lines of each file already read by the greedy algorithm
+  std::size_t _expected_pos{};
+  std::size_t _actual_pos{};
+};
+
+/**
+ * @brief Limits on the search for a minimal diff, set by @code max_cost @endcode and @code timeout @endcode of
+ * @code diff_options @endcode. The time limit starts when the budget is created.
+ */
+class diff_budget {
+ public:
+  explicit diff_budget(const diff_options& options) : _max_cost{options.max_cost} {
+    // Timeouts too long to be represented are never reached
+    const auto now = std::chrono::steady_clock::now();
+    if (options.timeout && *options.timeout < std::chrono::duration_cast<std::chrono::milliseconds>(
+                                                  std::chrono::steady_clock::time_point::max() - now)) {
+      _deadline = now + *options.timeout;
+    }
+  }
+
+  /**
+   * @brief Checks whether a search which has found that at least @code cost @endcode lines differ may continue.
+   *
+   * Once this returns @code false @endcode, it always does.
+   */
+  auto allows(std::size_t cost) -> bool {
+    _exceeded = _exceeded || cost > _max_cost || (_deadline && std::chrono::steady_clock::now() >= *_deadline);
+    return !_exceeded;
+  }
+
+  [[nodiscard]] auto exceeded() const noexcept -> bool { return _exceeded; }
+
+ private:
+  std::size_t _max_cost;
+  std::optional<std::chrono::steady_clock::time_point> _deadline{};
+  bool _exceeded{};
+};
+
+/**
+ * @brief Linear-space variant of the Myers O((N+M)D) difference algorithm.
+ *
+ * @code eq(i, j) @endcode returns whether line @code i @endcode of the expected sequence matches line @code j @endcode
+ * of the actual sequence. Every pair of matched lines in the shortest edit script is reported in increasing order via
+ * @code on_match(i, j) @endcode; all lines not reported are either expected-only or actual-only. If @code on_match
+ * @endcode returns @code false @endcode, no further matches are computed or reported.
+ *
+ * If @code budget @endcode is given, no further matches are computed or reported either once it does not allow the
+ * number of lines found to differ within the range being compared. The time taken is then O((N+M)C) for a maximum cost
+ * of C.
+ */
+template<typename Eq, typename OnMatch>
+class myers_diff {
+ public:
+  myers_diff(std::ptrdiff_t n, std::ptrdiff_t m, Eq eq, OnMatch on_match, diff_budget* budget = nullptr) :
+      _n{n},
+      _m{m},
+      _eq{std::move(eq)},
+      _on_match{std::move(on_match)},
+      _budget{budget},
+      _v_forward(static_cast<std::size_t>(n + m + 4)),
+      _v_reverse(static_cast<std::size_t>(n + m + 4)) {}
+
+  /**
+   * @return Whether all matches were reported, i.e. @code on_match @endcode never returned @code false @endcode and the
+   * budget was not exceeded.
+   */
+  auto run() -> bool {
+    compare(0, _n, 0, _m);
+    return !_stopped;
+  }
+
+ private:
+  void report(std::ptrdiff_t i, std::ptrdiff_t j) { _stopped = !_on_match(i, j); }
+
+  void compare(std::ptrdiff_t e_begin, std::ptrdiff_t e_end, std::ptrdiff_t a_begin, std::ptrdiff_t a_end) {
+    // Strip the common prefix and suffix, the latter of which is reported after the middle section
+    while (!_stopped && e_begin < e_end && a_begin < a_end && _eq(e_begin, a_begin)) {
+      report(e_begin++, a_begin++);
+    }
+    auto e_suffix = e_end;
+    auto a_suffix = a_end;
+    while (e_begin < e_suffix && a_begin < a_suffix && _eq(e_suffix - 1, a_suffix - 1)) {
+      --e_suffix;
+      --a_suffix;
+    }
+
+    if (!_stopped && e_begin != e_suffix && a_begin != a_suffix) {
+      if (const auto split = find_middle_snake(e_begin, e_suffix, a_begin, a_suffix)) {
+        compare(e_begin, split->first, a_begin, split->second);
+        compare(split->first, e_suffix, split->second, a_suffix);
+      }
+    }
+
+    for (; !_stopped && e_suffix < e_end; ++e_suffix, ++a_suffix) {
+      report(e_suffix, a_suffix);
+    }
+  }
+
+  /**
+   * @brief Walks the edit graph from both corners until the forward and reverse paths overlap.
+   *
+   * @return The point at which the edit graph should be split, or @code std::nullopt @endcode if the two ranges do not
+   * have any lines in common.
+   */
+  auto find_middle_snake(std::ptrdiff_t e_begin, std::ptrdiff_t e_end, std::ptrdiff_t a_begin, std::ptrdiff_t a_end)
+      -> std::optional<std::pair<std::ptrdiff_t, std::ptrdiff_t>> {
+    const auto n = e_end - e_begin;
+    const auto m = a_end - a_begin;
+    const auto max_d = (n + m + 1) / 2;
+    const auto delta = n - m;
+    const bool front = (delta % 2) != 0;
+
+    // Both V arrays are indexed by diagonal `k` in [-max_d - 1, max_d + 1]
+    const auto v_length = (2 * max_d) + 3;
+    std::fill_n(_v_forward.begin(), v_length, -1);
+    std::fill_n(_v_reverse.begin(), v_length, -1);
+    auto* const v_forward = _v_forward.data() + max_d + 1;
+    auto* const v_reverse = _v_reverse.data() + max_d + 1;
+    v_forward[1] = 0;
+    v_reverse[1] = 0;
+
+    // Diagonals which have run off the edit graph are trimmed from subsequent iterations
+    std::ptrdiff_t k_forward_start = 0;
+    std::ptrdiff_t k_forward_end = 0;
+    std::ptrdiff_t k_reverse_start = 0;
+    std::ptrdiff_t k_reverse_end = 0;
+
+    for (std::ptrdiff_t d = 0; d < max_d; ++d) {
+      for (auto k = -d + k_forward_start; k <= d - k_forward_end; k += 2) {
+        auto x = (k == -d || (k != d && v_forward[k - 1] < v_forward[k + 1])) ? v_forward[k + 1] : v_forward[k - 1] + 1;
+        auto y = x - k;
+        while (x < n && y < m && _eq(e_begin + x, a_begin + y)) {
+          ++x;
+          ++y;
+        }
+        v_forward[k] = x;
+
+        if (x > n) {
+          k_forward_end += 2;
+        } else if (y > m) {
+          k_forward_start += 2;
+        } else if (front) {
+          const auto k_reverse = delta - k;
+          if (k_reverse >= -max_d - 1 && k_reverse <= max_d + 1 && v_reverse[k_reverse] != -1
+              && x >= n - v_reverse[k_reverse]) {
+            return std::make_pair(e_begin + x, a_begin + y);
+          }
+        }
+      }
+
+      for (auto k = -d + k_reverse_start; k <= d - k_reverse_end; k += 2) {
+        auto x = (k == -d || (k != d && v_reverse[k - 1] < v_reverse[k + 1])) ? v_reverse[k + 1] : v_reverse[k - 1] + 1;
+        auto y = x - k;
+        while (x < n && y < m && _eq(e_end - x - 1, a_end - y - 1)) {
+          ++x;
+          ++y;
+        }
+        v_reverse[k] = x;
+
+        if (x > n) {
+          k_reverse_end += 2;
+        } else if (y > m) {
+          k_reverse_start += 2;
+        } else if (!front) {
+          const auto k_forward = delta - k;
+          if (k_forward >= -max_d - 1 && k_forward <= max_d + 1 && v_forward[k_forward] != -1) {
+            const auto x_forward = v_forward[k_forward];
+            if (x_forward >= n - x) {
+              return std::make_pair(e_begin + x_forward, a_begin + x_forward - k_forward);
+            }
+          }
+        }
+      }
+
+      // Neither path of length `d` overlaps the other, so more than `2d` lines differ, and the number of lines which
+      // differ is odd if and only if `delta` is
+      if (_budget != nullptr && !_budget->allows(static_cast<std::size_t>((2 * d) + (front ? 1 : 2)))) {
+        _stopped = true;
+        return std::nullopt;
+      }
+    }
+
+    return std::nullopt;
+  }
+
+  std::ptrdiff_t _n;
+  std::ptrdiff_t _m;
+  Eq _eq;
+  OnMatch _on_match;
+  diff_budget* _budget;
+  std::vector<std::ptrdiff_t> _v_forward;
+  std::vector<std::ptrdiff_t> _v_reverse;
+  bool _stopped{};
+};
+
+/**
+ * @brief Occurrences of each interned line within a range of the expected lines and a range of the actual lines.
+ *
+ * The entries are indexed by line ID, and @code clear @endcode only resets those of the lines counted, so that counting
+ * a range takes time proportional to its length rather than to the number of distinct lines.
+ */
+class line_occurrences {
+ public:
+  struct entry {
+    std::size_t expected_count;
+    std::size_t actual_count;
+    // Position of the last occurrence counted in each range, or -1 if there is none
+    std::ptrdiff_t expected_pos{-1};
+    std::ptrdiff_t actual_pos{-1};
+  };
+
+  explicit line_occurrences(std::size_t nids) : _entries(nids) {}
+
+  /**
+   * @return The position of the previous occurrence of the line counted in the expected range, or -1 if there is none.
+   */
+  auto add_expected(std::size_t id, std::ptrdiff_t pos) -> std::ptrdiff_t {
+    auto& counts = touch(id);
+    ++counts.expected_count;
+    return std::exchange(counts.expected_pos, pos);
+  }
+
+  void add_actual(std::size_t id, std::ptrdiff_t pos) {
+    auto& counts = touch(id);
+    ++counts.actual_count;
+    counts.actual_pos = pos;
+  }
+
+  [[nodiscard]] auto operator[](std::size_t id) const -> const entry& { return _entries[id]; }
+
+  void clear() {
+    for (const auto id : _touched) {
+      _entries[id] = entry{};
+    }
+    _touched.clear();
+  }
+
+ private:
+  auto touch(std::size_t id) -> entry& {
+    auto& counts = _entries[id];
+    if (counts.expected_count == 0 && counts.actual_count == 0) {
+      _touched.push_back(id);
+    }
+    return counts;
+  }
+
+  std::vector<entry> _entries;
+  std::vector<std::size_t> _touched;
+};
+
+/**
+ * @brief Patience and histogram difference algorithms, which split both sequences at matching lines which are rare in
+ * both of them, instead of searching for the shortest edit script.
+ *
+ * Unlike with the Myers algorithm, lines which repeat often (such as blank lines or closing braces) are only matched
+ * once the rare lines around them are aligned, so that the diff follows the structure of the files. Within each range
+ * between two matches, the common prefix and suffix are matched first, after which:
+ * - The patience algorithm matches the longest increasing sequence of lines which occur exactly once in both ranges.
+ * - The histogram algorithm matches a run of consecutive lines containing the lines which occur fewest times in the
+ *   expected range, ignoring lines which occur more than @code max_chain @endcode times.
+ * Ranges in which no such lines exist are compared using @code myers_diff @endcode, unless they have no lines in
+ * common.
+ *
+ * Lines are identified by the IDs in @code expected_ids @endcode and @code actual_ids @endcode, and @code eq(i, j)
+ * @endcode returns whether line @code i @endcode of the expected sequence matches line @code j @endcode of the actual
+ * sequence, which is true if their IDs are equal. If @code exact_ids @endcode is set, it is also false otherwise.
+ * Matches are reported, and @code budget @endcode is applied to the ranges compared using @code myers_diff @endcode, in
+ * the same way as by @code myers_diff @endcode. The time limit of the budget is also checked before comparing each
+ * range.
+ */
+template<typename Eq, typename OnMatch>
+class anchored_diff {
+ public:
+  static constexpr std::size_t max_chain = 64;
+
+  anchored_diff(diff_algorithm algorithm,
+                std::span<const std::size_t> expected_ids,
+                std::span<const std::size_t> actual_ids,
+                std::size_t nids,
+                bool exact_ids,
+                Eq eq,
+                OnMatch on_match,
+                diff_budget* budget = nullptr) :
+      _histogram{algorithm == diff_algorithm::histogram},
+      _expected_ids{expected_ids},
+      _actual_ids{actual_ids},
+      _exact_ids{exact_ids},
+      _eq{std::move(eq)},
+      _on_match{std::move(on_match)},
+      _budget{budget},
+      _occurrences{nids} {
+    if (_histogram) {
+      _next_expected.resize(expected_ids.size());
+    }
+  }
+
+  /**
+   * @return Whether all matches were reported, i.e. @code on_match @endcode never returned @code false @endcode and the
+   * budget was not exceeded.
+   */
+  auto run() -> bool {
+    // Ranges are compared in order from a stack rather than recursively, as the matches may be nested arbitrarily deep
+    _tasks.push_back(range{.e_begin = 0,
+                           .e_end = std::ssize(_expected_ids),
+                           .a_begin = 0,
+                           .a_end = std::ssize(_actual_ids),
+                           .matched = false});
+    while (!_stopped && !_tasks.empty()) {
+      const auto task = _tasks.back();
+      _tasks.pop_back();
+      if (task.matched) {
+        for (auto i = task.e_begin, j = task.a_begin; !_stopped && i < task.e_end; ++i, ++j) {
+          report(i, j);
+        }
+      } else if (_budget != nullptr && !_budget->allows(0)) {
+        _stopped = true;
+      } else {
+        compare(task);
+      }
+    }
+    return !_stopped;
+  }
+
+ private:
+  /**
+   * @brief Range of the expected and actual lines, which are either compared or all matched in order.
+   */
+  struct range {
+    std::ptrdiff_t e_begin;
+    std::ptrdiff_t e_end;
+    std::ptrdiff_t a_begin;
+    std::ptrdiff_t a_end;
+    bool matched;
+  };
+
+  void report(std::ptrdiff_t i, std::ptrdiff_t j) { _stopped = !_on_match(i, j); }
+
+  void compare(range task) {
+    while (!_stopped && task.e_begin < task.e_end && task.a_begin < task.a_end && _eq(task.e_begin, task.a_begin)) {
+      report(task.e_begin++, task.a_begin++);
+    }
+    auto e_suffix = task.e_end;
+    auto a_suffix = task.a_end;
+    while (task.e_begin < e_suffix && task.a_begin < a_suffix && _eq(e_suffix - 1, a_suffix - 1)) {
+      --e_suffix;
+      --a_suffix;
+    }
+    if (e_suffix != task.e_end) {
+      _tasks.push_back(range{
+          .e_begin = e_suffix, .e_end = task.e_end, .a_begin = a_suffix, .a_end = task.a_end, .matched = true});
+    }
+    task.e_end = e_suffix;
+    task.a_end = a_suffix;
+    if (_stopped || task.e_begin == task.e_end || task.a_begin == task.a_end) {
+      return;
+    }
+
+    _anchors.clear();
+    const auto has_common = _histogram ? find_histogram_run(task) : find_patience_anchors(task);
+    _occurrences.clear();
+    if (_anchors.empty()) {
+      if (has_common || !_exact_ids) {
+        compare_myers(task);
+      }
+      return;
+    }
+
+    // Push the ranges between the anchors and the anchors themselves, so that they are popped in order
+    const auto first_task = _tasks.size();
+    auto e_pos = task.e_begin;
+    auto a_pos = task.a_begin;
+    auto push_gap = [&](std::ptrdiff_t e_end, std::ptrdiff_t a_end) {
+      if (e_pos != e_end && a_pos != a_end) {
+        _tasks.push_back(range{.e_begin = e_pos, .e_end = e_end, .a_begin = a_pos, .a_end = a_end, .matched = false});
+      }
+    };
+    for (const auto& anchor : _anchors) {
+      push_gap(anchor.e_begin, anchor.a_begin);
+      _tasks.push_back(anchor);
+      e_pos = anchor.e_end;
+      a_pos = anchor.a_end;
+    }
+    push_gap(task.e_end, task.a_end);
+    std::reverse(_tasks.begin() + static_cast<std::ptrdiff_t>(first_task), _tasks.end());
+  }
+
+  /**
+   * @brief Adds the longest increasing sequence of lines which occur once in both ranges to @code _anchors @endcode.
+   *
+   * @return Whether the ranges have any lines in common.
+   */
+  auto find_patience_anchors(const range& task) -> bool {
+    for (auto i = task.e_begin; i < task.e_end; ++i) {
+      _occurrences.add_expected(_expected_ids[static_cast<std::size_t>(i)], i);
+    }
+    for (auto j = task.a_begin; j < task.a_end; ++j) {
+      _occurrences.add_actual(_actual_ids[static_cast<std::size_t>(j)], j);
+    }
+
+    bool has_common{};
+    _unique.clear();
+    for (auto i = task.e_begin; i < task.e_end; ++i) {
+      const auto& entry = _occurrences[_expected_ids[static_cast<std::size_t>(i)]];
+      has_common = has_common || entry.actual_count != 0;
+      if (entry.expected_count == 1 && entry.actual_count == 1) {
+        _unique.push_back(range{
+            .e_begin = i, .e_end = i + 1, .a_begin = entry.actual_pos, .a_end = entry.actual_pos + 1, .matched = true});
+      }
+    }
+
+    // Patience sorting: each pile holds the index of the line with the smallest actual position which ends an
+    // increasing sequence of its length, and each line links to the top of the previous pile when it was placed
+    _piles.clear();
+    _links.resize(_unique.size());
+    for (std::size_t k = 0; k < _unique.size(); ++k) {
+      const auto pile = std::ranges::lower_bound(
+          _piles, _unique[k].a_begin, std::ranges::less{}, [this](std::size_t idx) { return _unique[idx].a_begin; });
+      _links[k] = pile == _piles.begin() ? _unique.size() : *(pile - 1);
+      if (pile == _piles.end()) {
+        _piles.push_back(k);
+      } else {
+        *pile = k;
+      }
+    }
+    if (!_piles.empty()) {
+      for (auto k = _piles.back(); k != _unique.size(); k = _links[k]) {
+        _anchors.push_back(_unique[k]);
+      }
+      std::ranges::reverse(_anchors);
+    }
+    return has_common;
+  }
+
+  /**
+   * @brief Adds the run of matching lines containing the rarest line of the expected range to @code _anchors @endcode.
+   *
+   * Runs are extended across lines with equal IDs in both directions, and their rarity is the smallest number of times
+   * any of their lines occurs in the expected range. A longer run is preferred over a rarer one, as in Git.
+   *
+   * @return Whether the ranges have any lines in common.
+   */
+  auto find_histogram_run(const range& task) -> bool {
+    // Chain the occurrences of each line in increasing order
+    for (auto i = task.e_end - 1; i >= task.e_begin; --i) {
+      const auto idx = static_cast<std::size_t>(i);
+      _next_expected[idx] = _occurrences.add_expected(_expected_ids[idx], i);
+    }
+
+    bool has_common{};
+    std::optional<range> best{};
+    std::size_t best_rarity = max_chain;
+    auto ids_equal = [this](std::ptrdiff_t i, std::ptrdiff_t j) {
+      return _expected_ids[static_cast<std::size_t>(i)] == _actual_ids[static_cast<std::size_t>(j)];
+    };
+    auto count = [this](std::ptrdiff_t i) {
+      return _occurrences[_expected_ids[static_cast<std::size_t>(i)]].expected_count;
+    };
+    for (auto j = task.a_begin; j < task.a_end;) {
+      const auto& entry = _occurrences[_actual_ids[static_cast<std::size_t>(j)]];
+      has_common = has_common || entry.expected_count != 0;
+      if (entry.expected_count == 0 || entry.expected_count > best_rarity) {
+        ++j;
+        continue;
+      }
+
+      auto next_j = j + 1;
+      for (auto i = entry.expected_pos; i != -1; i = _next_expected[static_cast<std::size_t>(i)]) {
+        auto run = range{.e_begin = i, .e_end = i + 1, .a_begin = j, .a_end = j + 1, .matched = true};
+        auto rarity = entry.expected_count;
+        while (run.e_begin > task.e_begin && run.a_begin > task.a_begin &&
+               ids_equal(run.e_begin - 1, run.a_begin - 1)) {
+          --run.e_begin;
+          --run.a_begin;
+          rarity = std::min(rarity, count(run.e_begin));
+        }
+        while (run.e_end < task.e_end && run.a_end < task.a_end && ids_equal(run.e_end, run.a_end)) {
+          rarity = std::min(rarity, count(run.e_end));
+          ++run.e_end;
+          ++run.a_end;
+        }
+        if (!best || run.e_end - run.e_begin > best->e_end - best->e_begin || rarity < best_rarity) {
+          best = run;
+          best_rarity = rarity;
+        }
+        next_j = std::max(next_j, run.a_end);
+      }
+      j = next_j;
+    }
+
+    if (best) {
+      _anchors.push_back(*best);
+    }
+    return has_common;
+  }
+
+  void compare_myers(const range& task) {
+    myers_diff fallback{task.e_end - task.e_begin,
+                        task.a_end - task.a_begin,
+                        [eq = _eq, e_begin = task.e_begin, a_begin = task.a_begin](std::ptrdiff_t i, std::ptrdiff_t j) {
+                          return eq(e_begin + i, a_begin + j);
+                        },
+                        [this, e_begin = task.e_begin, a_begin = task.a_begin](std::ptrdiff_t i, std::ptrdiff_t j) {
+                          report(e_begin + i, a_begin + j);
+                          return !_stopped;
+                        },
+                        _budget};
+    _stopped = !fallback.run();
+  }
+
+  bool _histogram;
+  std::span<const std::size_t> _expected_ids;
+  std::span<const std::size_t> _actual_ids;
+  bool _exact_ids;
+  Eq _eq;
+  OnMatch _on_match;
+  diff_budget* _budget;
+  line_occurrences _occurrences;
+  // Next occurrence of each expected line within the range being compared by the histogram algorithm
+  std::vector<std::ptrdiff_t> _next_expected;
+  std::vector<range> _tasks;
+  std::vector<range> _anchors;
+  // Lines occurring once in both ranges, and the state of the patience sort over them
+  std::vector<range> _unique;
+  std::vector<std::size_t> _piles;
+  std::vector<std::size_t> _links;
+  bool _stopped{};
+};
+
+/**
+ * @brief Differ which reads both files into memory and interns their lines, and matches them using the Myers, patience
+ * or histogram algorithm selected by the options.
+ */
+template<line_source ExpectedReader, line_source ActualReader>
+class interned_file_differ final : public eager_file_differ<ExpectedReader, ActualReader> {
+ public:
+  interned_file_differ(const interned_file_differ&) = delete;
+  interned_file_differ(interned_file_differ&&) noexcept = default;
+
+  ~interned_file_differ() = default;
+
+  auto operator=(const interned_file_differ&) -> interned_file_differ& = delete;
+  auto operator=(interned_file_differ&&) noexcept -> interned_file_differ& = default;
+
+  /**
+   * @brief All algorithms strip the common suffix of both files themselves, so it can be stripped in advance.
+   */
+  static constexpr bool preserves_common_suffix = true;
+
+  interned_file_differ(ExpectedReader expected, ActualReader actual, const diff_options& options = {}) :
+      eager_file_differ<ExpectedReader, ActualReader>{std::move(expected), std::move(actual), options} {}
+
+  template<diff_line_sink Sink>
+  auto do_diff(Sink& line_callback) -> bool {
+    const auto& expected_content = this->_expected_content;
+    const auto& actual_content = this->_actual_content;
+
+    // Intern each distinct line so that the inner loop of the algorithm only compares integers. Unless lines are
+    // compared exactly, lines which are equal under the comparison are interned as the same line. Numbers compared
+    // with a tolerance are interned as text, and lines with different IDs are compared in full below instead.
+    auto intern = [](auto& line_ids, const line_arena& lines) {
+      std::vector<std::size_t> ids{};
+      ids.reserve(lines.size());
+      for (std::size_t i = 0; i < lines.size(); ++i) {
+        ids.push_back(line_ids.try_emplace(lines[i], line_ids.size()).first->second);
+      }
+      return ids;
+    };
+    auto* const stats = this->_options.stats;
+    const auto comparator = this->_comparator.without_tolerance();
+    std::vector<std::size_t> expected_ids{};
+    std::vector<std::size_t> actual_ids{};
+    std::size_t nids{};
+    if (comparator.is_exact()) {
+      std::unordered_map<std::string_view, std::size_t> line_ids{};
+      expected_ids = intern(line_ids, expected_content);
+      actual_ids = intern(line_ids, actual_content);
+      nids = line_ids.size();
+    } else {
+      const auto hash = [&comparator](std::string_view line) { return comparator.hash(line); };
+      const auto equal = [&comparator](std::string_view lhs, std::string_view rhs) {
+        return comparator.equal(lhs, rhs);
+      };
+      std::unordered_map<std::string_view, std::size_t, decltype(hash), decltype(equal)> line_ids{0, hash, equal};
+      expected_ids = intern(line_ids, expected_content);
+      actual_ids = intern(line_ids, actual_content);
+      nids = line_ids.size();
+    }
+    count_stat(stats, &diff_stats::hash_probes, expected_ids.size() + actual_ids.size());
+
+    // Lines with different IDs may still be equal within the tolerance, which is only possible if their hashes are
+    // equal
+    std::vector<std::uint64_t> expected_hashes{};
+    std::vector<std::uint64_t> actual_hashes{};
+    if (this->_comparator.has_tolerance()) {
+      auto hash_all = [this](const line_arena& lines) {
+        std::vector<std::uint64_t> hashes{};
+        hashes.reserve(lines.size());
+        for (std::size_t i = 0; i < lines.size(); ++i) {
+          hashes.push_back(this->_comparator.hash(lines[i]));
+        }
+        return hashes;
+      };
+      expected_hashes = hash_all(expected_content);
+      actual_hashes = hash_all(actual_content);
+    }
+    auto lines_match = [&](std::size_t expected_idx, std::size_t actual_idx) {
+      count_stat(stats, &diff_stats::line_comparisons);
+      if (expected_ids[expected_idx] == actual_ids[actual_idx]) {
+        return true;
+      }
+      return !expected_hashes.empty() && expected_hashes[expected_idx] == actual_hashes[actual_idx] &&
+             this->_comparator.equal(expected_content[expected_idx], actual_content[actual_idx]);
+    };
+
+    // Whether the files differ does not depend on the edit script
+    if (this->_options.stop == diff_stop::at_first_difference) {
+      if (expected_ids.size() != actual_ids.size()) {
+        return true;
+      }
+      for (std::size_t i = 0; i < expected_ids.size(); ++i) {
+        if (!lines_match(i, i)) {
+          return true;
+        }
+      }
+      return false;
+    }
+
+    bool has_diff{};
+    std::size_t expected_pos{};
+    std::size_t actual_pos{};
+    // Number of context lines output since the last change
+    std::size_t context_run{};
+
+    auto emit = [&line_callback, stats](const diff_line& line) {
+      time_stat(stats, &diff_stats::output_time, [&] { line_callback(line); });
+    };
+
+    // Outputs all unmatched lines before the given positions, with all `-` lines preceding all `+` lines
+    auto output_diff = [&](std::size_t expected_end, std::size_t actual_end) {
+      if (expected_pos < expected_end || actual_pos < actual_end) {
+        context_run = 0;
+      }
+      for (; expected_pos < expected_end; ++expected_pos) {
+        has_diff = true;
+        emit(diff_line{.line = expected_content[expected_pos], .type = diff_line_type::expected_only});
+      }
+      for (; actual_pos < actual_end; ++actual_pos) {
+        has_diff = true;
+        emit(diff_line{.line = actual_content[actual_pos], .type = diff_line_type::actual_only});
+      }
+    };
+
+    auto eq = [&lines_match](std::ptrdiff_t i, std::ptrdiff_t j) {
+      return lines_match(static_cast<std::size_t>(i), static_cast<std::size_t>(j));
+    };
+    auto on_match = [&](std::ptrdiff_t i, std::ptrdiff_t j) {
+      output_diff(static_cast<std::size_t>(i), static_cast<std::size_t>(j));
+      if (has_diff || this->_options.context_lines) {
+        // The first hunk ends once more context lines follow a change than any hunk includes
+        if (has_diff && this->_options.stop != diff_stop::never &&
+            context_run++ == 2 * this->_options.context_lines.value_or(0)) {
+          return false;
+        }
+        emit(diff_line{.line = expected_content[expected_pos], .type = diff_line_type::context});
+      }
+      ++expected_pos;
+      ++actual_pos;
+      return true;
+    };
+    diff_budget budget{this->_options};
+    const auto completed = [&] {
+      if (this->_options.algorithm == diff_algorithm::patience ||
+          this->_options.algorithm == diff_algorithm::histogram) {
+        return anchored_diff{this->_options.algorithm,
+                             std::span<const std::size_t>{expected_ids},
+                             std::span<const std::size_t>{actual_ids},
+                             nids,
+                             expected_hashes.empty(),
+                             eq,
+                             on_match,
+                             &budget}
+            .run();
+      }
+      return myers_diff{static_cast<std::ptrdiff_t>(expected_ids.size()),
+                        static_cast<std::ptrdiff_t>(actual_ids.size()),
+                        eq,
+                        on_match,
+                        &budget}
+          .run();
+    }();
+    if (completed) {
+      output_diff(expected_content.size(), actual_content.size());
+    } else if (budget.exceeded()) {
+      // The lines before the first unmatched line are already output, and the rest are compared in linear time
+      _budget_exceeded = true;
+      this->_expected_pos = expected_pos;
+      this->_actual_pos = actual_pos;
+      has_diff = greedy_differ::do_diff(line_callback, has_diff);
+    }
+
+    return has_diff;
+  }
+
+  [[nodiscard]] auto budget_exceeded() const noexcept -> bool { return _budget_exceeded; }
+
+ private:
+  using greedy_differ = file_differ<eager_file_differ<ExpectedReader, ActualReader>>;
+
+  bool _budget_exceeded{};
+};
+
+template<line_source ExpectedReader, line_source ActualReader>
+class lazy_file_differ final : public file_differ<lazy_file_differ<ExpectedReader, ActualReader>> {
+ public:
+  lazy_file_differ(const lazy_file_differ&) = delete;
+  lazy_file_differ(lazy_file_differ&&) noexcept = default;
+
+  ~lazy_file_differ() = default;
+
+  auto operator=(const lazy_file_differ&) -> lazy_file_differ& = delete;
+  auto operator=(lazy_file_differ&&) noexcept -> lazy_file_differ& = default;
+
+  lazy_file_differ(ExpectedReader expected, ActualReader actual, const diff_options& options = {}) :
+      file_differ<lazy_file_differ>{options}, _expected{std::move(expected)}, _actual{std::move(actual)} {}
+
+ private:
+  friend class file_differ<lazy_file_differ>;
+
+  auto read_expected_line() -> std::optional<std::string_view> {
+    return read_line(_expected, &diff_stats::expected_lines, &diff_stats::expected_bytes);
+  }
+  auto read_actual_line() -> std::optional<std::string_view> {
+    return read_line(_actual, &diff_stats::actual_lines, &diff_stats::actual_bytes);
+  }
+  [[nodiscard]] auto actual_lines_persist() const noexcept -> bool { return _actual.is_persistent(); }
+
+  // Indexed readers already know the exact hash of every line
+  [[nodiscard]] auto expected_line_hash(std::string_view line) const -> std::uint64_t {
+    if constexpr (requires { _expected.last_line_hash(); }) {
+      if (const auto hash = _expected.last_line_hash(); hash && this->_comparator.is_exact()) {
+        return *hash;
+      }
+    }
+    return this->_comparator.hash(line);
+  }
+
+  /**
+   * @brief Reads a line from @code reader @endcode, and adds the time taken, and the line and its size to the given
+   * counters of @code stats @endcode if statistics are collected.
+   */
+  template<line_source Reader>
+  auto read_line(Reader& reader, std::size_t diff_stats::* lines_counter, std::size_t diff_stats::* bytes_counter)
+      -> std::optional<std::string_view> {
+    auto* const stats = this->_options.stats;
+    const auto line = time_stat(stats, &diff_stats::io_time, [&reader] { return reader.read_line(); });
+    if (line) {
+      count_stat(stats, lines_counter);
+      count_stat(stats, bytes_counter, line->size() + 1);
+    }
+    return line;
+  }
+
+  ExpectedReader _expected;
+  ActualReader _actual;
+};
+
+/**
+ * @brief Lengths in bytes of the common leading and trailing lines of two files.
+ */
+struct common_affixes {
+  std::size_t prefix;
+  std::size_t suffix;
+  bool identical;
+};
+
+/**
+ * @brief Finds the common leading and, if @code with_suffix @endcode, trailing lines of two files by comparing their
+ * contents in blocks.
+ *
+ * The prefix and suffix never overlap, and are aligned to line boundaries in both files.
+ */
+auto find_common_affixes(std::string_view expected, std::string_view actual, bool with_suffix) -> common_affixes {
+  static constexpr std::size_t block_size = 4096;
+
+  const auto common_size = std::min(expected.size(), actual.size());
+
+  std::size_t mismatch{};
+  while (mismatch < common_size) {
+    const auto block = std::min(block_size, common_size - mismatch);
+    if (!kernels.equal(expected.data() + mismatch, actual.data() + mismatch, block)) {
+      break;
+    }
+    mismatch += block;
+  }
+  while (mismatch < common_size && expected[mismatch] == actual[mismatch]) {
+    ++mismatch;
+  }
+
+  if (mismatch == common_size && expected.size() == actual.size()) {
+    return common_affixes{.prefix = expected.size(), .suffix = 0, .identical = true};
+  }
+
+  // Back up to the start of the line containing the first difference
+  const auto last_newline = expected.substr(0, mismatch).rfind('\n');
+  const auto prefix = last_newline == std::string_view::npos ? 0 : last_newline + 1;
+  // If one file is a prefix of the other, an unterminated last line may still be common to both files, so leave the
+  // suffix to the line differ
+  if (!with_suffix || mismatch == common_size) {
+    return common_affixes{.prefix = prefix, .suffix = 0, .identical = false};
+  }
+
+  const auto suffix_limit = common_size - prefix;
+  auto suffix_equal = [&](std::size_t offset, std::size_t size) {
+    return kernels.equal(expected.data() + expected.size() - offset - size,
+                         actual.data() + actual.size() - offset - size,
+                         size);
+  };
+
+  std::size_t suffix{};
+  while (suffix < suffix_limit) {
+    const auto block = std::min(block_size, suffix_limit - suffix);
+    if (!suffix_equal(suffix, block)) {
+      break;
+    }
+    suffix += block;
+  }
+  while (suffix < suffix_limit && suffix_equal(suffix, 1)) {
+    ++suffix;
+  }
+
+  // The suffix may only start where a line starts in both files
+  auto is_line_start = [](std::string_view contents, std::size_t pos) { return pos == 0 || contents[pos - 1] == '\n'; };
+  if (!is_line_start(expected, expected.size() - suffix) || !is_line_start(actual, actual.size() - suffix)) {
+    const auto newline = expected.find('\n', expected.size() - suffix);
+    suffix = newline == std::string_view::npos ? 0 : expected.size() - newline - 1;
+  }
+
+  return common_affixes{.prefix = prefix, .suffix = suffix, .identical = false};
+}
+
+/**
+ * @brief Runs @code task(idx) @endcode for each index in @code [0, count) @endcode on up to @code threads @endcode
+ * threads, including the calling thread.
+ *
+ * Each thread takes the next index as soon as it finishes its previous task, so that threads which finish early take
+ * over the work which is left. This balances the load as well as per-thread queues with work stealing would: the
+ * callers split their work into a few coarse tasks of similar size per thread, so the shared index is only contended
+ * once per task, and there are no nested tasks which would benefit from being queued on the thread that created them.
+ */
+template<std::invocable<std::size_t> Task>
+void parallel_for(std::size_t count, std::size_t threads, const Task& task) {
+  std::atomic<std::size_t> next_idx{};
+  auto worker = [&] {
+    for (auto idx = next_idx.fetch_add(1); idx < count; idx = next_idx.fetch_add(1)) {
+      task(idx);
+    }
+  };
+
+  std::vector<std::jthread> workers{};
+  for (std::size_t i = 1; i < std::min(count, threads); ++i) {
+    workers.emplace_back(worker);
+  }
+  worker();
+}
+
+/**
+ * @brief Minimum size of the segments which large files are split into to be compared concurrently.
+ */
+constexpr std::size_t min_segment_size = 1U << 18U;
+
+/**
+ * @brief Pair of equal lines, one in each file, after which both files are split into segments.
+ */
+struct segment_anchor {
+  // Offset of the end of the anchor line in each file, including its newline
+  std::size_t expected_end;
+  std::size_t actual_end;
+};
+
+/**
+ * @brief Finds up to @code nsegments - 1 @endcode anchors which split both files into segments of similar size.
+ *
+ * In the style of patience diff, each anchor is a line which is unique within its neighborhood in both files, and is
+ * searched for near where the previous anchor or the relative sizes of both files suggest. Anchors are only a guess of
+ * which lines the greedy algorithm matches, and are validated after diffing the segments.
+ */
+auto find_segment_anchors(std::string_view expected, std::string_view actual, std::size_t nsegments)
+    -> std::vector<segment_anchor> {
+  static constexpr std::size_t window_size = 4096;
+  static constexpr std::size_t max_candidates = 8;
+  static constexpr auto npos = std::string_view::npos;
+
+  auto find_newline = [](std::string_view contents, std::size_t pos) {
+    const auto* const last = contents.data() + contents.size();
+    const auto* const newline = kernels.find_newline(contents.data() + pos, last);
+    return newline == last ? npos : static_cast<std::size_t>(newline - contents.data());
+  };
+  // Returns the start of the first line which starts at or after `pos`
+  auto next_line_start = [&find_newline](std::string_view contents, std::size_t pos) {
+    if (pos == 0) {
+      return std::size_t{0};
+    }
+    const auto newline = find_newline(contents, pos - 1);
+    return newline == npos ? npos : newline + 1;
+  };
+  // Returns the number of lines equal to `line` within the window around `center`, and the start of the last one
+  auto find_in_window = [&](std::string_view contents, std::size_t center, std::string_view line) {
+    std::size_t count{};
+    std::size_t last_match{npos};
+    const auto end = std::min(contents.size(), center + window_size);
+    auto pos = next_line_start(contents, center > window_size ? center - window_size : 0);
+    while (pos < end) {
+      const auto newline = find_newline(contents, pos);
+      if (newline == npos) {
+        break;
+      }
+      if (lines_equal(contents.substr(pos, newline - pos), line)) {
+        ++count;
+        last_match = pos;
+      }
+      pos = newline + 1;
+    }
+    return std::pair{count, last_match};
+  };
+
+  std::vector<segment_anchor> anchors{};
+  segment_anchor prev_anchor{.expected_end = 0, .actual_end = 0};
+  for (std::size_t k = 1; k < nsegments; ++k) {
+    auto candidate = next_line_start(expected, expected.size() / nsegments * k);
+    for (std::size_t i = 0; i < max_candidates && candidate < expected.size(); ++i) {
+      const auto newline = find_newline(expected, candidate);
+      // Every segment must contain at least one line, and the last segment includes the unterminated last line
+      if (newline == npos || newline + 1 == expected.size()) {
+        break;
+      }
+
+      const auto line = expected.substr(candidate, newline - candidate);
+      if (!line.empty() && candidate >= prev_anchor.expected_end && find_in_window(expected, candidate, line).first == 1) {
+        const auto ratio = static_cast<double>(actual.size()) / static_cast<double>(expected.size());
+        const std::array hints{prev_anchor.actual_end + (candidate - prev_anchor.expected_end),
+                               static_cast<std::size_t>(static_cast<double>(candidate) * ratio)};
+        for (const auto hint : hints) {
+          const auto [count, match] = find_in_window(actual, hint, line);
+          if (count == 1 && match >= prev_anchor.actual_end && match + line.size() + 1 < actual.size()) {
+            prev_anchor = segment_anchor{.expected_end = newline + 1, .actual_end = match + line.size() + 1};
+            anchors.push_back(prev_anchor);
+            break;
+          }
+        }
+        if (!anchors.empty() && anchors.back().expected_end == newline + 1) {
+          break;
+        }
+      }
+
+      candidate = newline + 1;
+    }
+  }
+
+  return anchors;
+}
+
+/**
+ * @brief Compares two files held in memory with the greedy algorithm, by splitting them into segments which are
+ * compared concurrently on up to @code options.threads @endcode threads.
+ *
+ * The diff is always the same as that of @code lazy_file_differ @endcode. The greedy algorithm matches each expected
+ * line against the first unmatched equal line in the actual file, so the diff of the files is the diff of their
+ * segments joined together, as long as
+ *
+ * - the anchor line ending each expected segment matches the line ending the actual segment, and
+ * - none of the expected lines output as missing from a segment are equal to a line after the end of the actual
+ *   segment, which would otherwise have been matched instead.
+ *
+ * Starting from the first segment for which either does not hold, the rest of the files are compared on one thread.
+ */
+template<diff_line_sink Sink>
+auto diff_segments(std::string_view expected, std::string_view actual, const diff_options& options, Sink& line_callback)
+    -> bool {
+  using segment_differ = lazy_file_differ<memory_line_reader, memory_line_reader>;
+
+  const auto threads = options.threads;
+  const auto anchors = find_segment_anchors(expected, actual, std::min(threads * 4, expected.size() / min_segment_size));
+  const auto nsegments = anchors.size() + 1;
+
+  // Segments do not include the empty line following the last line of a file, unless they are the last segment
+  auto segment_readers = [&](std::size_t idx) {
+    const auto begin = idx == 0 ? segment_anchor{.expected_end = 0, .actual_end = 0} : anchors[idx - 1];
+    std::pair readers{memory_line_reader{expected.substr(begin.expected_end)},
+                      memory_line_reader{actual.substr(begin.actual_end)}};
+    if (idx < anchors.size()) {
+      readers.first.trim(0, expected.size() - anchors[idx].expected_end);
+      readers.second.trim(0, actual.size() - anchors[idx].actual_end);
+    }
+    return readers;
+  };
+
+  // Diff of a segment, stored as runs of lines of the same type
+  struct segment_diff {
+    std::vector<std::pair<diff_line_type, std::size_t>> runs;
+    std::vector<std::string_view> removed_lines;
+  };
+
+  std::vector<segment_diff> segment_diffs(nsegments);
+  // Statistics of each segment are collected separately, since the segments are compared concurrently
+  std::vector<diff_stats> segment_stats(stats_enabled && options.stats != nullptr ? nsegments : 0);
+  parallel_for(nsegments, threads, [&](std::size_t idx) {
+    auto& segment = segment_diffs[idx];
+    auto recorder = [&segment](const diff_line& line) {
+      if (segment.runs.empty() || segment.runs.back().first != line.type) {
+        segment.runs.emplace_back(line.type, 0);
+      }
+      ++segment.runs.back().second;
+      if (line.type == diff_line_type::expected_only) {
+        segment.removed_lines.push_back(line.line);
+      }
+    };
+
+    auto [expected_reader, actual_reader] = segment_readers(idx);
+    segment_differ differ{std::move(expected_reader),
+                          std::move(actual_reader),
+                          diff_options{.stats = segment_stats.empty() ? nullptr : &segment_stats[idx]}};
+    // All context lines are recorded, since the segment may follow a change in a previous segment
+    differ.do_diff(recorder, true);
+  });
+
+  // The anchor is matched against the last line of the actual segment if and only if it is the last line of the diff
+  std::size_t first_invalid{};
+  while (first_invalid < anchors.size() && !segment_diffs[first_invalid].runs.empty() &&
+         segment_diffs[first_invalid].runs.back().first == diff_line_type::context) {
+    ++first_invalid;
+  }
+
+  // Check every line output as missing before an anchor against all actual lines after the anchor
+  std::unordered_map<std::uint64_t, std::vector<std::pair<std::size_t, std::string_view>>> removed_lines{};
+  std::optional<std::size_t> scan_begin{};
+  for (std::size_t idx = 0; idx < first_invalid; ++idx) {
+    for (const auto line : segment_diffs[idx].removed_lines) {
+      removed_lines[hash_line(line)].emplace_back(idx, line);
+      scan_begin = scan_begin.value_or(anchors[idx].actual_end);
+    }
+  }
+  if (scan_begin) {
+    std::atomic<std::size_t> first_conflict{first_invalid};
+    const auto scan = actual.substr(*scan_begin);
+    const auto nchunks = std::max<std::size_t>(std::min(threads * 4, scan.size() / min_segment_size), 1);
+    parallel_for(nchunks, threads, [&](std::size_t idx) {
+      // Chunks start and end on line boundaries, and only the last chunk includes the empty line following the
+      // last line
+      auto chunk_bound = [&](std::size_t chunk_idx) {
+        if (chunk_idx == 0) {
+          return std::size_t{0};
+        }
+        const auto newline = scan.find('\n', scan.size() / nchunks * chunk_idx);
+        return newline == std::string_view::npos ? scan.size() : newline + 1;
+      };
+      const auto chunk_begin = chunk_bound(idx);
+      if (idx != 0 && chunk_begin == chunk_bound(idx - 1)) {
+        return;
+      }
+
+      memory_line_reader reader{scan.substr(chunk_begin)};
+      if (idx + 1 < nchunks) {
+        const auto chunk_end = chunk_bound(idx + 1);
+        if (chunk_end == scan.size()) {
+          return;
+        }
+        reader.trim(0, scan.size() - chunk_end);
+      }
+
+      while (const auto line = reader.read_line()) {
+        const auto removed_it = removed_lines.find(hash_line(*line));
+        if (removed_it == removed_lines.end()) {
+          continue;
+        }
+
+        const auto pos = static_cast<std::size_t>(line->data() - actual.data());
+        for (const auto& [segment_idx, removed_line] : removed_it->second) {
+          if (pos >= anchors[segment_idx].actual_end && lines_equal(*line, removed_line)) {
+            auto conflict = first_conflict.load();
+            while (segment_idx < conflict && !first_conflict.compare_exchange_weak(conflict, segment_idx)) {
+            }
+          }
+        }
+      }
+    });
+    first_invalid = first_conflict.load();
+  }
+
+  bool has_diff{};
+  auto emit = [&line_callback, stats = options.stats](const diff_line& line) {
+    time_stat(stats, &diff_stats::output_time, [&] { line_callback(line); });
+  };
+  for (std::size_t idx = 0; idx < first_invalid || (idx == first_invalid && idx == anchors.size()); ++idx) {
+    // The remaining segments are compared again below, which collects their statistics anew
+    if (!segment_stats.empty()) {
+      merge_stats(*options.stats, segment_stats[idx]);
+    }
+
+    auto [expected_reader, actual_reader] = segment_readers(idx);
+    // Context lines are equal in both files, so the matching actual lines are skipped without splitting them
+    auto actual_rest = *actual_reader.contents();
+    for (const auto& [type, count] : segment_diffs[idx].runs) {
+      for (std::size_t i = 0; i < count; ++i) {
+        switch (type) {
+          case diff_line_type::context: {
+            const auto line = *expected_reader.read_line();
+            actual_rest.remove_prefix(std::min(line.size() + 1, actual_rest.size()));
+            if (has_diff || options.context_lines) {
+              emit(diff_line{.line = line, .type = diff_line_type::context});
+            }
+            break;
+          }
+          case diff_line_type::expected_only:
+            has_diff = true;
+            emit(diff_line{.line = *expected_reader.read_line(), .type = diff_line_type::expected_only});
+            break;
+          case diff_line_type::actual_only: {
+            has_diff = true;
+            const auto line = actual_rest.substr(0, actual_rest.find('\n'));
+            actual_rest.remove_prefix(std::min(line.size() + 1, actual_rest.size()));
+            emit(diff_line{.line = line, .type = diff_line_type::actual_only});
+            break;
+          }
+          default:
+            assert(false);
+        }
+      }
+    }
+  }
+
+  if (first_invalid < anchors.size()) {
+    const auto begin = first_invalid == 0 ? segment_anchor{.expected_end = 0, .actual_end = 0} : anchors[first_invalid - 1];
+    segment_differ differ{memory_line_reader{expected.substr(begin.expected_end)},
+                          memory_line_reader{actual.substr(begin.actual_end)},
+                          diff_options{.context_lines = options.context_lines, .stats = options.stats}};
+    has_diff = differ.do_diff(line_callback, has_diff);
+  }
+
+  return has_diff;
+}
+
+/**
+ * @brief Compares the lines of two readers using @code Differ @endcode.
+ *
+ * If both readers hold their contents in memory and can be trimmed, their contents are compared first, so that
+ * identical files are never split into lines, and lines common to the start (and where @code Differ @endcode allows,
+ * the end) of both files are skipped.
+ */
+template<template<line_source, line_source> typename Differ,
+         line_source ExpectedReader,
+         line_source ActualReader,
+         diff_line_sink Sink>
+auto diff_readers(ExpectedReader expected_reader,
+                  ActualReader actual_reader,
+                  const diff_options& options,
+                  Sink& line_callback) -> diff_result {
+  using differ_type = Differ<ExpectedReader, ActualReader>;
+
+  const stats_scope scope{options.stats};
+  auto emit = [&line_callback, stats = options.stats](const diff_line& line) {
+    time_stat(stats, &diff_stats::output_time, [&] { line_callback(line); });
+  };
+
+  std::string_view common_suffix{};
+  const auto expected_contents = expected_reader.contents();
+  const auto actual_contents = actual_reader.contents();
+  if (expected_contents && actual_contents && expected_reader.is_trimmable() && actual_reader.is_trimmable()) {
+    const auto affixes =
+        find_common_affixes(*expected_contents, *actual_contents, differ_type::preserves_common_suffix);
+    if (affixes.identical) {
+      count_stat(options.stats, &diff_stats::skipped_bytes, expected_contents->size() + actual_contents->size());
+      return diff_result{.has_diff = false, .lookahead_exceeded = 0, .budget_exceeded = false};
+    }
+    count_stat(options.stats, &diff_stats::skipped_bytes, 2 * (affixes.prefix + affixes.suffix));
+
+    expected_reader.trim(affixes.prefix, affixes.suffix);
+    actual_reader.trim(affixes.prefix, affixes.suffix);
+    common_suffix = expected_contents->substr(expected_contents->size() - affixes.suffix);
+
+    // The sink numbers the lines of the diff by counting every context line
+    if (options.context_lines && options.stop != diff_stop::at_first_difference) {
+      const line_comparator comparator{options};
+      const auto common_prefix = expected_contents->substr(0, affixes.prefix);
+      for (std::size_t pos = 0; pos < common_prefix.size();) {
+        const auto newline = common_prefix.find('\n', pos);
+        if (const auto line = common_prefix.substr(pos, newline - pos); !comparator.is_ignored(line)) {
+          emit(diff_line{.line = line, .type = diff_line_type::context});
+        }
+        pos = newline + 1;
+      }
+    }
+  }
+
+  // Large files are split into segments which are compared concurrently, which produces the same diff as long as
+  // lines are compared exactly, none are ignored, and the greedy algorithm is not limited in how far it looks ahead
+  if constexpr (std::same_as<differ_type, lazy_file_differ<ExpectedReader, ActualReader>>) {
+    const auto unlimited = diff_options{};
+    const line_comparator comparator{options};
+    if (expected_contents && actual_contents && options.threads > 1 && options.stop == diff_stop::never &&
+        comparator.is_exact() && !comparator.ignores_lines() &&
+        options.max_lookahead_lines == unlimited.max_lookahead_lines &&
+        options.max_lookahead_bytes == unlimited.max_lookahead_bytes) {
+      const auto expected_rest = *expected_reader.contents();
+      if (expected_rest.size() >= 2 * min_segment_size) {
+        const auto has_diff = diff_segments(expected_rest, *actual_reader.contents(), options, line_callback);
+        return diff_result{.has_diff = has_diff, .lookahead_exceeded = 0, .budget_exceeded = false};
+      }
+    }
+  }
+
+  differ_type differ{std::move(expected_reader), std::move(actual_reader), options};
+
+  const auto has_diff = differ.do_diff(line_callback);
+  if (has_diff && !common_suffix.empty() &&
+      (options.stop == diff_stop::never || (options.stop == diff_stop::after_first_hunk && options.context_lines))) {
+    // Only the context lines which may end the first hunk are needed
+    auto remaining = options.stop == diff_stop::never ? std::numeric_limits<std::size_t>::max()
+                                                      : 2 * options.context_lines.value_or(0) + 1;
+    const line_comparator comparator{options};
+    memory_line_reader suffix_reader{common_suffix};
+    for (auto line = suffix_reader.read_line(); line && remaining != 0; line = suffix_reader.read_line()) {
+      if (!comparator.is_ignored(*line)) {
+        emit(diff_line{.line = *line, .type = diff_line_type::context});
+        --remaining;
+      }
+    }
+  }
+
+  bool budget_exceeded{};
+  if constexpr (requires { differ.budget_exceeded(); }) {
+    budget_exceeded = differ.budget_exceeded();
+  }
+  return diff_result{
+      .has_diff = has_diff, .lookahead_exceeded = differ.lookahead_exceeded(), .budget_exceeded = budget_exceeded};
+}
+
+/**
+ * @brief Compares the lines read from the given readers using the algorithm selected by @code options @endcode.
+ */
+template<line_source ExpectedReader, line_source ActualReader, diff_line_sink Sink>
+auto diff_sources(ExpectedReader expected_reader,
+                  ActualReader actual_reader,
+                  const diff_options& options,
+                  Sink& line_callback) -> diff_result {
+  if (options.algorithm != diff_algorithm::greedy) {
+    return diff_readers<interned_file_differ>(
+        std::move(expected_reader), std::move(actual_reader), options, line_callback);
+  }
+  return diff_readers<lazy_file_differ>(std::move(expected_reader), std::move(actual_reader), options, line_callback);
+}
+
+/**
+ * @brief Opens the files at the given paths using @code open_line_reader @endcode, and compares them using
+ * @code diff_sources @endcode.
+ */
+template<diff_line_sink Sink>
+auto diff_paths(const std::filesystem::path& expected,
+                const std::filesystem::path& actual,
+                const diff_options& options,
+                Sink& line_callback) -> std::expected<diff_result, std::string> {
+  read_progress expected_progress{};
+  auto expected_reader = open_line_reader(expected, options.read_ahead, expected_progress);
+  if (!expected_reader) {
+    return std::unexpected{expected_reader.error()};
+  }
+  if (options.index_expected) {
+    attach_line_index(*expected_reader, expected, options.index_dir);
+  }
+  read_progress actual_progress{};
+  auto actual_reader = open_line_reader(actual, options.read_ahead, actual_progress);
+  if (!actual_reader) {
+    return std::unexpected{actual_reader.error()};
+  }
+
+  const auto result = std::visit(
+      [&options, &line_callback](auto& expected_line_reader, auto& actual_line_reader) {
+        return diff_sources(std::move(expected_line_reader), std::move(actual_line_reader), options, line_callback);
+      },
+      *expected_reader,
+      *actual_reader);
+
+  // The diff of a file which could not be read to its end is meaningless
+  if (expected_progress.error != 0) {
+    return std::unexpected{read_error_message(expected, expected_progress.error)};
+  }
+  if (actual_progress.error != 0) {
+    return std::unexpected{read_error_message(actual, actual_progress.error)};
+  }
+  return result;
+}
+
+/**
+ * @brief Line reader which forwards to a @code line_reader @endcode owned by the caller.
+ */
+class line_reader_ref {
+ public:
+  explicit line_reader_ref(line_reader& reader) noexcept : _reader{&reader} {}
+
+  auto read_line() -> std::optional<std::string_view> { return _reader->read_line(); }
+  [[nodiscard]] auto is_persistent() const noexcept -> bool { return _reader->is_persistent(); }
+  [[nodiscard]] auto contents() const noexcept -> std::optional<std::string_view> { return _reader->contents(); }
+  [[nodiscard]] auto is_trimmable() const noexcept -> bool { return _reader->is_trimmable(); }
+  void trim(std::size_t prefix, std::size_t suffix) { _reader->trim(prefix, suffix); }
+
+ private:
+  line_reader* _reader;
+};
+
+/**
+ * @brief Size of the buffer of @code output_sink @endcode, above which lines are written out.
+ */
+constexpr std::size_t output_buffer_size = 1U << 18U;
+
+}  // namespace
+
+auto diff_buffers(std::string_view expected,
+                  std::string_view actual,
+                  const diff_options& options,
+                  const diff_line_cb& line_callback) -> diff_result {
+  return diff_sources(memory_line_reader{expected}, memory_line_reader{actual}, options, line_callback);
+}
+
+auto diff_lines(line_reader& expected,
+                line_reader& actual,
+                const diff_options& options,
+                const diff_line_cb& line_callback) -> diff_result {
+  return diff_sources(line_reader_ref{expected}, line_reader_ref{actual}, options, line_callback);
+}
+
+auto diff_files(const std::filesystem::path& expected,
+                const std::filesystem::path& actual,
+                const diff_options& options,
+                const diff_line_cb& line_callback) -> std::expected<diff_result, std::string> {
+  return diff_paths(expected, actual, options, line_callback);
+}
+
+/**
+ * @brief Compares two files line by line and outputs the diff to the @code line_callback @endcode function.
+ *
+ * This is the reference implementation of the diff algorithm, which eagerly reads both files into memory
+ * and compares them line-by-line.
+ */
+auto diff_file_stdout_eager(std::ifstream expected, std::ifstream actual, const diff_line_cb& line_callback) -> bool {
+  eager_file_differ differ{istream_line_reader{std::move(expected)}, istream_line_reader{std::move(actual)}};
+
+  return differ.do_diff(line_callback);
+}
+
+/**
+ * @brief Compares two files line by line and outputs the diff to the @code line_callback @endcode function.
+ *
+ * This diff algorithm is derived from @code diff_file_stdout_eager @endcode, but it uses a lazy approach by lazily
+ * looking ahead in the actual file and buffering lines until a match is found in the expected file.
+ */
+auto diff_file_stdout(std::ifstream expected, std::ifstream actual, const diff_line_cb& line_callback) -> bool {
+  lazy_file_differ differ{istream_line_reader{std::move(expected)}, istream_line_reader{std::move(actual)}};
+
+  return differ.do_diff(line_callback);
+}
+
+/**
+ * @brief Compares two files line by line and outputs the diff to the @code line_callback @endcode function.
+ *
+ * This diff algorithm eagerly reads both files into memory, and computes the shortest edit script between them using
+ * the linear-space variant of the Myers diff algorithm.
+ */
+auto diff_file_stdout_myers(std::ifstream expected, std::ifstream actual, const diff_line_cb& line_callback) -> bool {
+  interned_file_differ differ{istream_line_reader{std::move(expected)},
+                              istream_line_reader{std::move(actual)},
+                              diff_options{.algorithm = diff_algorithm::myers}};
+
+  return differ.do_diff(line_callback);
+}
+
+/**
+ * @brief Overload of @code diff_file_stdout_eager @endcode which reads the files at the given paths.
+ */
+auto diff_file_stdout_eager(const std::filesystem::path& expected,
+                            const std::filesystem::path& actual,
+                            const diff_line_cb& line_callback) -> std::expected<bool, std::string> {
+  read_progress expected_progress{};
+  auto expected_reader = open_line_reader(expected, 0, expected_progress);
+  if (!expected_reader) {
+    return std::unexpected{expected_reader.error()};
+  }
+  read_progress actual_progress{};
+  auto actual_reader = open_line_reader(actual, 0, actual_progress);
+  if (!actual_reader) {
+    return std::unexpected{actual_reader.error()};
+  }
+
+  const auto has_diff = std::visit(
+      [&line_callback](auto& expected_line_reader, auto& actual_line_reader) {
+        return diff_readers<eager_file_differ>(
+                   std::move(expected_line_reader), std::move(actual_line_reader), diff_options{}, line_callback)
+            .has_diff;
+      },
+      *expected_reader,
+      *actual_reader);
+
+  if (expected_progress.error != 0) {
+    return std::unexpected{read_error_message(expected, expected_progress.error)};
+  }
+  if (actual_progress.error != 0) {
+    return std::unexpected{read_error_message(actual, actual_progress.error)};
+  }
+  return has_diff;
+}
+
+/**
+ * @brief Overload of @code diff_file_stdout @endcode which reads the files at the given paths.
+ *
+ * Regular files are memory-mapped, so that lines are never copied unless they need to be buffered for look-ahead.
+ */
+auto diff_file_stdout(const std::filesystem::path& expected,
+                      const std::filesystem::path& actual,
+                      const diff_line_cb& line_callback) -> std::expected<bool, std::string> {
+  const auto result = diff_file_stdout(expected, actual, diff_options{}, line_callback);
+  if (!result) {
+    return std::unexpected{result.error()};
+  }
+  return result->has_diff;
+}
+
+/**
+ * @brief Overload of @code diff_file_stdout @endcode which reads the files at the given paths, using the given
+ * options.
+ */
+auto diff_file_stdout(const std::filesystem::path& expected,
+                      const std::filesystem::path& actual,
+                      const diff_options& options,
+                      const diff_line_cb& line_callback) -> std::expected<diff_result, std::string> {
+  auto greedy_options = options;
+  greedy_options.algorithm = diff_algorithm::greedy;
+  return diff_files(expected, actual, greedy_options, line_callback);
+}
+
+/**
+ * @brief Overload of @code diff_file_stdout_myers @endcode which reads the files at the given paths.
+ */
+auto diff_file_stdout_myers(const std::filesystem::path& expected,
+                            const std::filesystem::path& actual,
+                            const diff_line_cb& line_callback) -> std::expected<bool, std::string> {
+  const auto result = diff_file_stdout_myers(expected, actual, diff_options{}, line_callback);
+  if (!result) {
+    return std::unexpected{result.error()};
+  }
+  return result->has_diff;
+}
+
+/**
+ * @brief Overload of @code diff_file_stdout_myers @endcode which reads the files at the given paths, using the given
+ * options.
+ */
+auto diff_file_stdout_myers(const std::filesystem::path& expected,
+                            const std::filesystem::path& actual,
+                            const diff_options& options,
+                            const diff_line_cb& line_callback) -> std::expected<diff_result, std::string> {
+  auto myers_options = options;
+  myers_options.algorithm = diff_algorithm::myers;
+  return diff_files(expected, actual, myers_options, line_callback);
+}
+
+output_sink::output_sink(std::FILE* stream) : _stream{stream} {
+  // Anything already written through stdio must precede our output
+  std::fflush(_stream);
+  _buffer.reserve(output_buffer_size);
+}
+
+output_sink::output_sink(std::string& output) : _output{&output} { _buffer.reserve(output_buffer_size); }
+
+output_sink::~output_sink() { static_cast<void>(flush()); }
+
+void output_sink::write_line(const diff_line& line) {
+  // Empty context lines are output without the leading space
+  if (line.type == diff_line_type::context && line.line.empty()) {
+    if (_buffer.size() == output_buffer_size) {
+      static_cast<void>(flush());
+    }
+    _buffer.push_back('\n');
+    return;
+  }
+
+  char prefix = ' ';
+  switch (line.type) {
+    case diff_line_type::context:
+      prefix = ' ';
+      break;
+    case diff_line_type::expected_only:
+      prefix = '-';
+      break;
+    case diff_line_type::actual_only:
+      prefix = '+';
+      break;
+    default:
+      assert(false);
+  }
+
+  const auto size = line.line.size() + 2;
+  if (_buffer.size() + size > output_buffer_size) {
+    // Lines which do not fit into the buffer are written out directly along with the buffered lines
+    if (size > output_buffer_size) {
+      write_chunks({_buffer, std::string_view{&prefix, 1}, line.line, "\n"});
+      _buffer.clear();
+      return;
+    }
+
+    static_cast<void>(flush());
+  }
+
+  _buffer.push_back(prefix);
+  _buffer.append(line.line);
+  _buffer.push_back('\n');
+}
+
+void output_sink::write_hunk_header(std::size_t expected_begin,
+                                    std::size_t expected_count,
+                                    std::size_t actual_begin,
+                                    std::size_t actual_count) {
+  // Ranges of one line omit their length, and empty ranges start at the line before them
+  auto range = [](std::size_t begin, std::size_t count) {
+    return count == 1 ? std::format("{}", begin + 1) : std::format("{},{}", count == 0 ? begin : begin + 1, count);
+  };
+  write(std::format("@@ -{} +{} @@\n", range(expected_begin, expected_count), range(actual_begin, actual_count)));
+}
+
+void output_sink::write(std::string_view text) {
+  if (_buffer.size() + text.size() > output_buffer_size) {
+    // Text which does not fit into the buffer is written out directly along with the buffered text
+    if (text.size() > output_buffer_size) {
+      write_chunks({_buffer, text});
+      _buffer.clear();
+      return;
+    }
+
+    static_cast<void>(flush());
+  }
+
+  _buffer.append(text);
+}
+
+auto output_sink::flush() -> std::expected<void, std::string> {
+  write_chunks({_buffer});
+  _buffer.clear();
+
+  if (_error) {
+    return std::unexpected{*_error};
+  }
+  return {};
+}
+
+void output_sink::write_chunks(std::initializer_list<std::string_view> chunks) {
+  if (_error) {
+    return;
+  }
+
+  if (_output != nullptr) {
+    for (const auto chunk : chunks) {
+      _output->append(chunk);
+    }
+    return;
+  }
+
+#ifdef NANODIFF_HAS_POSIX
+  std::array<::iovec, 4> iovecs{};
+  assert(chunks.size() <= iovecs.size());
+
+  std::size_t count{};
+  for (const auto chunk : chunks) {
+    if (!chunk.empty()) {
+      // NOLINTNEXTLINE(cppcoreguidelines-pro-type-const-cast)
+      iovecs[count++] = ::iovec{.iov_base = const_cast<char*>(chunk.data()), .iov_len = chunk.size()};
+    }
+  }
+
+  auto* pending = iovecs.data();
+  while (count != 0) {
+    const auto nwritten = ::writev(::fileno(_stream), pending, static_cast<int>(count));
+    if (nwritten < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      _error = std::format("Unable to write output: {}", std::strerror(errno));
+      return;
+    }
+
+    // Skip over the chunks which were written in full, and resume from the middle of the next one
+    auto remaining = static_cast<std::size_t>(nwritten);
+    while (count != 0 && remaining >= pending->iov_len) {
+      remaining -= pending->iov_len;
+      ++pending;
+      --count;
+    }
+    if (count != 0) {
+      pending->iov_base = static_cast<char*>(pending->iov_base) + remaining;
+      pending->iov_len -= remaining;
+    }
+  }
+#else
+  for (const auto chunk : chunks) {
+    if (std::fwrite(chunk.data(), 1, chunk.size(), _stream) != chunk.size()) {
+      _error = "Unable to write output";
+      return;
+    }
+  }
+  if (std::fflush(_stream) != 0) {
+    _error = "Unable to write output";
+  }
+#endif  // NANODIFF_HAS_POSIX
+}
+
+namespace {
+/**
+ * @brief Exit code returned when the look-ahead limit was reached, in which case the diff may contain lines which are
+ * not actually missing from the actual output.
+ */
+[[maybe_unused]] constexpr int lookahead_exceeded_exit_code = 2;
+
+/**
+ * @brief Position and size of a hunk in both files, where the positions are 0-based indices of the first line.
+ */
+struct diff_hunk {
+  std::size_t expected_begin;
+  std::size_t expected_count;
+  std::size_t actual_begin;
+  std::size_t actual_count;
+};
+
+/**
+ * @brief Writer which receives each complete hunk from a @code hunk_sink @endcode.
+ */
+template<typename Writer>
+concept hunk_writer = requires(Writer& writer, const diff_hunk& hunk, const diff_line& line) {
+  writer.begin_hunk(hunk);
+  writer.write_line(line);
+  writer.end_hunk();
+};
+
+/**
+ * @brief Sink which groups the lines of a diff into hunks, each with up to @code context @endcode context lines around
+ * its changes, and passes them to a @code hunk_writer @endcode.
+ *
+ * The differ must output every context line, which is done by setting @code diff_options::context_lines @endcode.
+ * Only the last @code context @endcode context lines are kept, in a ring buffer which grows with the lines seen until
+ * it is full and then reuses the storage of each line, and only the lines of the current hunk are buffered until its
+ * size is known.
+ *
+ * If the writer declares @code max_hunk_lines @endcode and @code max_hunk_bytes @endcode, a hunk is split before the
+ * next change once it holds as many lines or bytes, so that a large change is written while it is being compared. The
+ * part before the split keeps the context lines up to that change, or its trailing context if there is none, and the
+ * part following the split has no leading context.
+ */
+template<hunk_writer Writer>
+class hunk_sink {
+ public:
+  hunk_sink(Writer& writer, std::size_t context) : _writer{&writer}, _context{context} {}
+
+  void operator()(const diff_line& line) {
+    if (line.type != diff_line_type::context) {
+      if (_split_pending) {
+        // All context lines since the limit was reached belong to the hunk, and the next one continues right after it
+        _trailing_context = 0;
+        end_hunk();
+        _context_ring.clear();
+        _ring_next = 0;
+      }
+      if (!_in_hunk) {
+        start_hunk();
+      }
+      _trailing_context = 0;
+      append_line(line);
+      if constexpr (requires { Writer::max_hunk_lines; Writer::max_hunk_bytes; }) {
+        // The hunk is only split at the next change, so that it still ends with its context lines if there is none
+        _split_pending = _hunk_lines.size() >= Writer::max_hunk_lines || _hunk_text.size() >= Writer::max_hunk_bytes;
+      }
+      return;
+    }
+
+    if (_in_hunk) {
+      // Two hunks are merged if at most twice as many context lines separate them
+      if (_trailing_context == 2 * _context) {
+        end_hunk();
+      } else {
+        ++_trailing_context;
+        append_line(line);
+      }
+    }
+
+    ++_expected_pos;
+    ++_actual_pos;
+    if (_context_ring.size() < _context) {
+      _context_ring.emplace_back(line.line);
+      _ring_next = _context_ring.size() % _context;
+    } else if (_context != 0) {
+      _context_ring[_ring_next].assign(line.line);
+      _ring_next = (_ring_next + 1) % _context;
+    }
+  }
+
+  /**
+   * @brief Writes out the last hunk, which must be called after the diff is complete.
+   */
+  void finish() {
+    if (_in_hunk) {
+      drop_final_empty_line();
+      end_hunk();
+    }
+  }
+
+ private:
+  struct hunk_line {
+    diff_line_type type;
+    // End of the line in `_hunk_text`
+    std::size_t end;
+  };
+
+  void start_hunk() {
+    _in_hunk = true;
+    _hunk = diff_hunk{
+        .expected_begin = _expected_pos - _context_ring.size(),
+        .expected_count = 0,
+        .actual_begin = _actual_pos - _context_ring.size(),
+        .actual_count = 0,
+    };
+    for (std::size_t i = 0; i < _context_ring.size(); ++i) {
+      const auto& line = _context_ring[(_ring_next + i) % _context_ring.size()];
+      append_line(diff_line{.line = line, .type = diff_line_type::context});
+    }
+  }
+
+  void append_line(const diff_line& line) {
+    _hunk_text.append(line.line);
+    _hunk_lines.push_back(hunk_line{.type = line.type, .end = _hunk_text.size()});
+    if (line.type != diff_line_type::actual_only) {
+      ++_hunk.expected_count;
+      _expected_pos += line.type == diff_line_type::expected_only ? 1 : 0;
+    }
+    if (line.type != diff_line_type::expected_only) {
+      ++_hunk.actual_count;
+      _actual_pos += line.type == diff_line_type::actual_only ? 1 : 0;
+    }
+  }
+
+  /**
+   * @brief Removes the empty line which follows the final newline of both files from the end of the hunk, as it is not
+   * a line of either file.
+   *
+   * Every line of a file which does not end with a newline is non-empty, and every differ matches this line of both
+   * files against each other after all other lines, so a final empty context line can only be this line. If the diff
+   * stopped after the first hunk, it is followed by more context lines than the hunk includes, so removing it does not
+   * change the lines of the hunk.
+   */
+  void drop_final_empty_line() {
+    if (_trailing_context == 0) {
+      return;
+    }
+    const auto begin = _hunk_lines.size() >= 2 ? _hunk_lines[_hunk_lines.size() - 2].end : 0;
+    if (_hunk_lines.back().end != begin) {
+      return;
+    }
+    _hunk_lines.pop_back();
+    --_hunk.expected_count;
+    --_hunk.actual_count;
+    --_trailing_context;
+  }
+
+  void end_hunk() {
+    // Only the first context lines following the last change belong to the hunk
+    const auto excess = _trailing_context - std::min(_trailing_context, _context);
+    _hunk_lines.resize(_hunk_lines.size() - excess);
+    _hunk.expected_count -= excess;
+    _hunk.actual_count -= excess;
+
+    _writer->begin_hunk(_hunk);
+    std::size_t begin{};
+    for (const auto& [type, end] : _hunk_lines) {
+      _writer->write_line(diff_line{.line = std::string_view{_hunk_text}.substr(begin, end - begin), .type = type});
+      begin = end;
+    }
+    _writer->end_hunk();
+
+    _hunk_text.clear();
+    _hunk_lines.clear();
+    _trailing_context = 0;
+    _in_hunk = false;
+    _split_pending = false;
+  }
+
+  Writer* _writer;
+  std::size_t _context;
+  // The last context lines, of which there are at most `_context`
+  std::vector<std::string> _context_ring;
+  // Position in `_context_ring` of the oldest context line, at which the next one is stored once the ring is full
+  std::size_t _ring_next{};
+  // Number of lines of each file before the current line
+  std::size_t _expected_pos{};
+  std::size_t _actual_pos{};
+
+  bool _in_hunk{};
+  diff_hunk _hunk{};
+  // Number of context lines at the end of the current hunk
+  std::size_t _trailing_context{};
+  // Whether the current hunk reached the size limit of the writer, and is split before its next change
+  bool _split_pending{};
+  // Contents of all lines of the current hunk, which are not separated
+  std::string _hunk_text;
+  std::vector<hunk_line> _hunk_lines;
+};
+
+/**
+ * @brief Writes hunks as unified-diff text, i.e. a @code @@ -a,b +c,d @@ @endcode header followed by the lines of the
+ * hunk in the usual format.
+ */
+class unified_writer {
+ public:
+  // Number of lines and total size of their text after which a hunk is ended, so that memory use does not grow with the
+  // size of a change. Adjacent hunks apply the same as a single one.
+  static constexpr std::size_t max_hunk_lines = 1U << 12U;
+  static constexpr std::size_t max_hunk_bytes = 1U << 20U;
+
+  explicit unified_writer(output_sink& output) : _output{&output} {}
+
+  void begin_hunk(const diff_hunk& hunk) {
+    _output->write_hunk_header(hunk.expected_begin, hunk.expected_count, hunk.actual_begin, hunk.actual_count);
+  }
+  void write_line(const diff_line& line) { _output->write_line(line); }
+  void end_hunk() {}
+
+ private:
+  output_sink* _output;
+};
+
+/**
+ * @brief Writes hunks as newline-delimited JSON, with one record per hunk, followed by a summary record.
+ *
+ * Each hunk record holds the 1-based number and the size of the hunk in both files, and for each line its type named
+ * after @code diff_line_type @endcode, its number in each file containing it, and its text:
+ *
+ * @code
+ * {"type":"hunk","expected_start":2,"expected_count":1,"actual_start":2,"actual_count":1,
+ *  "lines":[{"type":"expected_only","expected_line":2,"text":"2"},{"type":"actual_only","actual_line":2,"text":"X"}]}
+ * @endcode
+ *
+ * Records are written straight into the buffer of the output sink, without allocating. Bytes which are not valid UTF-8
+ * are written as U+FFFD.
+ *
+ * Hunks are split into several records once they reach a fixed number of lines or bytes, so that the records of a large
+ * change are streamed while it is being compared instead of being buffered until it ends.
+ */
+class ndjson_writer {
+ public:
+  // Number of lines and total size of their text after which a hunk record is ended
+  static constexpr std::size_t max_hunk_lines = 1U << 12U;
+  static constexpr std::size_t max_hunk_bytes = 1U << 20U;
+
+  explicit ndjson_writer(output_sink& output) : _output{&output} {}
+
+  void begin_hunk(const diff_hunk& hunk) {
+    ++_hunks;
+    _expected_line = hunk.expected_begin;
+    _actual_line = hunk.actual_begin;
+    _first_line = true;
+
+    // The start of a hunk without lines in a file is the number of the line following it
+    _output->write(R"({"type":"hunk","expected_start":)");
+    write_number(hunk.expected_begin + 1);
+    _output->write(R"(,"expected_count":)");
+    write_number(hunk.expected_count);
+    _output->write(R"(,"actual_start":)");
+    write_number(hunk.actual_begin + 1);
+    _output->write(R"(,"actual_count":)");
+    write_number(hunk.actual_count);
+    _output->write(R"(,"lines":[)");
+  }
+
+  void write_line(const diff_line& line) {
+    _output->write(std::exchange(_first_line, false) ? R"({"type":")" : R"(,{"type":")");
+    switch (line.type) {
+      case diff_line_type::context:
+        _output->write("context\"");
+        break;
+      case diff_line_type::expected_only:
+        _output->write("expected_only\"");
+        ++_expected_only;
+        break;
+      case diff_line_type::actual_only:
+        _output->write("actual_only\"");
+        ++_actual_only;
+        break;
+      default:
+        assert(false);
+    }
+    if (line.type != diff_line_type::actual_only) {
+      _output->write(R"(,"expected_line":)");
+      write_number(++_expected_line);
+    }
+    if (line.type != diff_line_type::expected_only) {
+      _output->write(R"(,"actual_line":)");
+      write_number(++_actual_line);
+    }
+    _output->write(R"(,"text":)");
+    write_string(line.line);
+    _output->write("}");
+  }
+
+  void end_hunk() { _output->write("]}\n"); }
+
+  /**
+   * @brief Writes the record which precedes the records of each pair of files in batch mode.
+   */
+  void write_file(int exit_code, std::string_view expected, std::string_view actual) {
+    _output->write(R"({"type":"file","exit_code":)");
+    write_number(exit_code);
+    _output->write(R"(,"expected":)");
+    write_string(expected);
+    _output->write(R"(,"actual":)");
+    write_string(actual);
+    _output->write("}\n");
+  }
+
+  /**
+   * @brief Writes the summary record, which holds the number of hunks and changed lines written, and the result and
+   * duration of the comparison.
+   */
+  void write_summary(const diff_result& result, std::chrono::steady_clock::duration elapsed) {
+    _output->write(R"({"type":"summary","has_diff":)");
+    _output->write(result.has_diff ? "true" : "false");
+    _output->write(R"(,"hunks":)");
+    write_number(_hunks);
+    _output->write(R"(,"expected_only":)");
+    write_number(_expected_only);
+    _output->write(R"(,"actual_only":)");
+    write_number(_actual_only);
+    _output->write(R"(,"lookahead_exceeded":)");
+    write_number(result.lookahead_exceeded);
+    _output->write(R"(,"budget_exceeded":)");
+    _output->write(result.budget_exceeded ? "true" : "false");
+    _output->write(R"(,"elapsed_ms":)");
+    write_milliseconds(elapsed);
+    _output->write("}\n");
+  }
+
+  /**
+   * @brief Writes the statistics of the comparison of the given files as a record of type `stats`, whose fields are
+   * named after those of @code diff_stats @endcode.
+   */
+  void write_stats(const diff_stats& stats, std::string_view expected, std::string_view actual) {
+    _output->write(R"({"type":"stats","expected":)");
+    write_string(expected);
+    _output->write(R"(,"actual":)");
+    write_string(actual);
+    for (const auto& [name, value] : {
+             std::pair{R"(,"expected_lines":)", stats.expected_lines},
+             std::pair{R"(,"expected_bytes":)", stats.expected_bytes},
+             std::pair{R"(,"actual_lines":)", stats.actual_lines},
+             std::pair{R"(,"actual_bytes":)", stats.actual_bytes},
+             std::pair{R"(,"skipped_bytes":)", stats.skipped_bytes},
+             std::pair{R"(,"buffer_peak_lines":)", stats.buffer_peak_lines},
+             std::pair{R"(,"buffer_peak_bytes":)", stats.buffer_peak_bytes},
+             std::pair{R"(,"buffer_samples":)", stats.buffer_samples},
+             std::pair{R"(,"buffer_total_lines":)", stats.buffer_total_lines},
+             std::pair{R"(,"line_comparisons":)", stats.line_comparisons},
+             std::pair{R"(,"hash_probes":)", stats.hash_probes},
+             std::pair{R"(,"allocations":)", stats.allocations},
+             std::pair{R"(,"allocated_bytes":)", stats.allocated_bytes},
+         }) {
+      _output->write(name);
+      write_number(value);
+    }
+    for (const auto& [name, value] : {
+             std::pair{R"(,"total_ms":)", stats.total_time},
+             std::pair{R"(,"io_ms":)", stats.io_time},
+             std::pair{R"(,"match_ms":)", match_time(stats)},
+             std::pair{R"(,"output_ms":)", stats.output_time},
+         }) {
+      _output->write(name);
+      write_milliseconds(value);
+    }
+    _output->write("}\n");
+  }
+
+ private:
+  void write_milliseconds(std::chrono::nanoseconds duration) {
+    std::array<char, 32> chars{};
+    const auto ms = std::chrono::duration<double, std::milli>{duration}.count();
+    const auto [ptr, ec] = std::to_chars(chars.data(), chars.data() + chars.size(), ms, std::chars_format::fixed, 3);
+    _output->write(std::string_view{chars.data(), ec == std::errc{} ? ptr : chars.data()});
+  }
+
+  void write_number(std::integral auto value) {
+    std::array<char, std::numeric_limits<std::size_t>::digits10 + 2> chars{};
+    const auto [ptr, ec] = std::to_chars(chars.data(), chars.data() + chars.size(), value);
+    _output->write(std::string_view{chars.data(), ptr});
+  }
+
+  /**
+   * @brief Returns the length of the UTF-8 sequence starting at @code pos @endcode, or 0 if it is not valid.
+   */
+  static auto utf8_sequence_length(std::string_view text, std::size_t pos) noexcept -> std::size_t {
+    const auto byte = [&](std::size_t offset) { return static_cast<unsigned char>(text[pos + offset]); };
+    const auto lead = byte(0);
+
+    std::size_t length{};
+    // The range of the second byte excludes overlong encodings, surrogates, and code points above U+10FFFF
+    unsigned char second_min = 0x80;
+    unsigned char second_max = 0xBF;
+    if (lead >= 0xC2 && lead <= 0xDF) {
+      length = 2;
+    } else if (lead >= 0xE0 && lead <= 0xEF) {
+      length = 3;
+      second_min = lead == 0xE0 ? 0xA0 : second_min;
+      second_max = lead == 0xED ? 0x9F : second_max;
+    } else if (lead >= 0xF0 && lead <= 0xF4) {
+      length = 4;
+      second_min = lead == 0xF0 ? 0x90 : second_min;
+      second_max = lead == 0xF4 ? 0x8F : second_max;
+    } else {
+      return 0;
+    }
+
+    if (text.size() - pos < length || byte(1) < second_min || byte(1) > second_max) {
+      return 0;
+    }
+    for (std::size_t i = 2; i < length; ++i) {
+      if (byte(i) < 0x80 || byte(i) > 0xBF) {
+        return 0;
+      }
+    }
+    return length;
+  }
+
+  void write_string(std::string_view text) {
+    static constexpr std::string_view hex_digits = "0123456789abcdef";
+
+    _output->write("\"");
+    // Runs of characters which need no escaping are written at once
+    std::size_t run_begin{};
+    std::size_t pos{};
+    while (pos < text.size()) {
+      const auto c = static_cast<unsigned char>(text[pos]);
+      if (c >= 0x20 && c != '"' && c != '\\' && c < 0x80) {
+        ++pos;
+        continue;
+      }
+      if (c >= 0x80) {
+        if (const auto length = utf8_sequence_length(text, pos); length != 0) {
+          pos += length;
+          continue;
+        }
+      }
+
+      _output->write(text.substr(run_begin, pos - run_begin));
+      switch (c) {
+        case '"':
+          _output->write("\\\"");
+          break;
+        case '\\':
+          _output->write("\\\\");
+          break;
+        case '\t':
+          _output->write("\\t");
+          break;
+        case '\r':
+          _output->write("\\r");
+          break;
+        case '\n':
+          _output->write("\\n");
+          break;
+        default:
+          if (c >= 0x80) {
+            _output->write("\\ufffd");
+          } else {
+            const std::array<char, 6> escape{'\\', 'u', '0', '0', hex_digits[c >> 4U], hex_digits[c & 0xFU]};
+            _output->write(std::string_view{escape.data(), escape.size()});
+          }
+          break;
+      }
+      run_begin = ++pos;
+    }
+    _output->write(text.substr(run_begin));
+    _output->write("\"");
+  }
+
+  output_sink* _output;
+  std::size_t _hunks{};
+  std::size_t _expected_only{};
+  std::size_t _actual_only{};
+  // Number of the last line written from each file
+  std::size_t _expected_line{};
+  std::size_t _actual_line{};
+  bool _first_line{};
 };
 
-class lazy_file_differ final : public file_differ {
- public:
-  lazy_file_differ(const lazy_file_differ&) = delete;
-  lazy_file_differ(lazy_file_differ&&) noexcept = default;
+/**
+ * @brief Number of context lines around each change in NDJSON output, unless given by @code --unified @endcode.
+ */
+constexpr std::size_t default_ndjson_context = 3;
+
+/**
+ * @brief Returns the number of context lines around each change needed by the output format, if it groups the diff
+ * into hunks.
+ */
+auto output_context_lines(const command_line_args& cmd_args) -> std::optional<std::size_t> {
+  if (cmd_args.format == output_format::ndjson) {
+    return cmd_args.unified.value_or(default_ndjson_context);
+  }
+  return cmd_args.unified;
+}
 
-  ~lazy_file_differ() override = default;
+/**
+ * @brief Calls @code diff @endcode with a sink which writes the lines it receives to @code output @endcode in the
+ * format selected by the command line arguments.
+ */
+template<typename Diff>
+auto diff_to_output(const command_line_args& cmd_args, output_sink& output, Diff diff) {
+  if (cmd_args.format == output_format::ndjson) {
+    const auto start = std::chrono::steady_clock::now();
+    ndjson_writer writer{output};
+    hunk_sink hunks{writer, *output_context_lines(cmd_args)};
+    auto result = diff(hunks);
+    hunks.finish();
 
-  auto operator=(const lazy_file_differ&) -> lazy_file_differ& = delete;
-  auto operator=(lazy_file_differ&&) noexcept -> lazy_file_differ& = default;
+    // Failed comparisons have no summary, and are reported on stderr instead
+    if constexpr (std::same_as<decltype(result), diff_result>) {
+      writer.write_summary(result, std::chrono::steady_clock::now() - start);
+    } else if (result) {
+      writer.write_summary(*result, std::chrono::steady_clock::now() - start);
+    }
+    return result;
+  }
+  if (cmd_args.unified) {
+    unified_writer writer{output};
+    hunk_sink hunks{writer, *cmd_args.unified};
+    auto result = diff(hunks);
+    hunks.finish();
+    return result;
+  }
+  return diff(output);
+}
 
-  lazy_file_differ(std::ifstream expected, std::ifstream actual) :
-      _expected{std::move(expected)}, _actual{std::move(actual)} {}
+/**
+ * @brief Outputs the statistics of the comparison of the given files to stderr, in the given format.
+ */
+void print_stats(stats_format format, const diff_stats& stats, std::string_view expected, std::string_view actual) {
+  if (format == stats_format::json) {
+    std::string record{};
+    output_sink record_sink{record};
+    ndjson_writer{record_sink}.write_stats(stats, expected, actual);
+    static_cast<void>(record_sink.flush());
+    std::fwrite(record.data(), 1, record.size(), stderr);
+    return;
+  }
 
- private:
-  auto read_expected_line() -> std::optional<std::string> override {
-    std::optional<std::string> line{};
+  const auto ms = [](std::chrono::nanoseconds duration) {
+    return std::chrono::duration<double, std::milli>{duration}.count();
+  };
+  const auto buffer_average_lines =
+      stats.buffer_samples == 0
+          ? 0.0
+          : static_cast<double>(stats.buffer_total_lines) / static_cast<double>(stats.buffer_samples);
+  std::print(stderr,
+             "Statistics of {} and {}:\n"
+             "  Expected: {} lines, {} bytes read\n"
+             "  Actual: {} lines, {} bytes read\n"
+             "  Common prefix and suffix: {} bytes skipped\n"
+             "  Look-ahead buffer: {} lines ({} bytes) at most, {:.2f} lines on average\n"
+             "  Line comparisons: {}\n"
+             "  Hash probes: {}\n"
+             "  Allocations: {} ({} bytes)\n"
+             "  Time: {:.3f} ms, of which {:.3f} ms reading, {:.3f} ms matching, {:.3f} ms output\n",
+             expected,
+             actual,
+             stats.expected_lines,
+             stats.expected_bytes,
+             stats.actual_lines,
+             stats.actual_bytes,
+             stats.skipped_bytes,
+             stats.buffer_peak_lines,
+             stats.buffer_peak_bytes,
+             buffer_average_lines,
+             stats.line_comparisons,
+             stats.hash_probes,
+             stats.allocations,
+             stats.allocated_bytes,
+             ms(stats.total_time),
+             ms(stats.io_time),
+             ms(match_time(stats)),
+             ms(stats.output_time));
+}
+
+/**
+ * @brief Builds the options used to compute each diff from the command line arguments.
+ */
+auto make_diff_options(const command_line_args& cmd_args) -> diff_options {
+  diff_options options{};
+  // Whether the files differ does not depend on the algorithm, so use the one which can stop reading earliest
+  options.algorithm = cmd_args.quiet ? diff_algorithm::greedy : cmd_args.algorithm;
+  options.max_lookahead_lines = cmd_args.max_lookahead_lines.value_or(options.max_lookahead_lines);
+  options.max_lookahead_bytes = cmd_args.max_lookahead_bytes.value_or(options.max_lookahead_bytes);
+  options.max_cost = cmd_args.max_cost.value_or(options.max_cost);
+  if (cmd_args.timeout_ms) {
+    using rep = std::chrono::milliseconds::rep;
+    options.timeout = std::chrono::milliseconds{
+        static_cast<rep>(std::min<std::size_t>(*cmd_args.timeout_ms, std::numeric_limits<rep>::max()))};
+  }
+  options.read_ahead = cmd_args.read_ahead.value_or(options.read_ahead);
+  options.index_expected = cmd_args.index;
+  options.index_dir = cmd_args.index_dir.value_or("");
+  options.ignore_trailing_space = cmd_args.ignore_trailing_space;
+  options.ignore_all_space = cmd_args.ignore_all_space;
+  options.ignore_case = cmd_args.ignore_case;
+  options.ignore_blank_lines = cmd_args.ignore_blank_lines;
+  options.abs_tolerance = cmd_args.abs_tolerance.value_or(options.abs_tolerance);
+  options.rel_tolerance = cmd_args.rel_tolerance.value_or(options.rel_tolerance);
+  options.context_lines = output_context_lines(cmd_args);
+  if (cmd_args.quiet) {
+    options.stop = diff_stop::at_first_difference;
+  } else if (cmd_args.first || cmd_args.run_command) {
+    options.stop = diff_stop::after_first_hunk;
+  }
+  return options;
+}
+
+/**
+ * @brief Returns the exit code of a single comparison with the given result.
+ */
+auto result_exit_code(const std::expected<diff_result, std::string>& result, int diff_exit_code) -> int {
+  if (!result) {
+    return EXIT_FAILURE;
+  }
+  if (result->lookahead_exceeded != 0) {
+    return lookahead_exceeded_exit_code;
+  }
+  return result->has_diff ? diff_exit_code : EXIT_SUCCESS;
+}
+
+/**
+ * @brief Outputs the message for a diff whose search for a minimal diff exceeded its budget.
+ */
+void print_budget_exceeded() {
+  std::print(stderr,
+             "Diff budget exceeded: the rest of the files were compared with the greedy algorithm, so the diff may "
+             "not be minimal\n");
+}
+
+/**
+ * @brief Outputs the message for a diff in which the look-ahead limit was reached.
+ */
+void print_lookahead_exceeded(std::size_t lookahead_exceeded) {
+  std::print(stderr,
+             "Look-ahead limit reached: {} expected line(s) were reported as missing without searching the rest of "
+             "the actual output; the diff may contain lines which are not actually missing or extra\n",
+             lookahead_exceeded);
+}
+
+/**
+ * @brief Pair of files compared in batch mode.
+ */
+struct batch_job {
+  std::filesystem::path expected;
+  std::filesystem::path actual;
+};
+
+/**
+ * @brief Collects the pairs of files to compare in batch mode, in the order in which their results are output.
+ *
+ * Directories given as actual outputs are expanded into the regular files directly inside them, sorted by name. Paths
+ * are not checked here, so that a missing actual output only fails its own comparison.
+ */
+auto collect_batch_jobs(const command_line_args& cmd_args) -> std::expected<std::vector<batch_job>, std::string> {
+  std::vector<batch_job> jobs{};
 
-    if (_expected) {
-      line = std::string{};
-      std::getline(_expected, *line);
+  if (cmd_args.manifest) {
+    std::ifstream manifest{*cmd_args.manifest};
+    if (!manifest) {
+      return std::unexpected{std::format("Unable to open manifest '{}'", *cmd_args.manifest)};
     }
 
-    return line;
+    std::string line{};
+    for (std::size_t line_number = 1; std::getline(manifest, line); ++line_number) {
+      if (line.empty()) {
+        continue;
+      }
+
+      const auto tab = line.find('\t');
+      if (tab == std::string::npos) {
+        return std::unexpected{std::format(
+            "'{}', line {}: Expected paths to expected and actual outputs separated by a tab",
+            *cmd_args.manifest,
+            line_number)};
+      }
+
+      jobs.push_back(batch_job{.expected = line.substr(0, tab), .actual = line.substr(tab + 1)});
+    }
+
+    return jobs;
   }
-  auto read_actual_line() -> std::optional<std::string> override {
-    std::optional<std::string> line{};
 
-    if (_actual) {
-      line = std::string{};
-      std::getline(_actual, *line);
+  const std::filesystem::path expected{*cmd_args.expected};
+  for (const auto& actual : *cmd_args.batch_actuals) {
+    std::error_code ec{};
+    if (!std::filesystem::is_directory(actual, ec)) {
+      jobs.push_back(batch_job{.expected = expected, .actual = actual});
+      continue;
     }
 
-    return line;
+    std::vector<std::filesystem::path> files{};
+    for (std::filesystem::directory_iterator it{actual, ec}, end{}; !ec && it != end; it.increment(ec)) {
+      if (it->is_regular_file(ec)) {
+        files.push_back(it->path());
+      }
+    }
+    if (ec) {
+      return std::unexpected{std::format("'{}': Unable to read directory: {}", actual, ec.message())};
+    }
+
+    std::ranges::sort(files);
+    for (auto& file : files) {
+      jobs.push_back(batch_job{.expected = expected, .actual = std::move(file)});
+    }
+  }
+
+  return jobs;
+}
+
+/**
+ * @brief Contents of an expected file in batch mode, which are read once and shared by all comparisons against it.
+ */
+class preloaded_file {
+ public:
+  explicit preloaded_file(file_line_reader reader) : _reader{std::move(reader)} {
+    // Readers which do not hold their contents in memory are read into a buffer with the same lines
+    std::visit(
+        [this](auto& line_reader) {
+          if (line_reader.contents()) {
+            return;
+          }
+
+          auto line = line_reader.read_line();
+          while (line) {
+            _buffer.append(*line);
+            line = line_reader.read_line();
+            if (line) {
+              _buffer.push_back('\n');
+            }
+          }
+        },
+        _reader);
+  }
+
+  [[nodiscard]] auto contents() const noexcept -> std::string_view {
+    return std::visit([this](const auto& line_reader) { return line_reader.contents().value_or(_buffer); }, _reader);
+  }
+
+  /**
+   * @brief Returns the line index of @code contents() @endcode, if any.
+   */
+  [[nodiscard]] auto index() const noexcept -> line_index_view {
+    return std::visit(
+        [](const auto& line_reader) -> line_index_view {
+          if constexpr (requires { line_reader.index(); }) {
+            return line_reader.index();
+          } else {
+            return {};
+          }
+        },
+        _reader);
+  }
+
+ private:
+  file_line_reader _reader;
+  std::string _buffer;
+};
+
+/**
+ * @brief Compares one actual output against a preloaded expected file, writing the diff into @code output @endcode.
+ */
+auto run_batch_job(const preloaded_file& expected,
+                   const std::filesystem::path& actual,
+                   const command_line_args& cmd_args,
+                   const diff_options& options,
+                   std::string& output) -> std::expected<diff_result, std::string> {
+  const auto actual_path_or_err = normalize_path(actual.string());
+  if (!actual_path_or_err) {
+    return std::unexpected{actual_path_or_err.error()};
   }
+  read_progress actual_progress{};
+  auto actual_reader = open_line_reader(*actual_path_or_err, options.read_ahead, actual_progress);
+  if (!actual_reader) {
+    return std::unexpected{actual_reader.error()};
+  }
+
+  output_sink sink{output};
+  const auto result = std::visit(
+      [&](auto& actual_line_reader) {
+        memory_line_reader expected_reader{expected.contents(), expected.index()};
+        if (cmd_args.quiet) {
+          const auto discard = [](const diff_line&) {};
+          return diff_sources(std::move(expected_reader), std::move(actual_line_reader), options, discard);
+        }
+
+        return diff_to_output(cmd_args, sink, [&](auto& line_sink) {
+          return diff_sources(std::move(expected_reader), std::move(actual_line_reader), options, line_sink);
+        });
+      },
+      *actual_reader);
 
-  std::ifstream _expected;
-  std::ifstream _actual;
+  if (actual_progress.error != 0) {
+    return std::unexpected{read_error_message(*actual_path_or_err, actual_progress.error)};
+  }
+  return result;
+}
+
+/**
+ * @brief Result of a comparison in batch mode, which is filled in by a worker thread.
+ */
+struct batch_result {
+  std::expected<diff_result, std::string> result;
+  std::string output;
+  diff_stats stats;
+  std::atomic<bool> done;
 };
 
 /**
- * @brief Compares two files line by line and outputs the by the @code line_callback @endcode function.
+ * @brief Runs all comparisons of batch mode on a pool of threads.
  *
- * This is the reference implementation of the diff algorithm, which eagerly reads both files into memory
- * and compares them line-by-line.
+ * For each pair of files in order, a line containing the exit code of the comparison and the paths of both files
+ * separated by tabs is output, followed by the diff of the pair. Neither starts with a digit, so the two can always be
+ * told apart. With NDJSON output, the line is replaced by a record of type `file` holding the same fields.
+ *
+ * @return The exit code of the process, which reports errors over reached look-ahead limits over differences in any of
+ * the comparisons.
  */
-[[maybe_unused]]
-auto diff_file_stdout_eager(std::ifstream expected, std::ifstream actual, const diff_line_cb& line_callback) -> bool {
-  eager_file_differ differ{std::move(expected), std::move(actual)};
+auto run_batch(const command_line_args& cmd_args) -> int {
+  const auto jobs_or_err = collect_batch_jobs(cmd_args);
+  if (!jobs_or_err) {
+    std::print(stderr, "{}\n", jobs_or_err.error());
+    return EXIT_FAILURE;
+  }
+  const auto& jobs = *jobs_or_err;
+  const auto options = make_diff_options(cmd_args);
 
-  return differ.do_diff(line_callback);
+  // Each distinct expected file is only opened and read once, before any worker starts
+  std::map<std::filesystem::path, std::expected<preloaded_file, std::string>> expected_files{};
+  for (const auto& job : jobs) {
+    if (expected_files.contains(job.expected)) {
+      continue;
+    }
+
+    const auto expected_path_or_err = normalize_path(job.expected.string());
+    if (!expected_path_or_err) {
+      expected_files.emplace(job.expected, std::unexpected{expected_path_or_err.error()});
+      continue;
+    }
+    read_progress expected_progress{};
+    auto expected_reader = open_line_reader(*expected_path_or_err, 0, expected_progress);
+    if (!expected_reader) {
+      expected_files.emplace(job.expected, std::unexpected{expected_reader.error()});
+      continue;
+    }
+    if (options.index_expected) {
+      attach_line_index(*expected_reader, *expected_path_or_err, options.index_dir);
+    }
+
+    preloaded_file expected{std::move(*expected_reader)};
+    if (expected_progress.error != 0) {
+      expected_files.emplace(job.expected,
+                             std::unexpected{read_error_message(*expected_path_or_err, expected_progress.error)});
+      continue;
+    }
+    expected_files.emplace(job.expected, std::move(expected));
+  }
+
+  std::vector<batch_result> results(jobs.size());
+  std::atomic<std::size_t> next_job{};
+  auto worker = [&] {
+    for (auto idx = next_job.fetch_add(1); idx < jobs.size(); idx = next_job.fetch_add(1)) {
+      auto& result = results[idx];
+      if (const auto& expected = expected_files.at(jobs[idx].expected); expected) {
+        auto job_options = options;
+        job_options.stats = cmd_args.stats ? &result.stats : nullptr;
+        result.result = run_batch_job(*expected, jobs[idx].actual, cmd_args, job_options, result.output);
+      } else {
+        result.result = std::unexpected{expected.error()};
+      }
+
+      result.done.store(true, std::memory_order_release);
+      result.done.notify_one();
+    }
+  };
+
+  const auto thread_count =
+      std::min(jobs.size(), cmd_args.jobs.value_or(std::max(std::thread::hardware_concurrency(), 1U)));
+  std::vector<std::jthread> threads{};
+  threads.reserve(thread_count);
+  for (std::size_t i = 0; i < thread_count; ++i) {
+    threads.emplace_back(worker);
+  }
+
+  // Results are output in order as soon as they are available, so that only the diffs which finished out of order
+  // are held in memory
+  bool has_error{};
+  bool has_lookahead_exceeded{};
+  bool has_diff{};
+  for (std::size_t idx = 0; idx < jobs.size(); ++idx) {
+    auto& result = results[idx];
+    result.done.wait(false, std::memory_order_acquire);
+
+    has_error = has_error || !result.result;
+    has_lookahead_exceeded = has_lookahead_exceeded || (result.result && result.result->lookahead_exceeded != 0);
+    has_diff = has_diff || (result.result && result.result->has_diff);
+
+    const auto job_exit_code = result_exit_code(result.result, cmd_args.exit_code);
+
+    if (cmd_args.format == output_format::ndjson) {
+      std::string record{};
+      output_sink record_sink{record};
+      ndjson_writer{record_sink}.write_file(job_exit_code, jobs[idx].expected.string(), jobs[idx].actual.string());
+      static_cast<void>(record_sink.flush());
+      std::fwrite(record.data(), 1, record.size(), stdout);
+    } else {
+      std::print("{}\t{}\t{}\n", job_exit_code, jobs[idx].expected.string(), jobs[idx].actual.string());
+    }
+    if (!result.result) {
+      std::print(stderr, "{}\n", result.result.error());
+    } else {
+      if (result.result->budget_exceeded) {
+        print_budget_exceeded();
+      }
+      if (result.result->lookahead_exceeded != 0) {
+        print_lookahead_exceeded(result.result->lookahead_exceeded);
+      }
+      if (cmd_args.stats) {
+        print_stats(*cmd_args.stats, result.stats, jobs[idx].expected.string(), jobs[idx].actual.string());
+      }
+    }
+    std::fwrite(result.output.data(), 1, result.output.size(), stdout);
+
+    result.output.clear();
+    result.output.shrink_to_fit();
+  }
+
+  if (std::fflush(stdout) != 0 || std::ferror(stdout) != 0) {
+    std::print(stderr, "Unable to write output\n");
+    return EXIT_FAILURE;
+  }
+
+  if (has_error) {
+    return EXIT_FAILURE;
+  }
+  if (has_lookahead_exceeded) {
+    return lookahead_exceeded_exit_code;
+  }
+  return has_diff ? cmd_args.exit_code : EXIT_SUCCESS;
 }
 
+#ifdef NANODIFF_HAS_POSIX
 /**
- * @brief Compares two files line by line and outputs the by the @code line_callback @endcode function.
+ * @brief Child process whose standard output is redirected into a pipe.
  *
- * This diff algorithm is derived from @code diff_file_stdout_eager @endcode, but it uses a lazy approach by lazily
- * looking ahead in the actual file and buffering lines until a match is found in the expected file.
+ * The process is killed if it is still running when this object is destroyed.
  */
-auto diff_file_stdout(std::ifstream expected, std::ifstream actual, const diff_line_cb& line_callback) -> bool {
-  lazy_file_differ differ{std::move(expected), std::move(actual)};
+class child_process {
+ public:
+  child_process(const child_process&) = delete;
+  child_process(child_process&& other) noexcept :
+      _pid{std::exchange(other._pid, -1)}, _stdout{std::move(other._stdout)} {}
 
-  return differ.do_diff(line_callback);
+  ~child_process() {
+    if (_pid > 0) {
+      static_cast<void>(kill());
+    }
+  }
+
+  auto operator=(const child_process&) -> child_process& = delete;
+  auto operator=(child_process&&) noexcept -> child_process& = delete;
+
+  /**
+   * @brief Starts @code command @endcode, looking up its first element in @code PATH @endcode.
+   */
+  static auto spawn(const std::vector<std::string>& command) -> std::expected<child_process, std::string> {
+    std::array<int, 2> pipe_fds{};
+    if (::pipe(pipe_fds.data()) != 0) {
+      return std::unexpected{std::format("Unable to create pipe: {}", std::strerror(errno))};
+    }
+    unique_fd read_end{pipe_fds[0]};
+    unique_fd write_end{pipe_fds[1]};
+    // Neither end is inherited as is; the write end is duplicated onto the standard output of the child
+    ::fcntl(read_end.get(), F_SETFD, FD_CLOEXEC);
+    ::fcntl(write_end.get(), F_SETFD, FD_CLOEXEC);
+
+    ::posix_spawn_file_actions_t actions{};
+    ::posix_spawn_file_actions_init(&actions);
+    ::posix_spawn_file_actions_adddup2(&actions, write_end.get(), STDOUT_FILENO);
+
+    std::vector<char*> argv{};
+    argv.reserve(command.size() + 1);
+    for (const auto& arg : command) {
+      // NOLINTNEXTLINE(cppcoreguidelines-pro-type-const-cast)
+      argv.push_back(const_cast<char*>(arg.c_str()));
+    }
+    argv.push_back(nullptr);
+
+    ::pid_t pid{};
+    const auto err = ::posix_spawnp(&pid, argv.front(), &actions, nullptr, argv.data(), environ);
+    ::posix_spawn_file_actions_destroy(&actions);
+    if (err != 0) {
+      return std::unexpected{std::format("Unable to run '{}': {}", command.front(), std::strerror(err))};
+    }
+
+    return child_process{pid, std::move(read_end)};
+  }
+
+  /**
+   * @brief Returns the read end of the pipe connected to the standard output of the process.
+   */
+  auto take_stdout() noexcept -> unique_fd { return std::move(_stdout); }
+
+  /**
+   * @brief Waits for the process to exit.
+   *
+   * @return The wait status of the process.
+   */
+  auto wait() -> int {
+    int status{};
+    while (::waitpid(_pid, &status, 0) < 0 && errno == EINTR) {
+    }
+    _pid = -1;
+    return status;
+  }
+
+  /**
+   * @brief Waits for the process to exit for at most @code timeout @endcode.
+   *
+   * @return The wait status of the process, or @code std::nullopt @endcode if it is still running.
+   */
+  auto wait_for(const std::chrono::milliseconds timeout) -> std::optional<int> {
+    const auto deadline = std::chrono::steady_clock::now() + timeout;
+    while (true) {
+      int status{};
+      const auto pid = ::waitpid(_pid, &status, WNOHANG);
+      if (pid == _pid || (pid < 0 && errno != EINTR)) {
+        _pid = -1;
+        return status;
+      }
+      if (std::chrono::steady_clock::now() >= deadline) {
+        return std::nullopt;
+      }
+      std::this_thread::sleep_for(std::chrono::milliseconds{1});
+    }
+  }
+
+  /**
+   * @brief Kills the process if it is still running, and waits for it to exit.
+   *
+   * @return The wait status of the process.
+   */
+  auto kill() -> int {
+    ::kill(_pid, SIGKILL);
+    return wait();
+  }
+
+ private:
+  child_process(::pid_t pid, unique_fd stdout_fd) noexcept : _pid{pid}, _stdout{std::move(stdout_fd)} {}
+
+  ::pid_t _pid;
+  unique_fd _stdout;
+};
+
+/**
+ * @brief How long a command may keep running after closing its standard output before it is killed.
+ */
+constexpr std::chrono::milliseconds command_exit_grace_period{1000};
+
+/**
+ * @brief Number of bytes by which the output of a command may exceed twice the size of the expected file unless
+ * @code --max-output-bytes @endcode is given.
+ *
+ * An output this much longer than the expected file cannot match it, and most likely comes from a command stuck in a
+ * loop, which would otherwise be read, and buffered while looking ahead, until it is killed from outside.
+ */
+constexpr std::size_t default_output_slack = 1U << 20U;
+
+/**
+ * @brief Runs the command given by @code --run @endcode, and compares its standard output against the expected file
+ * while it is running.
+ *
+ * The command is killed as soon as the differ stops reading its output, e.g. once the first hunk is complete, or when
+ * it writes more than @code --max-output-bytes @endcode, which defaults to twice the size of the expected file plus
+ * @code default_output_slack @endcode. A command which closes its output but does not exit within
+ * @code command_exit_grace_period @endcode is killed as well, and counts as failed, as does a command exiting with a
+ * non-zero status or due to a signal, unless @code --ignore-exit-status @endcode is given.
+ *
+ * @return The exit code of the process.
+ */
+auto run_and_diff(const command_line_args& cmd_args) -> int {
+  const auto expected_path_or_err = normalize_path(*cmd_args.expected);
+  if (!expected_path_or_err) {
+    std::print(stderr, "{}\n", expected_path_or_err.error());
+    return EXIT_FAILURE;
+  }
+
+  diff_stats stats{};
+  auto options = make_diff_options(cmd_args);
+  options.stats = cmd_args.stats ? &stats : nullptr;
+  read_progress expected_progress{};
+  auto expected_reader = open_line_reader(*expected_path_or_err, options.read_ahead, expected_progress);
+  if (!expected_reader) {
+    std::print(stderr, "{}\n", expected_reader.error());
+    return EXIT_FAILURE;
+  }
+  if (options.index_expected) {
+    attach_line_index(*expected_reader, *expected_path_or_err, options.index_dir);
+  }
+
+  auto child = child_process::spawn(*cmd_args.run_command);
+  if (!child) {
+    std::print(stderr, "{}\n", child.error());
+    return EXIT_FAILURE;
+  }
+
+  // The expected file may not have a size, e.g. if it is read from the standard input
+  std::error_code ec{};
+  const auto expected_size = std::filesystem::is_regular_file(*expected_path_or_err, ec)
+                                 ? static_cast<std::size_t>(std::filesystem::file_size(*expected_path_or_err, ec))
+                                 : 0;
+  read_progress progress{};
+  progress.max_bytes = cmd_args.max_output_bytes.value_or(2 * (ec ? 0 : expected_size) + default_output_slack);
+
+  output_sink sink{stdout};
+  const auto result = std::visit(
+      [&](auto& expected_line_reader) {
+        fd_line_reader actual_reader{child->take_stdout(), progress};
+        if (cmd_args.quiet) {
+          const auto discard = [](const diff_line&) {};
+          return diff_sources(std::move(expected_line_reader), std::move(actual_reader), options, discard);
+        }
+
+        return diff_to_output(cmd_args, sink, [&](auto& line_sink) {
+          return diff_sources(std::move(expected_line_reader), std::move(actual_reader), options, line_sink);
+        });
+      },
+      *expected_reader);
+
+  // Once the differ stops reading, the rest of the output cannot change the result
+  bool command_failed{};
+  if (progress.end_of_file) {
+    if (const auto status = child->wait_for(command_exit_grace_period); !status) {
+      static_cast<void>(child->kill());
+      std::print(stderr, "Command was killed after closing its output without exiting\n");
+      command_failed = true;
+    } else if (WIFEXITED(*status) && WEXITSTATUS(*status) != 0) {
+      std::print(stderr, "Command exited with status {}\n", WEXITSTATUS(*status));
+      command_failed = true;
+    } else if (WIFSIGNALED(*status)) {
+      std::print(stderr, "Command was terminated by signal {}\n", WTERMSIG(*status));
+      command_failed = true;
+    }
+  } else {
+    static_cast<void>(child->kill());
+  }
+
+  if (const auto flushed = sink.flush(); !flushed) {
+    std::print(stderr, "{}\n", flushed.error());
+    return EXIT_FAILURE;
+  }
+  if (cmd_args.stats) {
+    print_stats(*cmd_args.stats, stats, *cmd_args.expected, cmd_args.run_command->front());
+  }
+
+  if (expected_progress.error != 0) {
+    std::print(stderr, "{}\n", read_error_message(*expected_path_or_err, expected_progress.error));
+    return EXIT_FAILURE;
+  }
+  if (progress.error != 0) {
+    std::print(stderr, "Unable to read the output of the command: {}\n", std::strerror(progress.error));
+    return EXIT_FAILURE;
+  }
+  if (progress.limit_exceeded) {
+    std::print(stderr, "Output limit reached: the command was stopped after writing {} bytes\n", progress.bytes);
+    return lookahead_exceeded_exit_code;
+  }
+  if (result.budget_exceeded) {
+    print_budget_exceeded();
+  }
+  if (result.lookahead_exceeded != 0) {
+    print_lookahead_exceeded(result.lookahead_exceeded);
+    return lookahead_exceeded_exit_code;
+  }
+  if (command_failed && !cmd_args.ignore_exit_status) {
+    return cmd_args.exit_code;
+  }
+  return result.has_diff ? cmd_args.exit_code : EXIT_SUCCESS;
 }
+#endif  // NANODIFF_HAS_POSIX
 
-#ifndef NANODIFF_TEST
 }  // namespace
-#endif  // NANODIFF_TEST
 
 #ifndef NANODIFF_TEST
 
@@ -385,55 +5716,63 @@ auto main(int argc, char** argv) -> int {
   }
 
   const auto& cmd_args = *cmd_args_or_err;
+  if (cmd_args.batch_actuals || cmd_args.manifest) {
+    return run_batch(cmd_args);
+  }
+#ifdef NANODIFF_HAS_POSIX
+  if (cmd_args.run_command) {
+    return run_and_diff(cmd_args);
+  }
+#endif  // NANODIFF_HAS_POSIX
 
   const auto expected_path_or_err = normalize_path(*cmd_args.expected);
   if (!expected_path_or_err) {
     std::print(stderr, "{}\n", expected_path_or_err.error());
+    return EXIT_FAILURE;
   }
   const auto actual_path_or_err = normalize_path(*cmd_args.actual);
   if (!actual_path_or_err) {
     std::print(stderr, "{}\n", actual_path_or_err.error());
+    return EXIT_FAILURE;
   }
 
-  const auto& expected_path = *expected_path_or_err;
-  const auto& actual_path = *actual_path_or_err;
+  diff_stats stats{};
+  auto options = make_diff_options(cmd_args);
+  options.threads = cmd_args.jobs.value_or(std::max(std::thread::hardware_concurrency(), 1U));
+  options.stats = cmd_args.stats ? &stats : nullptr;
 
-  std::ifstream expected{*expected_path_or_err};
-  std::ifstream actual{*actual_path_or_err};
+  // Instantiate the differs with the sink directly, so that no lines are passed through a `diff_line_cb`
+  output_sink sink{stdout};
+  const auto result_or_err = [&]() {
+    if (cmd_args.quiet) {
+      const auto discard = [](const diff_line&) {};
+      return diff_paths(*expected_path_or_err, *actual_path_or_err, options, discard);
+    }
 
-  if (!expected) {
-    std::print(stderr, "Unable to open file '{}'\n", expected_path.string());
+    return diff_to_output(cmd_args, sink, [&](auto& line_sink) {
+      return diff_paths(*expected_path_or_err, *actual_path_or_err, options, line_sink);
+    });
+  }();
+  if (const auto flushed = sink.flush(); !flushed) {
+    std::print(stderr, "{}\n", flushed.error());
     return EXIT_FAILURE;
   }
-  if (!actual) {
-    std::print(stderr, "Unable to open file '{}'\n", actual_path.string());
+
+  if (!result_or_err) {
+    std::print(stderr, "{}\n", result_or_err.error());
     return EXIT_FAILURE;
   }
-
-  bool has_diff = diff_file_stdout(std::move(expected), std::move(actual), [](const auto& diff_line) {
-    char prefix = ' ';
-    switch (diff_line.type) {
-      case diff_line_type::context:
-        if (diff_line.line.empty()) {
-          std::print("\n");
-          return;
-        }
-        prefix = ' ';
-        break;
-      case diff_line_type::expected_only:
-        prefix = '-';
-        break;
-      case diff_line_type::actual_only:
-        prefix = '+';
-        break;
-      default:
-        assert(false);
-    }
-
-    std::print("{}{}\n", prefix, diff_line.line);
-  });
-
-  if (has_diff) {
+  if (cmd_args.stats) {
+    print_stats(*cmd_args.stats, stats, *cmd_args.expected, *cmd_args.actual);
+  }
+  if (result_or_err->budget_exceeded) {
+    print_budget_exceeded();
+  }
+  if (result_or_err->lookahead_exceeded != 0) {
+    print_lookahead_exceeded(result_or_err->lookahead_exceeded);
+    return lookahead_exceeded_exit_code;
+  }
+  if (result_or_err->has_diff) {
     return cmd_args.exit_code;
   }
 }
@@ -2,39 +2,326 @@
 #define NANODIFF_H
 
 #include <cstdint>
+#include <cstdio>
 
+#include <chrono>
+#include <concepts>
+#include <expected>
+#include <filesystem>
 #include <fstream>
 #include <functional>
+#include <initializer_list>
+#include <limits>
 #include <optional>
+#include <ranges>
 #include <string>
 #include <string_view>
 
-// IMPORTANT: The members of this header must be kept in sync with `nanodiff.cpp`!!
-
-struct command_line_args {
-  std::optional<std::string> expected{std::nullopt};
-  std::optional<std::string> actual{std::nullopt};
-  // TODO(Derppening): Add option for hiding expected/actual file paths
-  // TODO(Derppening): Add option for hiding context lines
-  // TODO(Derppening): Add option for custom exit code
-  // TODO(Derppening): Add diff options supported by ZINC
-  // TODO(Derppening): Add option for treating missing file as empty
+/**
+ * @brief Enum representing the algorithm used to compute the diff.
+ */
+enum struct diff_algorithm : std::uint8_t {
+  greedy,
+  myers,
+  patience,
+  histogram,
 };
 
+/**
+ * @brief Enum representing the type of a diff line.
+ */
 enum struct diff_line_type : std::uint8_t {
   context,
   expected_only,
   actual_only,
 };
 
+/**
+ * @brief Structure representing a line in the diff output.
+ */
 struct diff_line {
   std::string_view line;
   diff_line_type type;
 };
 
+/**
+ * @brief Callback type for processing diff lines.
+ */
 using diff_line_cb = std::function<void(const diff_line& line)>;
 
+/**
+ * @brief Enum representing the point at which a differ stops comparing the files.
+ */
+enum struct diff_stop : std::uint8_t {
+  // Compare the files to the end
+  never,
+  // Stop after outputting the first group of consecutive `-` and `+` lines
+  after_first_hunk,
+  // Stop as soon as the files are known to differ, without outputting any lines
+  at_first_difference,
+};
+
+/**
+ * @brief Statistics collected while comparing two files, if nanodiff is built with @code NANODIFF_STATS @endcode.
+ */
+struct diff_stats {
+  // Lines and bytes read by the differ from each file, excluding the common prefix and suffix which are skipped
+  std::size_t expected_lines;
+  std::size_t expected_bytes;
+  std::size_t actual_lines;
+  std::size_t actual_bytes;
+  // Bytes of both files skipped as the common prefix and suffix without splitting them into lines
+  std::size_t skipped_bytes;
+  // Size of the look-ahead buffer of the greedy algorithm, sampled once per expected line
+  std::size_t buffer_peak_lines;
+  std::size_t buffer_peak_bytes;
+  std::size_t buffer_samples;
+  std::size_t buffer_total_lines;
+  std::size_t line_comparisons;
+  // Lookups of a line by its hash or contents
+  std::size_t hash_probes;
+  // Allocations made on the thread running the comparison
+  std::size_t allocations;
+  std::size_t allocated_bytes;
+  // Time taken by the whole comparison, of which reading lines (including waiting for input) and outputting lines took
+  // the given parts. Times of segments compared concurrently are summed.
+  std::chrono::nanoseconds total_time;
+  std::chrono::nanoseconds io_time;
+  std::chrono::nanoseconds output_time;
+};
+
+/**
+ * @brief Options controlling how the diff is computed.
+ */
+struct diff_options {
+  // Algorithm used by the entry points which do not select one themselves
+  diff_algorithm algorithm{diff_algorithm::greedy};
+  // Maximum number of actual lines buffered while looking ahead for a matching line
+  std::size_t max_lookahead_lines{std::numeric_limits<std::size_t>::max()};
+  // Maximum total size of actual lines buffered while looking ahead for a matching line
+  std::size_t max_lookahead_bytes{std::numeric_limits<std::size_t>::max()};
+  diff_stop stop{diff_stop::never};
+  // Maximum number of threads used to compare the files
+  std::size_t threads{1};
+  // Number of batches of lines read ahead of the differ by a separate thread per file, or 0 to read on the same thread
+  std::size_t read_ahead{0};
+  // Differences between lines which are ignored when comparing them
+  bool ignore_trailing_space{};
+  bool ignore_all_space{};
+  bool ignore_case{};
+  // Whether lines which are empty or only contain whitespace are skipped in both files
+  bool ignore_blank_lines{};
+  // Maximum absolute and relative differences between numbers within lines for them to compare equal, or 0 to compare
+  // numbers as text. Numbers are equal if they are within either tolerance.
+  double abs_tolerance{0};
+  double rel_tolerance{0};
+  // Maximum number of changed lines for which the Myers algorithm searches for a minimal diff, including where the
+  // patience and histogram algorithms fall back to it, and maximum time spent searching. Once either is exceeded, the
+  // rest of the files are compared with the greedy algorithm, which takes linear time.
+  std::size_t max_cost{std::numeric_limits<std::size_t>::max()};
+  std::optional<std::chrono::milliseconds> timeout{std::nullopt};
+  // Number of context lines around each change needed by the sink. If set, every context line is output, including
+  // those before the first change, and the first hunk only ends once more than twice as many context lines follow a
+  // change.
+  std::optional<std::size_t> context_lines{std::nullopt};
+  // Whether the line ends and hashes of a memory-mapped expected file are loaded from an index file, which is created
+  // if it is missing, corrupt or stale, so that the file never needs to be split into lines and hashed again
+  bool index_expected{};
+  // Directory holding the index files, or empty to store the index of each file next to it
+  std::filesystem::path index_dir{};
+  // Statistics updated during the comparison, or null if none are collected
+  diff_stats* stats{nullptr};
+};
+
+/**
+ * @brief Result of comparing two files.
+ */
+struct diff_result {
+  bool has_diff;
+  // Number of expected lines output as missing because the look-ahead limit was reached before finding a match
+  std::size_t lookahead_exceeded;
+  // Whether the maximum cost or time of the search for a minimal diff was exceeded, so that the diff may not be minimal
+  bool budget_exceeded;
+};
+
+/**
+ * @brief Formats diff lines in the porcelain format into a large reusable buffer, and writes them out in batches.
+ */
+class output_sink {
+ public:
+  /**
+   * @brief Creates a sink which writes to @code stream @endcode, bypassing its stdio buffer where possible.
+   */
+  explicit output_sink(std::FILE* stream);
+  /**
+   * @brief Creates a sink which appends to @code output @endcode.
+   */
+  explicit output_sink(std::string& output);
+  output_sink(const output_sink&) = delete;
+  output_sink(output_sink&&) noexcept = delete;
+
+  ~output_sink();
+
+  auto operator=(const output_sink&) -> output_sink& = delete;
+  auto operator=(output_sink&&) noexcept -> output_sink& = delete;
+
+  void write_line(const diff_line& line);
+  void operator()(const diff_line& line) { write_line(line); }
+
+  /**
+   * @brief Writes @code text @endcode as is.
+   */
+  void write(std::string_view text);
+
+  /**
+   * @brief Writes the header of a unified-diff hunk, given the 0-based index of its first line and its number of lines
+   * in each file.
+   */
+  void write_hunk_header(std::size_t expected_begin,
+                         std::size_t expected_count,
+                         std::size_t actual_begin,
+                         std::size_t actual_count);
+
+  /**
+   * @brief Writes out all buffered lines.
+   *
+   * @return The first error encountered while writing, if any.
+   */
+  auto flush() -> std::expected<void, std::string>;
+
+ private:
+  void write_chunks(std::initializer_list<std::string_view> chunks);
+
+  std::FILE* _stream{};
+  std::string* _output{};
+  std::string _buffer;
+  std::optional<std::string> _error;
+};
+
+/**
+ * @brief Source of lines from an input file, or any other input which can be read line-by-line.
+ *
+ * All readers split their input with the same semantics as repeatedly calling @code std::getline @endcode until the
+ * stream fails, i.e. the last line is always followed by an additional empty line. Custom sources only need to
+ * implement @code read_line() @endcode.
+ */
+class line_reader {
+ public:
+  line_reader() = default;
+  line_reader(const line_reader&) = delete;
+  line_reader(line_reader&&) noexcept = default;
+
+  virtual ~line_reader() = default;
+
+  auto operator=(const line_reader&) -> line_reader& = delete;
+  auto operator=(line_reader&&) noexcept -> line_reader& = default;
+
+  /**
+   * @brief Reads the next line from the input.
+   *
+   * The returned view is only valid until the next call to this function, unless the reader @code is_persistent()
+   * @endcode.
+   */
+  virtual auto read_line() -> std::optional<std::string_view> = 0;
+
+  /**
+   * @brief Whether views returned by @code read_line() @endcode remain valid for the lifetime of this reader.
+   */
+  [[nodiscard]] virtual auto is_persistent() const noexcept -> bool { return false; }
+
+  /**
+   * @brief Returns the unread contents of the input, if they are already entirely in memory.
+   */
+  [[nodiscard]] virtual auto contents() const noexcept -> std::optional<std::string_view> { return std::nullopt; }
+
+  /**
+   * @brief Whether this reader implements @code trim() @endcode, so that lines common to the start and end of both
+   * inputs can be skipped without reading them.
+   */
+  [[nodiscard]] virtual auto is_trimmable() const noexcept -> bool { return false; }
+
+  /**
+   * @brief Discards the first @code prefix @endcode and the last @code suffix @endcode bytes of @code contents()
+   * @endcode, both of which must end and start on a line boundary respectively.
+   *
+   * If @code suffix @endcode is non-zero, the empty line which otherwise follows the last line is not returned either.
+   * Only called if the reader returns its @code contents() @endcode and @code is_trimmable() @endcode.
+   */
+  virtual void trim([[maybe_unused]] std::size_t prefix, [[maybe_unused]] std::size_t suffix) {}
+};
+
+/**
+ * @brief Compares two buffers line by line and outputs the diff to the @code line_callback @endcode function, using
+ * the algorithm selected by @code options @endcode.
+ *
+ * The lines passed to @code line_callback @endcode are views into the buffers, which are never copied.
+ */
+auto diff_buffers(std::string_view expected,
+                  std::string_view actual,
+                  const diff_options& options,
+                  const diff_line_cb& line_callback) -> diff_result;
+/**
+ * @brief Overload of @code diff_buffers @endcode which takes the buffers as contiguous ranges of characters, such as
+ * @code std::span<const char> @endcode or @code std::vector<char> @endcode.
+ */
+template<std::ranges::contiguous_range Buffer>
+  requires std::same_as<std::ranges::range_value_t<Buffer>, char> &&
+           (!std::convertible_to<const Buffer&, std::string_view>)
+auto diff_buffers(const Buffer& expected,
+                  const Buffer& actual,
+                  const diff_options& options,
+                  const diff_line_cb& line_callback) -> diff_result {
+  return diff_buffers(std::string_view{std::ranges::data(expected), std::ranges::size(expected)},
+                      std::string_view{std::ranges::data(actual), std::ranges::size(actual)},
+                      options,
+                      line_callback);
+}
+
+/**
+ * @brief Compares the lines read from two sources and outputs the diff to the @code line_callback @endcode function,
+ * using the algorithm selected by @code options @endcode.
+ *
+ * If both sources return their @code contents() @endcode, they are split into segments compared concurrently as for
+ * @code diff_buffers @endcode, and if both are also @code is_trimmable() @endcode, their common leading and trailing
+ * lines are skipped without reading them line by line.
+ */
+auto diff_lines(line_reader& expected,
+                line_reader& actual,
+                const diff_options& options,
+                const diff_line_cb& line_callback) -> diff_result;
+
+/**
+ * @brief Compares the files at the given paths line by line and outputs the diff to the @code line_callback
+ * @endcode function, using the algorithm selected by @code options @endcode.
+ *
+ * Either path may be @code "-" @endcode to read from the standard input. Regular files are memory-mapped where
+ * possible, so that lines are never copied unless they need to be buffered for look-ahead.
+ */
+auto diff_files(const std::filesystem::path& expected,
+                const std::filesystem::path& actual,
+                const diff_options& options,
+                const diff_line_cb& line_callback) -> std::expected<diff_result, std::string>;
+
 auto diff_file_stdout_eager(std::ifstream expected, std::ifstream actual, const diff_line_cb& line_callback) -> bool;
 auto diff_file_stdout(std::ifstream expected, std::ifstream actual, const diff_line_cb& line_callback) -> bool;
+auto diff_file_stdout_myers(std::ifstream expected, std::ifstream actual, const diff_line_cb& line_callback) -> bool;
+
+auto diff_file_stdout_eager(const std::filesystem::path& expected,
+                            const std::filesystem::path& actual,
+                            const diff_line_cb& line_callback) -> std::expected<bool, std::string>;
+auto diff_file_stdout(const std::filesystem::path& expected,
+                      const std::filesystem::path& actual,
+                      const diff_line_cb& line_callback) -> std::expected<bool, std::string>;
+auto diff_file_stdout(const std::filesystem::path& expected,
+                      const std::filesystem::path& actual,
+                      const diff_options& options,
+                      const diff_line_cb& line_callback) -> std::expected<diff_result, std::string>;
+auto diff_file_stdout_myers(const std::filesystem::path& expected,
+                            const std::filesystem::path& actual,
+                            const diff_line_cb& line_callback) -> std::expected<bool, std::string>;
+auto diff_file_stdout_myers(const std::filesystem::path& expected,
+                            const std::filesystem::path& actual,
+                            const diff_options& options,
+                            const diff_line_cb& line_callback) -> std::expected<diff_result, std::string>;
 
 #endif  // NANODIFF_H
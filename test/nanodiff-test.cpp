@@ -1,22 +1,44 @@
+#include <cerrno>
 #include <cstdlib>
 #include <algorithm>
+#include <array>
+#include <chrono>
 #include <filesystem>
 #include <format>
 #include <fstream>
+#include <future>
 #include <optional>
+#include <string>
 #include <string_view>
+#include <thread>
 #include <vector>
 
 #include <gtest/gtest.h>
 
+#include <poll.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#if defined(__linux__)
+#include <sys/stat.h>
+#endif
+
+extern char** environ;
+
 #include "../nanodiff.h"
 
+using std::literals::operator""h;
+using std::literals::operator""ms;
 using std::literals::operator""sv;
 
+// Name of the executable run by the command-line tests, which is built next to the test directory
+#ifndef NANODIFF_TEST_EXECUTABLE
+#define NANODIFF_TEST_EXECUTABLE "nanodiff"
+#endif
+
 namespace {
 const std::filesystem::path test_res_dir{"test_resources"};
-const std::string_view stdout_tmpfile_name{".nanodiff-test.stdout"sv};
-const std::string_view stderr_tmpfile_name{".nanodiff-test.stderr"sv};
 
 struct line_count {
   std::size_t context = 0;
@@ -275,196 +297,1888 @@ TEST(LazyDiffTest, EmptyFiles) {
   EXPECT_EQ(0, line_count.actual_only);
 }
 
-#if defined(__linux__)
+TEST(LazyDiffTest, TrailingLinesAdded) {
+  const auto expected_path = test_res_dir / "testcase_trailing_lines-expected.txt";
+  const auto actual_path = test_res_dir / "testcase_trailing_lines-actual.txt";
 
-struct exec_output {
-  int exit_code;
-  std::string stdout;
-  std::string stderr;
-};
+  std::ifstream expected_file{expected_path};
+  ASSERT_TRUE(expected_file) << "Failed to open file: " << expected_path;
+  std::ifstream actual_file{actual_path};
+  ASSERT_TRUE(actual_file) << "Failed to open file: " << actual_path;
 
-class PorcelainStdoutTest : public testing::Test {
- protected:
-  void SetUp() override {
-    remove_tmpfile_if_exists(stdout_path);
-    remove_tmpfile_if_exists(stderr_path);
-  }
+  std::vector<diff_line> diffs{};
+  const auto has_diff = diff_file_stdout(std::move(expected_file), std::move(actual_file),
+                                         [&diffs](const diff_line& line) { diffs.push_back(line); });
+  EXPECT_TRUE(has_diff);
 
-  // NOLINTBEGIN(concurrency-mt-unsafe)
-  static auto run_cmd(const std::filesystem::path& expected_path,
-                      const std::filesystem::path& actual_path,
-                      const std::string_view args = ""sv) -> exec_output {
-    std::filesystem::path exec_path{};
-    PorcelainStdoutTest::exec_path(exec_path);
+  // The empty line following the final newline of the expected file only matches that of the actual file
+  const auto line_count{count_lines(diffs)};
+  EXPECT_EQ(1, line_count.context);
+  EXPECT_EQ(0, line_count.expected_only);
+  EXPECT_EQ(2, line_count.actual_only);
+}
 
-    const auto cmd = std::format("{} {} -- {} {} >{} 2>{}", std::string{exec_path}, args, std::string{expected_path},
-                                 std::string{actual_path}, std::string{stdout_path}, std::string{stderr_path});
-    const auto exit_code = std::system(cmd.c_str());
+TEST(MyersDiffTest, SameOutput) {
+  const auto expected_path = test_res_dir / "testcase_same_output-expected.txt";
+  const auto actual_path = test_res_dir / "testcase_same_output-actual.txt";
 
-    std::string stdout{};
-    read_to_string(stdout_path, stdout);
+  std::ifstream expected_file{expected_path};
+  ASSERT_TRUE(expected_file) << "Failed to open file: " << expected_path;
+  std::ifstream actual_file{actual_path};
+  ASSERT_TRUE(actual_file) << "Failed to open file: " << actual_path;
 
-    std::string stderr{};
-    read_to_string(stderr_path, stderr);
+  std::vector<diff_line> diffs{};
+  const auto has_diff = diff_file_stdout_myers(std::move(expected_file), std::move(actual_file),
+                                               [&diffs](const diff_line& line) { diffs.push_back(line); });
+  EXPECT_FALSE(has_diff);
 
-    return exec_output{
-        .exit_code = exit_code,
-        .stdout = std::move(stdout),
-        .stderr = std::move(stderr),
-    };
-  }
-  // NOLINTEND(concurrency-mt-unsafe)
+  const auto line_count{count_lines(diffs)};
+  EXPECT_EQ(0, line_count.context);
+  EXPECT_EQ(0, line_count.expected_only);
+  EXPECT_EQ(0, line_count.actual_only);
+}
 
-  void TearDown() override {
-    remove_tmpfile_if_exists(stdout_path);
-    remove_tmpfile_if_exists(stderr_path);
-  }
+TEST(MyersDiffTest, OneLineChanged) {
+  const auto expected_path = test_res_dir / "testcase_one_line_changed-expected.txt";
+  const auto actual_path = test_res_dir / "testcase_one_line_changed-actual.txt";
 
-  static void SetUpTestSuite() {
-    const auto exec_path{std::filesystem::absolute(std::filesystem::current_path() / ".." / "nanodiff")};
+  std::ifstream expected_file{expected_path};
+  ASSERT_TRUE(expected_file) << "Failed to open file: " << expected_path;
+  std::ifstream actual_file{actual_path};
+  ASSERT_TRUE(actual_file) << "Failed to open file: " << actual_path;
 
-    _exec_path = std::filesystem::is_regular_file(exec_path) ? std::make_optional(exec_path) : std::nullopt;
+  std::vector<diff_line> diffs{};
+  const auto has_diff = diff_file_stdout_myers(std::move(expected_file), std::move(actual_file),
+                                               [&diffs](const diff_line& line) { diffs.push_back(line); });
+  EXPECT_TRUE(has_diff);
 
-    const auto tmp_path{std::filesystem::temp_directory_path()};
-    stdout_path = std::filesystem::absolute(tmp_path / stdout_tmpfile_name);
-    stderr_path = std::filesystem::absolute(tmp_path / stderr_tmpfile_name);
+  const auto line_count{count_lines(diffs)};
+  EXPECT_EQ(3, line_count.context);
+  EXPECT_EQ(1, line_count.expected_only);
+  EXPECT_EQ(1, line_count.actual_only);
+}
 
-    remove_tmpfile_if_exists(stdout_path);
-    remove_tmpfile_if_exists(stderr_path);
-  }
+TEST(MyersDiffTest, LineAdded) {
+  const auto expected_path = test_res_dir / "testcase_line_added-expected.txt";
+  const auto actual_path = test_res_dir / "testcase_line_added-actual.txt";
 
-  static void exec_path(std::filesystem::path& exec_path) {
-    if (!_exec_path) {
-      GTEST_SKIP() << "Test requires `nanodiff` executable to be compiled";
-    }
-    exec_path = *_exec_path;
-  }
+  std::ifstream expected_file{expected_path};
+  ASSERT_TRUE(expected_file) << "Failed to open file: " << expected_path;
+  std::ifstream actual_file{actual_path};
+  ASSERT_TRUE(actual_file) << "Failed to open file: " << actual_path;
 
-  static void read_to_string(const std::filesystem::path& path, std::string& str) {
-    if (!std::filesystem::exists(path)) {
-      str.clear();
-      return;
-    }
+  std::vector<diff_line> diffs{};
+  const auto has_diff = diff_file_stdout_myers(std::move(expected_file), std::move(actual_file),
+                                               [&diffs](const diff_line& line) { diffs.push_back(line); });
+  EXPECT_TRUE(has_diff);
 
-    const auto size = std::filesystem::file_size(path);
-    str.resize(size);
+  const auto line_count{count_lines(diffs)};
+  EXPECT_EQ(4, line_count.context);
+  EXPECT_EQ(0, line_count.expected_only);
+  EXPECT_EQ(1, line_count.actual_only);
+}
 
-    std::ifstream ifs{path};
-    ASSERT_TRUE(ifs) << "Unable to open " << path << " for reading";
+TEST(MyersDiffTest, LineRemoved) {
+  const auto expected_path = test_res_dir / "testcase_line_removed-expected.txt";
+  const auto actual_path = test_res_dir / "testcase_line_removed-actual.txt";
 
-    ifs.read(str.data(), static_cast<std::streamsize>(size));
-  }
+  std::ifstream expected_file{expected_path};
+  ASSERT_TRUE(expected_file) << "Failed to open file: " << expected_path;
+  std::ifstream actual_file{actual_path};
+  ASSERT_TRUE(actual_file) << "Failed to open file: " << actual_path;
 
-  static std::filesystem::path stdout_path;
-  static std::filesystem::path stderr_path;
+  std::vector<diff_line> diffs{};
+  const auto has_diff = diff_file_stdout_myers(std::move(expected_file), std::move(actual_file),
+                                               [&diffs](const diff_line& line) { diffs.push_back(line); });
+  EXPECT_TRUE(has_diff);
 
- private:
-  static void remove_tmpfile_if_exists(const std::filesystem::path& path) {
-    if (std::filesystem::exists(path)) {
-      ASSERT_TRUE(std::filesystem::is_regular_file(path))
-          << path << "already exists as a directory and needs to be removed manually";
-      ASSERT_TRUE(std::filesystem::remove(path)) << "Failed to remove stdout temporary file " << path;
-    }
-  }
+  const auto line_count{count_lines(diffs)};
+  EXPECT_EQ(4, line_count.context);
+  EXPECT_EQ(1, line_count.expected_only);
+  EXPECT_EQ(0, line_count.actual_only);
+}
 
-  static std::optional<std::filesystem::path> _exec_path;
-};
+TEST(MyersDiffTest, CompletelyDifferent) {
+  const auto expected_path = test_res_dir / "testcase_completely_different-expected.txt";
+  const auto actual_path = test_res_dir / "testcase_completely_different-actual.txt";
 
-std::optional<std::filesystem::path> PorcelainStdoutTest::_exec_path{};
-std::filesystem::path PorcelainStdoutTest::stdout_path{};
-std::filesystem::path PorcelainStdoutTest::stderr_path{};
+  std::ifstream expected_file{expected_path};
+  ASSERT_TRUE(expected_file) << "Failed to open file: " << expected_path;
+  std::ifstream actual_file{actual_path};
+  ASSERT_TRUE(actual_file) << "Failed to open file: " << actual_path;
 
-TEST_F(PorcelainStdoutTest, SameOutput) {
-  const auto expected_path = test_res_dir / "testcase_same_output-expected.txt";
-  const auto actual_path = test_res_dir / "testcase_same_output-actual.txt";
+  std::vector<diff_line> diffs{};
+  const auto has_diff = diff_file_stdout_myers(std::move(expected_file), std::move(actual_file),
+                                               [&diffs](const diff_line& line) { diffs.push_back(line); });
+  EXPECT_TRUE(has_diff);
 
-  const auto exec_result = PorcelainStdoutTest::run_cmd(expected_path, actual_path);
-  EXPECT_EQ(exec_result.exit_code, 0);
+  const auto line_count{count_lines(diffs)};
+  EXPECT_EQ(1, line_count.context);
+  EXPECT_EQ(5, line_count.expected_only);
+  EXPECT_EQ(5, line_count.actual_only);
+}
 
-  EXPECT_EQ(exec_result.stdout, R"()"sv);
-  EXPECT_EQ(exec_result.stderr, R"()"sv);
+TEST(MyersDiffTest, EmptyFiles) {
+  const auto expected_path = test_res_dir / "testcase_empty-expected.txt";
+  const auto actual_path = test_res_dir / "testcase_empty-actual.txt";
+
+  std::ifstream expected_file{expected_path};
+  ASSERT_TRUE(expected_file) << "Failed to open file: " << expected_path;
+  std::ifstream actual_file{actual_path};
+  ASSERT_TRUE(actual_file) << "Failed to open file: " << actual_path;
+
+  std::vector<diff_line> diffs{};
+  const auto has_diff = diff_file_stdout_myers(std::move(expected_file), std::move(actual_file),
+                                               [&diffs](const diff_line& line) { diffs.push_back(line); });
+  EXPECT_FALSE(has_diff);
+
+  const auto line_count{count_lines(diffs)};
+  EXPECT_EQ(0, line_count.context);
+  EXPECT_EQ(0, line_count.expected_only);
+  EXPECT_EQ(0, line_count.actual_only);
 }
 
-TEST_F(PorcelainStdoutTest, OneLineChanged) {
+TEST(MyersDiffTest, LineMoved) {
+  const auto expected_path = test_res_dir / "testcase_line_moved-expected.txt";
+  const auto actual_path = test_res_dir / "testcase_line_moved-actual.txt";
+
+  std::ifstream expected_file{expected_path};
+  ASSERT_TRUE(expected_file) << "Failed to open file: " << expected_path;
+  std::ifstream actual_file{actual_path};
+  ASSERT_TRUE(actual_file) << "Failed to open file: " << actual_path;
+
+  std::vector<diff_line> diffs{};
+  const auto has_diff = diff_file_stdout_myers(std::move(expected_file), std::move(actual_file),
+                                               [&diffs](const diff_line& line) { diffs.push_back(line); });
+  EXPECT_TRUE(has_diff);
+
+  const auto line_count{count_lines(diffs)};
+  EXPECT_EQ(4, line_count.context);
+  EXPECT_EQ(1, line_count.expected_only);
+  EXPECT_EQ(1, line_count.actual_only);
+}
+
+TEST(PathDiffTest, OneLineChanged) {
   const auto expected_path = test_res_dir / "testcase_one_line_changed-expected.txt";
   const auto actual_path = test_res_dir / "testcase_one_line_changed-actual.txt";
 
-  const auto exec_result = PorcelainStdoutTest::run_cmd(expected_path, actual_path);
-  EXPECT_NE(exec_result.exit_code, 0);
+  std::vector<std::string> lines{};
+  std::vector<diff_line_type> types{};
+  const auto has_diff = diff_file_stdout(expected_path, actual_path, [&lines, &types](const diff_line& line) {
+    lines.emplace_back(line.line);
+    types.push_back(line.type);
+  });
+  ASSERT_TRUE(has_diff) << has_diff.error();
+  EXPECT_TRUE(*has_diff);
 
-  EXPECT_EQ(exec_result.stdout, R"(-3
-+X
- 4
- 5
+  EXPECT_EQ(lines, (std::vector<std::string>{"3", "X", "4", "5", ""}));
+  EXPECT_EQ(types,
+            (std::vector{diff_line_type::expected_only, diff_line_type::actual_only, diff_line_type::context,
+                         diff_line_type::context, diff_line_type::context}));
+}
 
-)"sv);
-  EXPECT_EQ(exec_result.stderr, R"()"sv);
+TEST(PathDiffTest, MyersOneLineChanged) {
+  const auto expected_path = test_res_dir / "testcase_one_line_changed-expected.txt";
+  const auto actual_path = test_res_dir / "testcase_one_line_changed-actual.txt";
+
+  std::vector<std::string> lines{};
+  std::vector<diff_line_type> types{};
+  const auto has_diff = diff_file_stdout_myers(expected_path, actual_path, [&lines, &types](const diff_line& line) {
+    lines.emplace_back(line.line);
+    types.push_back(line.type);
+  });
+  ASSERT_TRUE(has_diff) << has_diff.error();
+  EXPECT_TRUE(*has_diff);
+
+  EXPECT_EQ(lines, (std::vector<std::string>{"3", "X", "4", "5", ""}));
+  EXPECT_EQ(types,
+            (std::vector{diff_line_type::expected_only, diff_line_type::actual_only, diff_line_type::context,
+                         diff_line_type::context, diff_line_type::context}));
 }
 
-TEST_F(PorcelainStdoutTest, LineAdded) {
-  const auto expected_path = test_res_dir / "testcase_line_added-expected.txt";
-  const auto actual_path = test_res_dir / "testcase_line_added-actual.txt";
+TEST(PathDiffTest, SameOutput) {
+  const auto expected_path = test_res_dir / "testcase_same_output-expected.txt";
+  const auto actual_path = test_res_dir / "testcase_same_output-actual.txt";
 
-  const auto exec_result = PorcelainStdoutTest::run_cmd(expected_path, actual_path);
-  EXPECT_NE(exec_result.exit_code, 0);
+  std::vector<diff_line> diffs{};
+  const auto has_diff =
+      diff_file_stdout_myers(expected_path, actual_path, [&diffs](const diff_line& line) { diffs.push_back(line); });
+  ASSERT_TRUE(has_diff) << has_diff.error();
+  EXPECT_FALSE(*has_diff);
+  EXPECT_TRUE(diffs.empty());
+}
 
-  EXPECT_EQ(exec_result.stdout, R"(+extra line
- 4
- 5
- 6
+TEST(PathDiffTest, MissingTrailingNewline) {
+  const auto expected_path = test_res_dir / "testcase_missing_trailing_newline-expected.txt";
+  const auto actual_path = test_res_dir / "testcase_missing_trailing_newline-actual.txt";
 
-)"sv);
-  EXPECT_EQ(exec_result.stderr, R"()"sv);
+  std::vector<diff_line> diffs{};
+  auto has_diff =
+      diff_file_stdout(expected_path, actual_path, [&diffs](const diff_line& line) { diffs.push_back(line); });
+  ASSERT_TRUE(has_diff) << has_diff.error();
+  EXPECT_FALSE(*has_diff);
+
+  has_diff =
+      diff_file_stdout_myers(expected_path, actual_path, [&diffs](const diff_line& line) { diffs.push_back(line); });
+  ASSERT_TRUE(has_diff) << has_diff.error();
+  EXPECT_FALSE(*has_diff);
+  EXPECT_TRUE(diffs.empty());
 }
 
-TEST_F(PorcelainStdoutTest, LineRemoved) {
+TEST(PathDiffTest, ReadError) {
+  const auto expected_path = test_res_dir / "testcase_same_output-expected.txt";
+
+  // A directory can be opened, but not read
+  const auto result = diff_file_stdout(expected_path, test_res_dir, diff_options{}, [](const diff_line&) {});
+  ASSERT_FALSE(result);
+  EXPECT_TRUE(result.error().starts_with("Unable to read file"sv)) << result.error();
+}
+
+TEST(PathDiffTest, ReadErrorWithReadAhead) {
+  const auto expected_path = test_res_dir / "testcase_same_output-expected.txt";
+
+  // The error is passed on from the thread reading the file
+  const auto result =
+      diff_file_stdout(expected_path, test_res_dir, diff_options{.read_ahead = 2}, [](const diff_line&) {});
+  ASSERT_FALSE(result);
+  EXPECT_TRUE(result.error().starts_with("Unable to read file"sv)) << result.error();
+}
+
+TEST(PathDiffTest, LookaheadLimit) {
+  const auto expected_path = test_res_dir / "testcase_line_moved-expected.txt";
+  const auto actual_path = test_res_dir / "testcase_line_moved-actual.txt";
+
+  std::vector<std::string> lines{};
+  std::vector<diff_line_type> types{};
+  const auto result = diff_file_stdout(expected_path, actual_path, diff_options{.max_lookahead_lines = 2},
+                                       [&lines, &types](const diff_line& line) {
+                                         lines.emplace_back(line.line);
+                                         types.push_back(line.type);
+                                       });
+  ASSERT_TRUE(result) << result.error();
+  EXPECT_TRUE(result->has_diff);
+  EXPECT_EQ(result->lookahead_exceeded, 1);
+
+  EXPECT_EQ(lines, (std::vector<std::string>{"moved", "1", "2", "3", "moved", ""}));
+  EXPECT_EQ(types,
+            (std::vector{diff_line_type::expected_only, diff_line_type::context, diff_line_type::context,
+                         diff_line_type::context, diff_line_type::actual_only, diff_line_type::context}));
+}
+
+TEST(PathDiffTest, LookaheadLimitResumes) {
+  const auto expected_path = test_res_dir / "testcase_lines_inserted-expected.txt";
+  const auto actual_path = test_res_dir / "testcase_lines_inserted-actual.txt";
+
+  // The inserted lines do not fit into the look-ahead buffer, so the line after them is reported as missing, after
+  // which the diff gets back in step
+  std::vector<diff_line> diffs{};
+  const auto result = diff_file_stdout(expected_path, actual_path, diff_options{.max_lookahead_lines = 2},
+                                       [&diffs](const diff_line& line) { diffs.push_back(line); });
+  ASSERT_TRUE(result) << result.error();
+  EXPECT_TRUE(result->has_diff);
+  EXPECT_EQ(result->lookahead_exceeded, 1);
+
+  const auto line_count{count_lines(diffs)};
+  EXPECT_EQ(7, line_count.context);
+  EXPECT_EQ(1, line_count.expected_only);
+  EXPECT_EQ(4, line_count.actual_only);
+}
+
+TEST(PathDiffTest, LookaheadLimitBytes) {
   const auto expected_path = test_res_dir / "testcase_line_removed-expected.txt";
   const auto actual_path = test_res_dir / "testcase_line_removed-actual.txt";
 
-  const auto exec_result = PorcelainStdoutTest::run_cmd(expected_path, actual_path);
-  EXPECT_NE(exec_result.exit_code, 0);
+  std::vector<diff_line> diffs{};
+  const auto result = diff_file_stdout(expected_path, actual_path, diff_options{.max_lookahead_bytes = 1},
+                                       [&diffs](const diff_line& line) { diffs.push_back(line); });
+  ASSERT_TRUE(result) << result.error();
+  EXPECT_TRUE(result->has_diff);
+  EXPECT_EQ(result->lookahead_exceeded, 1);
 
-  EXPECT_EQ(exec_result.stdout, R"(-extra line
- 4
- 5
- 6
+  const auto line_count{count_lines(diffs)};
+  EXPECT_EQ(4, line_count.context);
+  EXPECT_EQ(1, line_count.expected_only);
+  EXPECT_EQ(0, line_count.actual_only);
+}
 
-)"sv);
-  EXPECT_EQ(exec_result.stderr, R"()"sv);
+TEST(PathDiffTest, LookaheadLimitBytesLineAdded) {
+  const auto expected_path = test_res_dir / "testcase_line_added-expected.txt";
+  const auto actual_path = test_res_dir / "testcase_line_added-actual.txt";
+
+  // The line after the added one is reported as missing, and found again while looking for the line after it
+  std::vector<std::string> lines{};
+  std::vector<diff_line_type> types{};
+  const auto result = diff_file_stdout(expected_path, actual_path, diff_options{.max_lookahead_bytes = 1},
+                                       [&lines, &types](const diff_line& line) {
+                                         lines.emplace_back(line.line);
+                                         types.push_back(line.type);
+                                       });
+  ASSERT_TRUE(result) << result.error();
+  EXPECT_TRUE(result->has_diff);
+  EXPECT_EQ(result->lookahead_exceeded, 1);
+
+  EXPECT_EQ(lines, (std::vector<std::string>{"4", "extra line", "4", "5", "6", ""}));
+  EXPECT_EQ(types,
+            (std::vector{diff_line_type::expected_only, diff_line_type::actual_only, diff_line_type::actual_only,
+                         diff_line_type::context, diff_line_type::context, diff_line_type::context}));
 }
 
-TEST_F(PorcelainStdoutTest, CompletelyDifferent) {
-  const auto expected_path = test_res_dir / "testcase_completely_different-expected.txt";
-  const auto actual_path = test_res_dir / "testcase_completely_different-actual.txt";
+TEST(PathDiffTest, ParallelSegments) {
+  const auto tmp_path{std::filesystem::temp_directory_path()};
+  const auto expected_path = tmp_path / "nanodiff-test-parallel-expected.txt";
+  const auto actual_path = tmp_path / "nanodiff-test-parallel-actual.txt";
+
+  // Large enough to be split into segments, with changes throughout both files, and lines which are missing from one
+  // part of the actual file but appear in a later part
+  {
+    std::ofstream expected{expected_path};
+    std::ofstream actual{actual_path};
+    ASSERT_TRUE(expected && actual) << "Unable to open temporary files for writing";
+    for (std::size_t i = 0; i < 100000; ++i) {
+      const auto line = i % 7 == 0 ? std::string{"repeated"} : std::format("line {}", i);
+      expected << line << '\n';
+      if (i == 10001) {
+        actual << "changed\n";
+      } else if (i != 30003 && i != 60003) {
+        actual << line << '\n';
+      }
+      if (i == 45003) {
+        actual << "inserted\n";
+      }
+      if (i == 90001) {
+        actual << "line 60003\n";
+      }
+    }
+  }
 
-  const auto exec_result = PorcelainStdoutTest::run_cmd(expected_path, actual_path);
-  EXPECT_NE(exec_result.exit_code, 0);
+  auto collect_diff = [&](std::size_t threads) {
+    std::vector<std::pair<std::string, diff_line_type>> lines{};
+    const auto result = diff_file_stdout(expected_path, actual_path, diff_options{.threads = threads},
+                                         [&lines](const diff_line& line) { lines.emplace_back(line.line, line.type); });
+    EXPECT_TRUE(result) << result.error();
+    EXPECT_TRUE(result && result->has_diff);
+    return lines;
+  };
+  const auto single_threaded = collect_diff(1);
+  const auto multi_threaded = collect_diff(4);
+
+  std::filesystem::remove(expected_path);
+  std::filesystem::remove(actual_path);
+
+  EXPECT_FALSE(single_threaded.empty());
+  EXPECT_TRUE(single_threaded == multi_threaded);
+}
 
-  EXPECT_EQ(exec_result.stdout, R"(-A
--B
--C
--D
--E
-+Apple
-+Banana
-+Carrot
-+Dog
-+Eggplant
+TEST(PathDiffTest, ParallelIgnoreBlankLines) {
+  const auto tmp_path{std::filesystem::temp_directory_path()};
+  const auto expected_path = tmp_path / "nanodiff-test-parallel-blank-expected.txt";
+  const auto actual_path = tmp_path / "nanodiff-test-parallel-blank-actual.txt";
+
+  // Large enough to be split into segments, with blank lines added throughout the actual file
+  {
+    std::ofstream expected{expected_path};
+    std::ofstream actual{actual_path};
+    ASSERT_TRUE(expected && actual) << "Unable to open temporary files for writing";
+    for (std::size_t i = 0; i < 100000; ++i) {
+      const auto line = std::format("line {}", i);
+      expected << line << '\n';
+      actual << line << '\n';
+      if (i % 2500 == 100) {
+        actual << '\n';
+      }
+    }
+  }
 
-)"sv);
-  EXPECT_EQ(exec_result.stderr, R"()"sv);
+  for (const std::size_t threads : {1, 4}) {
+    std::vector<std::pair<std::string, diff_line_type>> lines{};
+    const auto result = diff_file_stdout(expected_path,
+                                         actual_path,
+                                         diff_options{.threads = threads, .ignore_blank_lines = true},
+                                         [&lines](const diff_line& line) { lines.emplace_back(line.line, line.type); });
+    EXPECT_TRUE(result) << result.error();
+    EXPECT_TRUE(result && !result->has_diff) << "threads = " << threads;
+    EXPECT_TRUE(lines.empty()) << "threads = " << threads;
+  }
+
+  std::filesystem::remove(expected_path);
+  std::filesystem::remove(actual_path);
 }
 
-TEST_F(PorcelainStdoutTest, EmptyFiles) {
-  const auto expected_path = test_res_dir / "testcase_empty-expected.txt";
-  const auto actual_path = test_res_dir / "testcase_empty-actual.txt";
+TEST(PathDiffTest, FirstHunk) {
+  const auto expected_path = test_res_dir / "testcase_two_hunks-expected.txt";
+  const auto actual_path = test_res_dir / "testcase_two_hunks-actual.txt";
+
+  std::vector<std::string> lines{};
+  std::vector<diff_line_type> types{};
+  const auto result = diff_file_stdout(expected_path, actual_path, diff_options{.stop = diff_stop::after_first_hunk},
+                                       [&lines, &types](const diff_line& line) {
+                                         lines.emplace_back(line.line);
+                                         types.push_back(line.type);
+                                       });
+  ASSERT_TRUE(result) << result.error();
+  EXPECT_TRUE(result->has_diff);
+
+  EXPECT_EQ(lines, (std::vector<std::string>{"2", "X"}));
+  EXPECT_EQ(types, (std::vector{diff_line_type::expected_only, diff_line_type::actual_only}));
+}
 
-  const auto exec_result = PorcelainStdoutTest::run_cmd(expected_path, actual_path);
-  EXPECT_EQ(exec_result.exit_code, 0);
+TEST(PathDiffTest, FirstDifference) {
+  const auto expected_path = test_res_dir / "testcase_two_hunks-expected.txt";
+  const auto actual_path = test_res_dir / "testcase_two_hunks-actual.txt";
 
+  std::vector<diff_line> diffs{};
+  const auto result = diff_file_stdout(expected_path, actual_path, diff_options{.stop = diff_stop::at_first_difference},
+                                       [&diffs](const diff_line& line) { diffs.push_back(line); });
+  ASSERT_TRUE(result) << result.error();
+  EXPECT_TRUE(result->has_diff);
+  EXPECT_TRUE(diffs.empty());
+}
+
+TEST(PathDiffTest, FirstDifferenceTrailingLines) {
+  const auto expected_path = test_res_dir / "testcase_trailing_lines-expected.txt";
+  const auto actual_path = test_res_dir / "testcase_trailing_lines-actual.txt";
+
+  std::vector<diff_line> diffs{};
+  const auto result = diff_file_stdout(expected_path, actual_path, diff_options{.stop = diff_stop::at_first_difference},
+                                       [&diffs](const diff_line& line) { diffs.push_back(line); });
+  ASSERT_TRUE(result) << result.error();
+  EXPECT_TRUE(result->has_diff);
+  EXPECT_TRUE(diffs.empty());
+}
+
+TEST(PathDiffTest, FirstDifferenceSameOutput) {
+  const auto expected_path = test_res_dir / "testcase_missing_trailing_newline-expected.txt";
+  const auto actual_path = test_res_dir / "testcase_missing_trailing_newline-actual.txt";
+
+  const auto result = diff_file_stdout(expected_path, actual_path, diff_options{.stop = diff_stop::at_first_difference},
+                                       [](const diff_line&) { FAIL(); });
+  ASSERT_TRUE(result) << result.error();
+  EXPECT_FALSE(result->has_diff);
+}
+
+TEST(PathDiffTest, EmptyFiles) {
+  const auto expected_path = test_res_dir / "testcase_empty-expected.txt";
+  const auto actual_path = test_res_dir / "testcase_empty-actual.txt";
+
+  std::vector<diff_line> diffs{};
+  const auto has_diff =
+      diff_file_stdout_eager(expected_path, actual_path, [&diffs](const diff_line& line) { diffs.push_back(line); });
+  ASSERT_TRUE(has_diff) << has_diff.error();
+  EXPECT_FALSE(*has_diff);
+  EXPECT_TRUE(diffs.empty());
+}
+
+TEST(PathDiffTest, LongLines) {
+  const auto expected_path = test_res_dir / "testcase_long_lines-expected.txt";
+  const auto actual_path = test_res_dir / "testcase_long_lines-actual.txt";
+
+  std::vector<diff_line> diffs{};
+  const auto has_diff =
+      diff_file_stdout(expected_path, actual_path, [&diffs](const diff_line& line) { diffs.push_back(line); });
+  ASSERT_TRUE(has_diff) << has_diff.error();
+  EXPECT_TRUE(*has_diff);
+
+  const auto line_count{count_lines(diffs)};
+  EXPECT_EQ(2, line_count.context);
+  EXPECT_EQ(2, line_count.expected_only);
+  EXPECT_EQ(2, line_count.actual_only);
+}
+
+TEST(PathDiffTest, IgnoreWhitespaceCaseAndBlankLines) {
+  const auto expected_path = test_res_dir / "testcase_whitespace-expected.txt";
+  const auto actual_path = test_res_dir / "testcase_whitespace-actual.txt";
+
+  const diff_options options{.ignore_all_space = true, .ignore_case = true, .ignore_blank_lines = true};
+  const auto result = diff_file_stdout(expected_path, actual_path, options, [](const diff_line&) { FAIL(); });
+  ASSERT_TRUE(result) << result.error();
+  EXPECT_FALSE(result->has_diff);
+
+  const auto myers_result =
+      diff_file_stdout_myers(expected_path, actual_path, options, [](const diff_line&) { FAIL(); });
+  ASSERT_TRUE(myers_result) << myers_result.error();
+  EXPECT_FALSE(myers_result->has_diff);
+}
+
+TEST(PathDiffTest, MyersIgnoreTrailingSpaceAndCase) {
+  const auto expected_path = test_res_dir / "testcase_whitespace-expected.txt";
+  const auto actual_path = test_res_dir / "testcase_whitespace-actual.txt";
+
+  std::vector<std::pair<std::string, diff_line_type>> lines{};
+  const auto result = diff_file_stdout_myers(
+      expected_path,
+      actual_path,
+      diff_options{.ignore_trailing_space = true, .ignore_case = true},
+      [&lines](const diff_line& line) { lines.emplace_back(line.line, line.type); });
+  ASSERT_TRUE(result) << result.error();
+  EXPECT_TRUE(result->has_diff);
+
+  // Lines are output as they appear in the files
+  const std::vector<std::pair<std::string, diff_line_type>> expected_lines{
+      {"foo bar", diff_line_type::expected_only},
+      {"  indented", diff_line_type::expected_only},
+      {"foo   bar", diff_line_type::actual_only},
+      {"indented", diff_line_type::actual_only},
+      {"Value: 42", diff_line_type::context},
+      {"", diff_line_type::expected_only},
+      {"end", diff_line_type::context},
+      {"", diff_line_type::context},
+  };
+  EXPECT_EQ(lines, expected_lines);
+}
+
+TEST(PathDiffTest, NumericTolerance) {
+  const auto expected_path = test_res_dir / "testcase_numeric-expected.txt";
+  const auto actual_path = test_res_dir / "testcase_numeric-actual.txt";
+
+  std::vector<std::pair<std::string, diff_line_type>> lines{};
+  const auto result = diff_file_stdout(
+      expected_path,
+      actual_path,
+      diff_options{.abs_tolerance = 1e-6},
+      [&lines](const diff_line& line) { lines.emplace_back(line.line, line.type); });
+  ASSERT_TRUE(result) << result.error();
+  EXPECT_TRUE(result->has_diff);
+
+  // Only the first number of a version is compared with tolerance, and 100.5 is not within the absolute tolerance
+  const std::vector<std::pair<std::string, diff_line_type>> expected_lines{
+      {"version 1.2.3", diff_line_type::expected_only},
+      {"total: 100", diff_line_type::expected_only},
+      {"version 1.2.4", diff_line_type::actual_only},
+      {"total: 100.5", diff_line_type::actual_only},
+      {"done", diff_line_type::context},
+      {"", diff_line_type::context},
+  };
+  EXPECT_EQ(lines, expected_lines);
+
+  // Numbers after spaces ignored by -w are still compared with tolerance
+  lines.clear();
+  const auto all_space_result = diff_file_stdout(
+      expected_path,
+      actual_path,
+      diff_options{.ignore_all_space = true, .abs_tolerance = 1e-6},
+      [&lines](const diff_line& line) { lines.emplace_back(line.line, line.type); });
+  ASSERT_TRUE(all_space_result) << all_space_result.error();
+  EXPECT_TRUE(all_space_result->has_diff);
+  EXPECT_EQ(lines, expected_lines);
+
+  lines.clear();
+  const auto myers_result = diff_file_stdout_myers(
+      expected_path,
+      actual_path,
+      diff_options{.abs_tolerance = 1e-6, .rel_tolerance = 0.01},
+      [&lines](const diff_line& line) { lines.emplace_back(line.line, line.type); });
+  ASSERT_TRUE(myers_result) << myers_result.error();
+  EXPECT_TRUE(myers_result->has_diff);
+
+  const std::vector<std::pair<std::string, diff_line_type>> myers_expected_lines{
+      {"version 1.2.3", diff_line_type::expected_only},
+      {"version 1.2.4", diff_line_type::actual_only},
+      {"total: 100", diff_line_type::context},
+      {"done", diff_line_type::context},
+      {"", diff_line_type::context},
+  };
+  EXPECT_EQ(lines, myers_expected_lines);
+}
+
+TEST(PathDiffTest, ReadAhead) {
+  const auto tmp_path{std::filesystem::temp_directory_path()};
+  const auto expected_path = tmp_path / "nanodiff-test-read-ahead-expected.txt";
+  const auto actual_path = tmp_path / "nanodiff-test-read-ahead-actual.txt";
+
+  // Spans many batches, including lines longer than a batch, and ends without a trailing newline
+  {
+    std::ofstream expected{expected_path};
+    std::ofstream actual{actual_path};
+    ASSERT_TRUE(expected && actual) << "Unable to open temporary files for writing";
+    for (std::size_t i = 0; i < 50000; ++i) {
+      const auto line = i % 10000 == 0 ? std::string(1U << 19U, 'a') : std::format("line {}", i);
+      expected << line << '\n';
+      if (i % 9000 == 0) {
+        actual << "changed\n";
+      } else {
+        actual << line << '\n';
+      }
+    }
+    expected << "last";
+    actual << "last";
+  }
+
+  auto collect_diff = [&](diff_options options) {
+    std::vector<std::pair<std::string, diff_line_type>> lines{};
+    const auto result = diff_file_stdout(expected_path, actual_path, options,
+                                         [&lines](const diff_line& line) { lines.emplace_back(line.line, line.type); });
+    EXPECT_TRUE(result) << result.error();
+    EXPECT_TRUE(result && result->has_diff);
+    return lines;
+  };
+  const auto direct = collect_diff(diff_options{});
+  const auto read_ahead = collect_diff(diff_options{.read_ahead = 1});
+  const auto first_hunk = collect_diff(diff_options{.stop = diff_stop::after_first_hunk, .read_ahead = 4});
+
+  std::filesystem::remove(expected_path);
+  std::filesystem::remove(actual_path);
+
+  EXPECT_FALSE(direct.empty());
+  EXPECT_TRUE(direct == read_ahead);
+  ASSERT_LT(first_hunk.size(), direct.size());
+  EXPECT_TRUE(std::equal(first_hunk.begin(), first_hunk.end(), direct.begin()));
+}
+
+TEST(PathDiffTest, MissingFile) {
+  const auto expected_path = test_res_dir / "testcase_empty-expected.txt";
+  const auto actual_path = test_res_dir / "testcase_does_not_exist-actual.txt";
+
+  const auto has_diff = diff_file_stdout(expected_path, actual_path, [](const diff_line&) {});
+  EXPECT_FALSE(has_diff);
+}
+
+#if defined(__linux__)
+
+TEST(PathDiffTest, Fifo) {
+  const auto expected_path = test_res_dir / "testcase_line_added-expected.txt";
+  const auto fifo_path = std::filesystem::temp_directory_path() / ".nanodiff-test.fifo";
+
+  std::filesystem::remove(fifo_path);
+  ASSERT_EQ(::mkfifo(fifo_path.c_str(), 0600), 0) << "Failed to create FIFO " << fifo_path;
+
+  std::thread writer{[&fifo_path]() { std::ofstream{fifo_path} << "1\n2\n3\nextra line\n4\n5\n6\n"; }};
+
+  std::vector<diff_line> diffs{};
+  const auto has_diff =
+      diff_file_stdout(expected_path, fifo_path, [&diffs](const diff_line& line) { diffs.push_back(line); });
+  writer.join();
+  std::filesystem::remove(fifo_path);
+
+  ASSERT_TRUE(has_diff) << has_diff.error();
+  EXPECT_TRUE(*has_diff);
+
+  const auto line_count{count_lines(diffs)};
+  EXPECT_EQ(4, line_count.context);
+  EXPECT_EQ(0, line_count.expected_only);
+  EXPECT_EQ(1, line_count.actual_only);
+}
+
+TEST(PathDiffTest, ExpectedIndex) {
+  const auto tmp_path{std::filesystem::temp_directory_path()};
+  const auto expected_path = tmp_path / "nanodiff-test-index-expected.txt";
+  const auto actual_path = test_res_dir / "testcase_two_hunks-actual.txt";
+  const auto index_dir = tmp_path / "nanodiff-test-index";
+  std::filesystem::remove_all(index_dir);
+
+  auto write_expected = [&](std::string_view contents) {
+    std::ofstream{expected_path} << contents;
+    // The modification time may not change if the file is rewritten quickly
+    std::filesystem::last_write_time(expected_path, std::filesystem::last_write_time(expected_path) + 1h);
+  };
+  auto collect_diff = [&] {
+    std::string output{};
+    output_sink sink{output};
+    const auto result = diff_files(expected_path,
+                                   actual_path,
+                                   diff_options{.index_expected = true, .index_dir = index_dir},
+                                   [&sink](const diff_line& line) { sink.write_line(line); });
+    EXPECT_TRUE(result) << result.error();
+    EXPECT_TRUE(sink.flush());
+    return output;
+  };
+  auto index_files = [&] {
+    return std::ranges::distance(std::filesystem::directory_iterator{index_dir}, std::filesystem::directory_iterator{});
+  };
+
+  write_expected("1\n2\n3\n4\n5\n6\n");
+  const auto two_hunks = "-2\n+X\n 3\n 4\n-5\n+Y\n 6\n\n"sv;
+  // The index is created by the first comparison, and loaded by the second
+  EXPECT_EQ(collect_diff(), two_hunks);
+  ASSERT_EQ(index_files(), 1);
+  EXPECT_EQ(collect_diff(), two_hunks);
+
+  // Corrupt indexes are replaced
+  const auto index_path = std::filesystem::directory_iterator{index_dir}->path();
+  std::ofstream{index_path, std::ios::binary | std::ios::trunc} << std::string(200, 'x');
+  EXPECT_EQ(collect_diff(), two_hunks);
+  EXPECT_NE(std::filesystem::file_size(index_path), 200U);
+
+  // Indexes of files which are only touched are kept, but store the new modification time
+  const auto index_time = std::filesystem::last_write_time(index_path) - 24h;
+  std::filesystem::last_write_time(index_path, index_time);
+  std::filesystem::last_write_time(expected_path, std::filesystem::last_write_time(expected_path) + 1h);
+  EXPECT_EQ(collect_diff(), two_hunks);
+  EXPECT_NE(std::filesystem::last_write_time(index_path), index_time);
+  std::filesystem::last_write_time(index_path, index_time);
+  EXPECT_EQ(collect_diff(), two_hunks);
+  EXPECT_EQ(std::filesystem::last_write_time(index_path), index_time);
+
+  // Stale indexes are replaced, even if the size of the file is unchanged
+  write_expected("1\nX\n3\n4\n5\n6\n");
+  EXPECT_EQ(collect_diff(), "-5\n+Y\n 6\n\n"sv);
+  write_expected("1\nX\n3\n4\nY\n6\n");
+  EXPECT_EQ(collect_diff(), ""sv);
+  EXPECT_EQ(index_files(), 1);
+
+  std::filesystem::remove(expected_path);
+  std::filesystem::remove_all(index_dir);
+}
+
+TEST(BufferDiffTest, OneLineChanged) {
+  const std::string expected{"1\n2\n3\n4\n5\n"};
+  const std::string actual{"1\n2\nX\n4\n5\n"};
+
+  std::string output{};
+  output_sink sink{output};
+  const auto result = diff_buffers(expected, actual, diff_options{}, [&](const diff_line& line) {
+    // Lines are views into the buffers
+    const auto& buffer = line.type == diff_line_type::actual_only ? actual : expected;
+    EXPECT_GE(line.line.data(), buffer.data());
+    EXPECT_LE(line.line.data() + line.line.size(), buffer.data() + buffer.size());
+    sink.write_line(line);
+  });
+  EXPECT_TRUE(result.has_diff);
+  ASSERT_TRUE(sink.flush());
+
+  EXPECT_EQ(output, R"(-3
++X
+ 4
+ 5
+
+)"sv);
+}
+
+TEST(BufferDiffTest, SameOutput) {
+  const std::string_view contents{"1\n2\n3\n"};
+
+  std::vector<diff_line> diffs{};
+  const auto result =
+      diff_buffers(contents, contents, diff_options{}, [&diffs](const diff_line& line) { diffs.push_back(line); });
+  EXPECT_FALSE(result.has_diff);
+  EXPECT_TRUE(diffs.empty());
+}
+
+TEST(BufferDiffTest, MyersSpan) {
+  const std::vector<char> expected{'a', '\n', 'b', '\n', 'c', '\n'};
+  const std::vector<char> actual{'b', '\n', 'c', '\n', 'd', '\n'};
+
+  std::string output{};
+  output_sink sink{output};
+  const auto result = diff_buffers(std::span{expected},
+                                   std::span{actual},
+                                   diff_options{.algorithm = diff_algorithm::myers},
+                                   [&sink](const diff_line& line) { sink.write_line(line); });
+  EXPECT_TRUE(result.has_diff);
+  ASSERT_TRUE(sink.flush());
+
+  EXPECT_EQ(output, R"(-a
+ b
+ c
++d
+
+)"sv);
+}
+
+TEST(BufferDiffTest, TimeoutFallsBackToGreedy) {
+  constexpr auto expected = "a\nb\nc\n"sv;
+  constexpr auto actual = "c\nb\na\n"sv;
+
+  for (const auto algorithm : {diff_algorithm::myers, diff_algorithm::patience, diff_algorithm::histogram}) {
+    std::string output{};
+    output_sink sink{output};
+    const auto result = diff_buffers(expected,
+                                     actual,
+                                     diff_options{.algorithm = algorithm, .timeout = 0ms},
+                                     [&sink](const diff_line& line) { sink.write_line(line); });
+    EXPECT_TRUE(result.has_diff);
+    EXPECT_TRUE(result.budget_exceeded);
+    ASSERT_TRUE(sink.flush());
+
+    std::string greedy_output{};
+    output_sink greedy_sink{greedy_output};
+    const auto greedy_result = diff_buffers(
+        expected, actual, diff_options{}, [&greedy_sink](const diff_line& line) { greedy_sink.write_line(line); });
+    EXPECT_FALSE(greedy_result.budget_exceeded);
+    ASSERT_TRUE(greedy_sink.flush());
+
+    EXPECT_EQ(output, greedy_output);
+  }
+
+  const auto result =
+      diff_buffers(expected, actual, diff_options{.algorithm = diff_algorithm::myers}, [](const diff_line&) {});
+  EXPECT_FALSE(result.budget_exceeded);
+}
+
+// Line source which returns the lines of a vector, as a stand-in for a caller-defined source
+class vector_line_reader final : public line_reader {
+ public:
+  explicit vector_line_reader(std::vector<std::string> lines) : _lines{std::move(lines)} {}
+
+  auto read_line() -> std::optional<std::string_view> override {
+    if (_pos == _lines.size()) {
+      return std::nullopt;
+    }
+    return _lines[_pos++];
+  }
+
+ private:
+  std::vector<std::string> _lines;
+  std::size_t _pos{};
+};
+
+TEST(LineReaderDiffTest, MatchesBuffers) {
+  const auto expected_path = test_res_dir / "testcase_two_hunks-expected.txt";
+  const auto actual_path = test_res_dir / "testcase_two_hunks-actual.txt";
+
+  for (const auto algorithm :
+       {diff_algorithm::greedy, diff_algorithm::myers, diff_algorithm::patience, diff_algorithm::histogram}) {
+    std::string file_output{};
+    {
+      output_sink sink{file_output};
+      const auto result = diff_files(expected_path,
+                                     actual_path,
+                                     diff_options{.algorithm = algorithm},
+                                     [&sink](const diff_line& line) { sink.write_line(line); });
+      ASSERT_TRUE(result) << result.error();
+      EXPECT_TRUE(result->has_diff);
+    }
+
+    // Each source ends with the empty line which follows the last line of the files
+    vector_line_reader expected{{"1", "2", "3", "4", "5", "6", ""}};
+    vector_line_reader actual{{"1", "X", "3", "4", "Y", "6", ""}};
+    std::string reader_output{};
+    {
+      output_sink sink{reader_output};
+      const auto result = diff_lines(expected,
+                                     actual,
+                                     diff_options{.algorithm = algorithm},
+                                     [&sink](const diff_line& line) { sink.write_line(line); });
+      EXPECT_TRUE(result.has_diff);
+    }
+
+    EXPECT_EQ(reader_output, file_output);
+  }
+}
+
+// Line source which holds its input in memory, but reads it line by line from the start
+class buffer_line_reader final : public line_reader {
+ public:
+  explicit buffer_line_reader(std::string_view buffer) : _buffer{buffer} {}
+
+  auto read_line() -> std::optional<std::string_view> override {
+    if (_done) {
+      return std::nullopt;
+    }
+    const auto newline = _buffer.find('\n', _pos);
+    if (newline == std::string_view::npos) {
+      _done = true;
+      return _buffer.substr(_pos);
+    }
+    const auto line = _buffer.substr(_pos, newline - _pos);
+    _pos = newline + 1;
+    return line;
+  }
+
+  [[nodiscard]] auto contents() const noexcept -> std::optional<std::string_view> override {
+    return _done ? std::string_view{} : _buffer.substr(_pos);
+  }
+
+ private:
+  std::string_view _buffer;
+  std::size_t _pos{};
+  bool _done{};
+};
+
+TEST(LineReaderDiffTest, ContentsWithoutTrim) {
+  const std::string expected{"1\n2\n3\n4\n5\n"};
+  const std::string actual{"1\n2\nX\n4\n5\n"};
+
+  for (const auto algorithm : {diff_algorithm::greedy, diff_algorithm::myers}) {
+    std::string buffer_output{};
+    {
+      output_sink sink{buffer_output};
+      diff_buffers(expected, actual, diff_options{.algorithm = algorithm}, [&sink](const diff_line& line) {
+        sink.write_line(line);
+      });
+    }
+
+    // The common lines are read one by one, since the readers cannot skip them
+    buffer_line_reader expected_reader{expected};
+    buffer_line_reader actual_reader{actual};
+    std::string reader_output{};
+    {
+      output_sink sink{reader_output};
+      const auto result = diff_lines(expected_reader,
+                                     actual_reader,
+                                     diff_options{.algorithm = algorithm},
+                                     [&sink](const diff_line& line) { sink.write_line(line); });
+      EXPECT_TRUE(result.has_diff);
+    }
+
+    EXPECT_EQ(reader_output, buffer_output);
+  }
+}
+
+TEST(OutputSinkTest, OneLineChanged) {
+  const auto expected_path = test_res_dir / "testcase_one_line_changed-expected.txt";
+  const auto actual_path = test_res_dir / "testcase_one_line_changed-actual.txt";
+
+  std::string output{};
+  output_sink sink{output};
+  const auto has_diff =
+      diff_file_stdout(expected_path, actual_path, [&sink](const diff_line& line) { sink.write_line(line); });
+  ASSERT_TRUE(has_diff) << has_diff.error();
+  EXPECT_TRUE(*has_diff);
+  ASSERT_TRUE(sink.flush());
+
+  EXPECT_EQ(output, R"(-3
++X
+ 4
+ 5
+
+)"sv);
+}
+
+TEST(OutputSinkTest, ManyLines) {
+  std::string output{};
+  std::string expected_output{};
+  {
+    output_sink sink{output};
+    for (int i = 0; i < 100000; ++i) {
+      const auto line = std::to_string(i);
+      sink.write_line(diff_line{.line = line, .type = diff_line_type::actual_only});
+      expected_output += std::format("+{}\n", line);
+    }
+  }
+
+  EXPECT_EQ(output, expected_output);
+}
+
+TEST(OutputSinkTest, LongLine) {
+  const std::string long_line(1U << 20U, 'a');
+
+  std::string output{};
+  output_sink sink{output};
+  sink.write_line(diff_line{.line = "before", .type = diff_line_type::context});
+  sink.write_line(diff_line{.line = long_line, .type = diff_line_type::expected_only});
+  sink.write_line(diff_line{.line = "", .type = diff_line_type::context});
+  ASSERT_TRUE(sink.flush());
+
+  EXPECT_EQ(output, std::format(" before\n-{}\n\n", long_line));
+}
+
+struct exec_output {
+  int exit_code;
+  std::string stdout;
+  std::string stderr;
+};
+
+class PorcelainStdoutTest : public testing::Test {
+ protected:
+  static auto run_cmd(const std::filesystem::path& expected_path,
+                      const std::filesystem::path& actual_path,
+                      const std::string_view args = ""sv) -> exec_output {
+    return run_cmd_args(std::format("{} -- {} {}", args, std::string{expected_path}, std::string{actual_path}));
+  }
+
+  // Runs the executable through the shell, and captures its output in memory through a pipe per stream, so that tests
+  // can run concurrently without sharing any files
+  static auto run_cmd_args(const std::string_view args) -> exec_output {
+    std::filesystem::path exec_path{};
+    PorcelainStdoutTest::exec_path(exec_path);
+
+    const auto cmd = std::format("{} {}", std::string{exec_path}, args);
+
+    std::array<int, 2> stdout_pipe{-1, -1};
+    std::array<int, 2> stderr_pipe{-1, -1};
+    if (::pipe(stdout_pipe.data()) != 0 || ::pipe(stderr_pipe.data()) != 0) {
+      ADD_FAILURE() << "Unable to create pipes for the output of " << cmd;
+      return exec_output{.exit_code = -1, .stdout = {}, .stderr = {}};
+    }
+
+    ::posix_spawn_file_actions_t actions{};
+    ::posix_spawn_file_actions_init(&actions);
+    ::posix_spawn_file_actions_adddup2(&actions, stdout_pipe[1], STDOUT_FILENO);
+    ::posix_spawn_file_actions_adddup2(&actions, stderr_pipe[1], STDERR_FILENO);
+    for (const auto fd : {stdout_pipe[0], stdout_pipe[1], stderr_pipe[0], stderr_pipe[1]}) {
+      ::posix_spawn_file_actions_addclose(&actions, fd);
+    }
+
+    std::string shell{"sh"};
+    std::string shell_flag{"-c"};
+    std::string shell_cmd{cmd};
+    std::array<char*, 4> argv{shell.data(), shell_flag.data(), shell_cmd.data(), nullptr};
+    ::pid_t pid{};
+    const auto spawn_err = ::posix_spawn(&pid, "/bin/sh", &actions, nullptr, argv.data(), environ);
+    ::posix_spawn_file_actions_destroy(&actions);
+    ::close(stdout_pipe[1]);
+    ::close(stderr_pipe[1]);
+
+    exec_output output{.exit_code = -1, .stdout = {}, .stderr = {}};
+    if (spawn_err != 0) {
+      ADD_FAILURE() << "Unable to run " << cmd;
+    } else {
+      // Both pipes are drained together, so that the command never blocks on a full pipe. Commands run by `--run` may
+      // leave processes behind which keep the pipes open, so reading stops once the shell has exited and the pipes
+      // hold no more output.
+      std::array<::pollfd, 2> fds{{{.fd = stdout_pipe[0], .events = POLLIN, .revents = 0},
+                                    {.fd = stderr_pipe[0], .events = POLLIN, .revents = 0}}};
+      std::array<std::string*, 2> outputs{&output.stdout, &output.stderr};
+      std::array<char, 1U << 16U> buffer{};
+      int status{};
+      bool exited{};
+      while (fds[0].fd >= 0 || fds[1].fd >= 0) {
+        const auto nready = ::poll(fds.data(), fds.size(), exited ? 0 : 50);
+        if (nready < 0 && errno != EINTR) {
+          break;
+        }
+        if (nready == 0) {
+          if (exited) {
+            break;
+          }
+          exited = ::waitpid(pid, &status, WNOHANG) == pid;
+          continue;
+        }
+        for (std::size_t i = 0; i < fds.size(); ++i) {
+          if (nready < 0 || fds[i].fd < 0 || fds[i].revents == 0) {
+            continue;
+          }
+          const auto nread = ::read(fds[i].fd, buffer.data(), buffer.size());
+          if (nread > 0) {
+            outputs[i]->append(buffer.data(), static_cast<std::size_t>(nread));
+          } else if (nread == 0 || errno != EINTR) {
+            fds[i].fd = -1;
+          }
+        }
+      }
+
+      if (!exited) {
+        while (::waitpid(pid, &status, 0) < 0 && errno == EINTR) {
+        }
+      }
+      output.exit_code = WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+    }
+
+    ::close(stdout_pipe[0]);
+    ::close(stderr_pipe[0]);
+    return output;
+  }
+
+  static void SetUpTestSuite() {
+    const auto exec_path{std::filesystem::absolute(std::filesystem::current_path() / ".." / NANODIFF_TEST_EXECUTABLE)};
+
+    _exec_path = std::filesystem::is_regular_file(exec_path) ? std::make_optional(exec_path) : std::nullopt;
+  }
+
+  static void exec_path(std::filesystem::path& exec_path) {
+    if (!_exec_path) {
+      GTEST_SKIP() << "Test requires `nanodiff` executable to be compiled";
+    }
+    exec_path = *_exec_path;
+  }
+
+ private:
+  static std::optional<std::filesystem::path> _exec_path;
+};
+
+std::optional<std::filesystem::path> PorcelainStdoutTest::_exec_path{};
+
+TEST_F(PorcelainStdoutTest, SameOutput) {
+  const auto expected_path = test_res_dir / "testcase_same_output-expected.txt";
+  const auto actual_path = test_res_dir / "testcase_same_output-actual.txt";
+
+  const auto exec_result = PorcelainStdoutTest::run_cmd(expected_path, actual_path);
+  EXPECT_EQ(exec_result.exit_code, 0);
+
+  EXPECT_EQ(exec_result.stdout, R"()"sv);
+  EXPECT_EQ(exec_result.stderr, R"()"sv);
+}
+
+TEST_F(PorcelainStdoutTest, OneLineChanged) {
+  const auto expected_path = test_res_dir / "testcase_one_line_changed-expected.txt";
+  const auto actual_path = test_res_dir / "testcase_one_line_changed-actual.txt";
+
+  const auto exec_result = PorcelainStdoutTest::run_cmd(expected_path, actual_path);
+  EXPECT_NE(exec_result.exit_code, 0);
+
+  EXPECT_EQ(exec_result.stdout, R"(-3
++X
+ 4
+ 5
+
+)"sv);
+  EXPECT_EQ(exec_result.stderr, R"()"sv);
+}
+
+TEST_F(PorcelainStdoutTest, LineAdded) {
+  const auto expected_path = test_res_dir / "testcase_line_added-expected.txt";
+  const auto actual_path = test_res_dir / "testcase_line_added-actual.txt";
+
+  const auto exec_result = PorcelainStdoutTest::run_cmd(expected_path, actual_path);
+  EXPECT_NE(exec_result.exit_code, 0);
+
+  EXPECT_EQ(exec_result.stdout, R"(+extra line
+ 4
+ 5
+ 6
+
+)"sv);
+  EXPECT_EQ(exec_result.stderr, R"()"sv);
+}
+
+TEST_F(PorcelainStdoutTest, LineRemoved) {
+  const auto expected_path = test_res_dir / "testcase_line_removed-expected.txt";
+  const auto actual_path = test_res_dir / "testcase_line_removed-actual.txt";
+
+  const auto exec_result = PorcelainStdoutTest::run_cmd(expected_path, actual_path);
+  EXPECT_NE(exec_result.exit_code, 0);
+
+  EXPECT_EQ(exec_result.stdout, R"(-extra line
+ 4
+ 5
+ 6
+
+)"sv);
+  EXPECT_EQ(exec_result.stderr, R"()"sv);
+}
+
+TEST_F(PorcelainStdoutTest, CompletelyDifferent) {
+  const auto expected_path = test_res_dir / "testcase_completely_different-expected.txt";
+  const auto actual_path = test_res_dir / "testcase_completely_different-actual.txt";
+
+  const auto exec_result = PorcelainStdoutTest::run_cmd(expected_path, actual_path);
+  EXPECT_NE(exec_result.exit_code, 0);
+
+  EXPECT_EQ(exec_result.stdout, R"(-A
+-B
+-C
+-D
+-E
++Apple
++Banana
++Carrot
++Dog
++Eggplant
+
+)"sv);
+  EXPECT_EQ(exec_result.stderr, R"()"sv);
+}
+
+TEST_F(PorcelainStdoutTest, EmptyFiles) {
+  const auto expected_path = test_res_dir / "testcase_empty-expected.txt";
+  const auto actual_path = test_res_dir / "testcase_empty-actual.txt";
+
+  const auto exec_result = PorcelainStdoutTest::run_cmd(expected_path, actual_path);
+  EXPECT_EQ(exec_result.exit_code, 0);
+
+  EXPECT_EQ(exec_result.stdout, R"()"sv);
+  EXPECT_EQ(exec_result.stderr, R"()"sv);
+}
+
+TEST_F(PorcelainStdoutTest, LookaheadLimit) {
+  const auto expected_path = test_res_dir / "testcase_line_moved-expected.txt";
+  const auto actual_path = test_res_dir / "testcase_line_moved-actual.txt";
+
+  const auto exec_result = PorcelainStdoutTest::run_cmd(expected_path, actual_path, "--max-lookahead-lines 2"sv);
+  EXPECT_NE(exec_result.exit_code, 0);
+
+  EXPECT_EQ(exec_result.stdout, R"(-moved
+ 1
+ 2
+ 3
++moved
+
+)"sv);
+  EXPECT_TRUE(exec_result.stderr.starts_with("Look-ahead limit reached"sv)) << exec_result.stderr;
+}
+
+TEST_F(PorcelainStdoutTest, LookaheadLimitWithMyers) {
+  const auto expected_path = test_res_dir / "testcase_line_moved-expected.txt";
+  const auto actual_path = test_res_dir / "testcase_line_moved-actual.txt";
+
+  const auto exec_result =
+      PorcelainStdoutTest::run_cmd(expected_path, actual_path, "--algorithm myers --max-lookahead-lines 2"sv);
+  EXPECT_NE(exec_result.exit_code, 0);
+  EXPECT_TRUE(exec_result.stdout.starts_with("Error while parsing command-line arguments"sv)) << exec_result.stdout;
+}
+
+TEST_F(PorcelainStdoutTest, MyersLineMoved) {
+  const auto expected_path = test_res_dir / "testcase_line_moved-expected.txt";
+  const auto actual_path = test_res_dir / "testcase_line_moved-actual.txt";
+
+  const auto exec_result = PorcelainStdoutTest::run_cmd(expected_path, actual_path, "--algorithm myers"sv);
+  EXPECT_NE(exec_result.exit_code, 0);
+
+  EXPECT_EQ(exec_result.stdout, R"(-moved
+ 1
+ 2
+ 3
++moved
+
+)"sv);
+  EXPECT_EQ(exec_result.stderr, R"()"sv);
+}
+
+TEST_F(PorcelainStdoutTest, MaxCost) {
+  const auto expected_path = test_res_dir / "testcase_line_moved-expected.txt";
+  const auto actual_path = test_res_dir / "testcase_line_moved-actual.txt";
+
+  // Two lines differ, so a limit of two lines does not change the diff
+  const auto exec_result =
+      PorcelainStdoutTest::run_cmd(expected_path, actual_path, "--algorithm myers --max-cost 2"sv);
+  EXPECT_NE(exec_result.exit_code, 0);
+  EXPECT_EQ(exec_result.stdout, "-moved\n 1\n 2\n 3\n+moved\n\n"sv);
+  EXPECT_EQ(exec_result.stderr, R"()"sv);
+
+  const auto exceeded_result =
+      PorcelainStdoutTest::run_cmd(expected_path, actual_path, "--algorithm myers --max-cost 1"sv);
+  EXPECT_NE(exceeded_result.exit_code, 0);
+  EXPECT_EQ(exceeded_result.stdout, PorcelainStdoutTest::run_cmd(expected_path, actual_path).stdout);
+  EXPECT_TRUE(exceeded_result.stderr.starts_with("Diff budget exceeded"sv)) << exceeded_result.stderr;
+}
+
+TEST_F(PorcelainStdoutTest, MaxCostWithGreedy) {
+  const auto expected_path = test_res_dir / "testcase_line_moved-expected.txt";
+  const auto actual_path = test_res_dir / "testcase_line_moved-actual.txt";
+
+  const auto exec_result = PorcelainStdoutTest::run_cmd(expected_path, actual_path, "--max-cost 2"sv);
+  EXPECT_NE(exec_result.exit_code, 0);
+  EXPECT_TRUE(exec_result.stdout.starts_with("Error while parsing command-line arguments"sv)) << exec_result.stdout;
+}
+
+TEST_F(PorcelainStdoutTest, FirstHunk) {
+  const auto expected_path = test_res_dir / "testcase_two_hunks-expected.txt";
+  const auto actual_path = test_res_dir / "testcase_two_hunks-actual.txt";
+
+  const auto exec_result = PorcelainStdoutTest::run_cmd(expected_path, actual_path, "--first"sv);
+  EXPECT_NE(exec_result.exit_code, 0);
+  EXPECT_EQ(exec_result.stdout, "-2\n+X\n"sv);
+  EXPECT_EQ(exec_result.stderr, R"()"sv);
+}
+
+TEST_F(PorcelainStdoutTest, MyersFirstHunk) {
+  const auto expected_path = test_res_dir / "testcase_two_hunks-expected.txt";
+  const auto actual_path = test_res_dir / "testcase_two_hunks-actual.txt";
+
+  const auto exec_result = PorcelainStdoutTest::run_cmd(expected_path, actual_path, "--algorithm myers --first"sv);
+  EXPECT_NE(exec_result.exit_code, 0);
+  EXPECT_EQ(exec_result.stdout, "-2\n+X\n"sv);
+  EXPECT_EQ(exec_result.stderr, R"()"sv);
+}
+
+TEST_F(PorcelainStdoutTest, AnchoredMovedFunction) {
+  const auto expected_path = test_res_dir / "testcase_moved_function-expected.txt";
+  const auto actual_path = test_res_dir / "testcase_moved_function-actual.txt";
+
+  // Greedy matches the braces and blank lines of the removed function against those of the others
+  const auto greedy_result = PorcelainStdoutTest::run_cmd(expected_path, actual_path, "-U 0"sv);
+  EXPECT_NE(greedy_result.exit_code, 0);
+  EXPECT_EQ(std::ranges::count(greedy_result.stdout, '\n'), 28);
+
+  for (const auto algorithm : {"patience"sv, "histogram"sv}) {
+    const auto exec_result =
+        PorcelainStdoutTest::run_cmd(expected_path, actual_path, std::format("--algorithm {} -U 0", algorithm));
+    EXPECT_NE(exec_result.exit_code, 0);
+    EXPECT_EQ(exec_result.stdout, R"(@@ -2,0 +3,9 @@
++int fib(int n)
++{
++    if(n > 2)
++    {
++        return fib(n-1) + fib(n-2);
++    }
++    return 1;
++}
++
+@@ -9 +17,0 @@
+-        printf("Your answer is: ");
+@@ -14,9 +21,0 @@
+-int fact(int n)
+-{
+-    if(n > 1)
+-    {
+-        return fact(n-1) * n;
+-    }
+-    return 1;
+-}
+-
+@@ -25 +24 @@
+-    frobnitz(fact(10));
++    frobnitz(fib(10));
+)"sv) << algorithm;
+    EXPECT_EQ(exec_result.stderr, R"()"sv);
+  }
+}
+
+TEST_F(PorcelainStdoutTest, AnchoredFirstHunk) {
+  const auto expected_path = test_res_dir / "testcase_two_hunks-expected.txt";
+  const auto actual_path = test_res_dir / "testcase_two_hunks-actual.txt";
+
+  for (const auto algorithm : {"patience"sv, "histogram"sv}) {
+    const auto exec_result =
+        PorcelainStdoutTest::run_cmd(expected_path, actual_path, std::format("--algorithm {} --first", algorithm));
+    EXPECT_NE(exec_result.exit_code, 0);
+    EXPECT_EQ(exec_result.stdout, "-2\n+X\n"sv) << algorithm;
+    EXPECT_EQ(exec_result.stderr, R"()"sv);
+  }
+}
+
+TEST_F(PorcelainStdoutTest, Unified) {
+  const auto expected_path = test_res_dir / "testcase_two_hunks-expected.txt";
+  const auto actual_path = test_res_dir / "testcase_two_hunks-actual.txt";
+
+  // The changes are separated by two context lines, so they are in one hunk
+  const auto exec_result = PorcelainStdoutTest::run_cmd(expected_path, actual_path, "-U 1"sv);
+  EXPECT_NE(exec_result.exit_code, 0);
+  EXPECT_EQ(exec_result.stdout, "@@ -1,6 +1,6 @@\n 1\n-2\n+X\n 3\n 4\n-5\n+Y\n 6\n"sv);
+  EXPECT_EQ(exec_result.stderr, R"()"sv);
+}
+
+TEST_F(PorcelainStdoutTest, UnifiedNoContext) {
+  const auto expected_path = test_res_dir / "testcase_two_hunks-expected.txt";
+  const auto actual_path = test_res_dir / "testcase_two_hunks-actual.txt";
+
+  const auto exec_result = PorcelainStdoutTest::run_cmd(expected_path, actual_path, "--unified 0"sv);
+  EXPECT_NE(exec_result.exit_code, 0);
+  EXPECT_EQ(exec_result.stdout, "@@ -2 +2 @@\n-2\n+X\n@@ -5 +5 @@\n-5\n+Y\n"sv);
+  EXPECT_EQ(exec_result.stderr, R"()"sv);
+}
+
+TEST_F(PorcelainStdoutTest, MyersUnifiedFirstHunk) {
+  const auto expected_path = test_res_dir / "testcase_two_hunks-expected.txt";
+  const auto actual_path = test_res_dir / "testcase_two_hunks-actual.txt";
+
+  const auto exec_result =
+      PorcelainStdoutTest::run_cmd(expected_path, actual_path, "--algorithm myers -U 0 --first"sv);
+  EXPECT_NE(exec_result.exit_code, 0);
+  EXPECT_EQ(exec_result.stdout, "@@ -2 +2 @@\n-2\n+X\n"sv);
+  EXPECT_EQ(exec_result.stderr, R"()"sv);
+}
+
+TEST_F(PorcelainStdoutTest, UnifiedLastLineChanged) {
+  const auto expected_path = test_res_dir / "testcase_last_line_changed-expected.txt";
+  const auto actual_path = test_res_dir / "testcase_last_line_changed-actual.txt";
+
+  // The empty line following the final newline is not a line of either file
+  const auto exec_result = PorcelainStdoutTest::run_cmd(expected_path, actual_path, "-U 3"sv);
+  EXPECT_NE(exec_result.exit_code, 0);
+  EXPECT_EQ(exec_result.stdout, "@@ -1,3 +1,3 @@\n 1\n 2\n-3\n+X\n"sv);
+  EXPECT_EQ(exec_result.stderr, R"()"sv);
+
+  const auto ndjson_result = PorcelainStdoutTest::run_cmd(expected_path, actual_path, "--format ndjson"sv);
+  EXPECT_NE(ndjson_result.exit_code, 0);
+  EXPECT_TRUE(ndjson_result.stdout.starts_with(
+      R"({"type":"hunk","expected_start":1,"expected_count":3,"actual_start":1,"actual_count":3,"lines":[)"
+      R"({"type":"context","expected_line":1,"actual_line":1,"text":"1"},)"
+      R"({"type":"context","expected_line":2,"actual_line":2,"text":"2"},)"
+      R"({"type":"expected_only","expected_line":3,"text":"3"},{"type":"actual_only","actual_line":3,"text":"X"}]})"
+      "\n"sv))
+      << ndjson_result.stdout;
+}
+
+TEST_F(PorcelainStdoutTest, UnifiedBlankLineRemoved) {
+  const auto expected_path = test_res_dir / "testcase_blank_line_removed-expected.txt";
+  const auto actual_path = test_res_dir / "testcase_blank_line_removed-actual.txt";
+
+  // The blank line is not matched against the empty line following the final newline of the actual file
+  const auto no_context = PorcelainStdoutTest::run_cmd(expected_path, actual_path, "-U 0"sv);
+  EXPECT_NE(no_context.exit_code, 0);
+  EXPECT_EQ(no_context.stdout, "@@ -2 +1,0 @@\n-\n"sv);
+
+  const auto exec_result = PorcelainStdoutTest::run_cmd(expected_path, actual_path, "-U 3"sv);
+  EXPECT_NE(exec_result.exit_code, 0);
+  EXPECT_EQ(exec_result.stdout, "@@ -1,3 +1,2 @@\n a\n-\n b\n"sv);
+  EXPECT_EQ(exec_result.stderr, R"()"sv);
+
+  const auto ndjson_result = PorcelainStdoutTest::run_cmd(expected_path, actual_path, "--format ndjson -U 0"sv);
+  EXPECT_NE(ndjson_result.exit_code, 0);
+  EXPECT_TRUE(ndjson_result.stdout.starts_with(
+      R"({"type":"hunk","expected_start":2,"expected_count":1,"actual_start":2,"actual_count":0,"lines":[)"
+      R"({"type":"expected_only","expected_line":2,"text":""}]})"
+      "\n"
+      R"({"type":"summary","has_diff":true,"hunks":1,"expected_only":1,"actual_only":0,)"sv))
+      << ndjson_result.stdout;
+}
+
+TEST_F(PorcelainStdoutTest, UnifiedLargeContext) {
+  const auto expected_path = test_res_dir / "testcase_last_line_changed-expected.txt";
+  const auto actual_path = test_res_dir / "testcase_last_line_changed-actual.txt";
+
+  // Context lines are only buffered as they are seen
+  const auto exec_result = PorcelainStdoutTest::run_cmd(expected_path, actual_path, "-U 100000000"sv);
+  EXPECT_NE(exec_result.exit_code, 0);
+  EXPECT_EQ(exec_result.stdout, "@@ -1,3 +1,3 @@\n 1\n 2\n-3\n+X\n"sv);
+  EXPECT_EQ(exec_result.stderr, R"()"sv);
+}
+
+TEST_F(PorcelainStdoutTest, UnifiedAddedLines) {
+  const auto expected_path = test_res_dir / "testcase_line_added-expected.txt";
+  const auto actual_path = test_res_dir / "testcase_line_added-actual.txt";
+
+  const auto exec_result = PorcelainStdoutTest::run_cmd(expected_path, actual_path, "-U 0"sv);
+  EXPECT_NE(exec_result.exit_code, 0);
+  // Empty ranges start at the line before them
+  EXPECT_EQ(exec_result.stdout, "@@ -3,0 +4 @@\n+extra line\n"sv);
+  EXPECT_EQ(exec_result.stderr, R"()"sv);
+}
+
+TEST_F(PorcelainStdoutTest, UnifiedIgnoreBlankLines) {
+  const auto expected_path = test_res_dir / "testcase_two_hunks-expected.txt";
+  const auto actual_path = test_res_dir / "testcase_two_hunks-actual.txt";
+
+  const auto exec_result = PorcelainStdoutTest::run_cmd(expected_path, actual_path, "-U 3 -B"sv);
+  EXPECT_NE(exec_result.exit_code, 0);
+  EXPECT_TRUE(exec_result.stdout.contains("--unified cannot be used with --ignore-blank-lines"sv))
+      << exec_result.stdout;
+}
+
+TEST_F(PorcelainStdoutTest, Ndjson) {
+  const auto expected_path = test_res_dir / "testcase_two_hunks-expected.txt";
+  const auto actual_path = test_res_dir / "testcase_two_hunks-actual.txt";
+
+  const auto exec_result = PorcelainStdoutTest::run_cmd(expected_path, actual_path, "--format=ndjson -U 0"sv);
+  EXPECT_NE(exec_result.exit_code, 0);
+  EXPECT_TRUE(exec_result.stdout.starts_with(
+      R"({"type":"hunk","expected_start":2,"expected_count":1,"actual_start":2,"actual_count":1,"lines":[)"
+      R"({"type":"expected_only","expected_line":2,"text":"2"},{"type":"actual_only","actual_line":2,"text":"X"}]})"
+      "\n"
+      R"({"type":"hunk","expected_start":5,"expected_count":1,"actual_start":5,"actual_count":1,"lines":[)"
+      R"({"type":"expected_only","expected_line":5,"text":"5"},{"type":"actual_only","actual_line":5,"text":"Y"}]})"
+      "\n"
+      R"({"type":"summary","has_diff":true,"hunks":2,"expected_only":2,"actual_only":2,"lookahead_exceeded":0,)"
+      R"("budget_exceeded":false,"elapsed_ms":)"sv))
+      << exec_result.stdout;
+  EXPECT_TRUE(exec_result.stdout.ends_with("}\n"sv)) << exec_result.stdout;
+  EXPECT_EQ(exec_result.stderr, R"()"sv);
+}
+
+TEST_F(PorcelainStdoutTest, UnifiedLargeHunk) {
+  const auto tmp_path{std::filesystem::temp_directory_path()};
+  const auto expected_path = tmp_path / "nanodiff-test-unified-large-hunk-expected.txt";
+  const auto actual_path = tmp_path / "nanodiff-test-unified-large-hunk-actual.txt";
+
+  {
+    std::ofstream expected{expected_path};
+    std::ofstream actual{actual_path};
+    ASSERT_TRUE(expected && actual) << "Unable to open temporary files for writing";
+    expected << "first\n";
+    actual << "first\n";
+    for (std::size_t i = 0; i < 5000; ++i) {
+      actual << std::format("line {}\n", i);
+    }
+  }
+
+  const auto exec_result = PorcelainStdoutTest::run_cmd(expected_path, actual_path, "-U 1"sv);
+  std::filesystem::remove(expected_path);
+  std::filesystem::remove(actual_path);
+
+  // The added lines are split into two adjacent hunks, the second of which has no leading context
+  EXPECT_NE(exec_result.exit_code, 0);
+  EXPECT_TRUE(exec_result.stdout.starts_with("@@ -1 +1,4096 @@\n first\n+line 0\n"sv))
+      << exec_result.stdout.substr(0, 200);
+  EXPECT_TRUE(exec_result.stdout.contains("\n+line 4094\n@@ -1,0 +4097,905 @@\n+line 4095\n"sv));
+  EXPECT_TRUE(exec_result.stdout.ends_with("\n+line 4999\n"sv));
+  EXPECT_EQ(exec_result.stderr, R"()"sv);
+}
+
+TEST_F(PorcelainStdoutTest, NdjsonLargeHunk) {
+  const auto tmp_path{std::filesystem::temp_directory_path()};
+  const auto expected_path = tmp_path / "nanodiff-test-ndjson-large-hunk-expected.txt";
+  const auto actual_path = tmp_path / "nanodiff-test-ndjson-large-hunk-actual.txt";
+
+  {
+    std::ofstream expected{expected_path};
+    std::ofstream actual{actual_path};
+    ASSERT_TRUE(expected && actual) << "Unable to open temporary files for writing";
+    expected << "first\n";
+    actual << "first\n";
+    for (std::size_t i = 0; i < 5000; ++i) {
+      actual << std::format("line {}\n", i);
+    }
+  }
+
+  const auto exec_result = PorcelainStdoutTest::run_cmd(expected_path, actual_path, "--format ndjson -U 1"sv);
+  std::filesystem::remove(expected_path);
+  std::filesystem::remove(actual_path);
+
+  // The added lines are split into two hunk records, the second of which has no leading context
+  EXPECT_NE(exec_result.exit_code, 0);
+  EXPECT_TRUE(exec_result.stdout.starts_with(
+      R"({"type":"hunk","expected_start":1,"expected_count":1,"actual_start":1,"actual_count":4096,"lines":[)"
+      R"({"type":"context","expected_line":1,"actual_line":1,"text":"first"},)"sv))
+      << exec_result.stdout.substr(0, 200);
+  EXPECT_TRUE(exec_result.stdout.contains(
+      "\n"
+      R"({"type":"hunk","expected_start":2,"expected_count":0,"actual_start":4097,"actual_count":905,"lines":[)"
+      R"({"type":"actual_only","actual_line":4097,"text":"line 4095"},)"sv));
+  EXPECT_TRUE(exec_result.stdout.contains(R"({"type":"summary","has_diff":true,"hunks":2,"expected_only":0,)"
+                                          R"("actual_only":5000,)"sv));
+  EXPECT_EQ(exec_result.stderr, R"()"sv);
+}
+
+TEST_F(PorcelainStdoutTest, NdjsonLargeHunkTrailingContext) {
+  const auto tmp_path{std::filesystem::temp_directory_path()};
+  const auto expected_path = tmp_path / "nanodiff-test-ndjson-large-hunk-context-expected.txt";
+  const auto actual_path = tmp_path / "nanodiff-test-ndjson-large-hunk-context-actual.txt";
+
+  {
+    std::ofstream expected{expected_path};
+    std::ofstream actual{actual_path};
+    ASSERT_TRUE(expected && actual) << "Unable to open temporary files for writing";
+    expected << "first\nlast\n";
+    actual << "first\n";
+    for (std::size_t i = 0; i < 4095; ++i) {
+      actual << std::format("line {}\n", i);
+    }
+    actual << "last\n";
+  }
+
+  const auto exec_result = PorcelainStdoutTest::run_cmd(expected_path, actual_path, "--format ndjson -U 1"sv);
+  std::filesystem::remove(expected_path);
+  std::filesystem::remove(actual_path);
+
+  // The hunk reaches the size limit at its last change, and still ends with its trailing context
+  EXPECT_NE(exec_result.exit_code, 0);
+  EXPECT_TRUE(exec_result.stdout.starts_with(
+      R"({"type":"hunk","expected_start":1,"expected_count":2,"actual_start":1,"actual_count":4097,"lines":[)"sv))
+      << exec_result.stdout.substr(0, 200);
+  EXPECT_TRUE(exec_result.stdout.contains(
+      R"(,{"type":"context","expected_line":2,"actual_line":4097,"text":"last"}]})"
+      "\n"sv));
+  EXPECT_TRUE(exec_result.stdout.contains(R"({"type":"summary","has_diff":true,"hunks":1,"expected_only":0,)"
+                                          R"("actual_only":4095,)"sv));
+  EXPECT_EQ(exec_result.stderr, R"()"sv);
+}
+
+TEST_F(PorcelainStdoutTest, NdjsonEscaping) {
+  const auto expected_path = test_res_dir / "testcase_json_escaping-expected.txt";
+  const auto actual_path = test_res_dir / "testcase_json_escaping-actual.txt";
+
+  // Invalid UTF-8 is replaced, and valid UTF-8 is written as is
+  const auto exec_result = PorcelainStdoutTest::run_cmd(expected_path, actual_path, "--format ndjson -U 0"sv);
+  EXPECT_NE(exec_result.exit_code, 0);
+  EXPECT_TRUE(exec_result.stdout.starts_with(
+      R"({"type":"hunk","expected_start":1,"expected_count":1,"actual_start":1,"actual_count":1,"lines":[)"
+      R"({"type":"expected_only","expected_line":1,"text":"say \"hi\"\tto C:\\dir\u0001 caf)"
+      "\xc3\xa9"
+      R"("},)"
+      R"({"type":"actual_only","actual_line":1,"text":"say hi \ufffd"}]})"sv))
+      << exec_result.stdout;
+}
+
+TEST_F(PorcelainStdoutTest, Stats) {
+  const auto expected_path = test_res_dir / "testcase_two_hunks-expected.txt";
+  const auto actual_path = test_res_dir / "testcase_two_hunks-actual.txt";
+
+  const auto exec_result = PorcelainStdoutTest::run_cmd(expected_path, actual_path, "--stats=json"sv);
+#ifdef NANODIFF_STATS
+  EXPECT_NE(exec_result.exit_code, 0);
+  EXPECT_EQ(exec_result.stdout, R"(-2
++X
+ 3
+ 4
+-5
++Y
+ 6
+
+)"sv);
+
+  // Allocations and times depend on the standard library and the machine
+  EXPECT_TRUE(exec_result.stderr.starts_with(std::format(
+      R"({{"type":"stats","expected":"{}","actual":"{}","expected_lines":6,"expected_bytes":11,"actual_lines":6,)"
+      R"("actual_bytes":11,"skipped_bytes":4,"buffer_peak_lines":5,"buffer_peak_bytes":5,"buffer_samples":5,)"
+      R"("buffer_total_lines":17,"line_comparisons":8,"hash_probes":4,"allocations":)",
+      expected_path.string(),
+      actual_path.string())))
+      << exec_result.stderr;
+  EXPECT_TRUE(exec_result.stderr.ends_with("}\n"sv)) << exec_result.stderr;
+#else
+  EXPECT_NE(exec_result.exit_code, 0);
+  EXPECT_TRUE(exec_result.stdout.contains("--stats requires nanodiff to be built with NANODIFF_STATS"sv))
+      << exec_result.stdout;
+#endif
+}
+
+TEST_F(PorcelainStdoutTest, Quiet) {
+  const auto expected_path = test_res_dir / "testcase_two_hunks-expected.txt";
+  const auto actual_path = test_res_dir / "testcase_two_hunks-actual.txt";
+
+  const auto exec_result = PorcelainStdoutTest::run_cmd(expected_path, actual_path, "--quiet"sv);
+  EXPECT_NE(exec_result.exit_code, 0);
+  EXPECT_EQ(exec_result.stdout, R"()"sv);
+  EXPECT_EQ(exec_result.stderr, R"()"sv);
+}
+
+TEST_F(PorcelainStdoutTest, QuietSameOutput) {
+  const auto expected_path = test_res_dir / "testcase_same_output-expected.txt";
+  const auto actual_path = test_res_dir / "testcase_same_output-actual.txt";
+
+  const auto exec_result = PorcelainStdoutTest::run_cmd(expected_path, actual_path, "-q"sv);
+  EXPECT_EQ(exec_result.exit_code, 0);
+  EXPECT_EQ(exec_result.stdout, R"()"sv);
+}
+
+TEST_F(PorcelainStdoutTest, Batch) {
+  const auto expected_path = test_res_dir / "testcase_two_hunks-expected.txt";
+  const auto actual_path = test_res_dir / "testcase_two_hunks-actual.txt";
+
+  const auto exec_result = PorcelainStdoutTest::run_cmd_args(
+      std::format("--batch --first -- {} {} {}", expected_path.string(), expected_path.string(), actual_path.string()));
+  EXPECT_NE(exec_result.exit_code, 0);
+
+  EXPECT_EQ(exec_result.stdout,
+            std::format("0\t{0}\t{0}\n1\t{0}\t{1}\n-2\n+X\n", expected_path.string(), actual_path.string()));
+  EXPECT_EQ(exec_result.stderr, R"()"sv);
+}
+
+TEST_F(PorcelainStdoutTest, BatchSameOutput) {
+  const auto expected_path = test_res_dir / "testcase_same_output-expected.txt";
+  const auto actual_path = test_res_dir / "testcase_same_output-actual.txt";
+
+  const auto exec_result = PorcelainStdoutTest::run_cmd(expected_path, actual_path, "--batch --jobs 2"sv);
+  EXPECT_EQ(exec_result.exit_code, 0);
+  EXPECT_EQ(exec_result.stdout, std::format("0\t{}\t{}\n", expected_path.string(), actual_path.string()));
+}
+
+TEST_F(PorcelainStdoutTest, BatchLookaheadLimit) {
+  const auto expected_path = test_res_dir / "testcase_line_moved-expected.txt";
+  const auto actual_path = test_res_dir / "testcase_line_moved-actual.txt";
+
+  const auto exec_result =
+      PorcelainStdoutTest::run_cmd(expected_path, actual_path, "--batch --max-lookahead-lines 2"sv);
+  EXPECT_EQ(exec_result.exit_code, 2);
+
+  EXPECT_EQ(exec_result.stdout,
+            std::format("2\t{}\t{}\n-moved\n 1\n 2\n 3\n+moved\n\n", expected_path.string(), actual_path.string()));
+  EXPECT_TRUE(exec_result.stderr.starts_with("Look-ahead limit reached"sv)) << exec_result.stderr;
+}
+
+TEST_F(PorcelainStdoutTest, BatchManifest) {
+  const auto expected_path = test_res_dir / "testcase_two_hunks-expected.txt";
+  const auto actual_path = test_res_dir / "testcase_two_hunks-actual.txt";
+  const auto missing_path = test_res_dir / "testcase_missing.txt";
+
+  const auto manifest_path = std::filesystem::temp_directory_path() / "nanodiff-test-manifest.tsv";
+  {
+    std::ofstream manifest{manifest_path};
+    ASSERT_TRUE(manifest) << "Unable to open " << manifest_path << " for writing";
+    manifest << std::format("{0}\t{1}\n{1}\t{1}\n{0}\t{2}\n", expected_path.string(), actual_path.string(),
+                            missing_path.string());
+  }
+
+  const auto exec_result = PorcelainStdoutTest::run_cmd_args(std::format("--manifest {} -q", manifest_path.string()));
+  std::filesystem::remove(manifest_path);
+  EXPECT_NE(exec_result.exit_code, 0);
+
+  EXPECT_EQ(exec_result.stdout,
+            std::format("1\t{0}\t{1}\n0\t{1}\t{1}\n1\t{0}\t{2}\n", expected_path.string(), actual_path.string(),
+                        missing_path.string()));
+  EXPECT_TRUE(exec_result.stderr.contains("File not found"sv)) << exec_result.stderr;
+}
+
+TEST_F(PorcelainStdoutTest, Jobs) {
+  const auto expected_path = test_res_dir / "testcase_one_line_changed-expected.txt";
+  const auto actual_path = test_res_dir / "testcase_one_line_changed-actual.txt";
+
+  const auto single_threaded = PorcelainStdoutTest::run_cmd(expected_path, actual_path, "--jobs 1"sv);
+  const auto multi_threaded = PorcelainStdoutTest::run_cmd(expected_path, actual_path, "--jobs 4"sv);
+  EXPECT_NE(multi_threaded.exit_code, 0);
+  EXPECT_EQ(single_threaded.stdout, multi_threaded.stdout);
+}
+
+TEST_F(PorcelainStdoutTest, ReadAhead) {
+  const auto expected_path = test_res_dir / "testcase_line_added-expected.txt";
+  const auto actual_path = test_res_dir / "testcase_line_added-actual.txt";
+
+  const auto direct = PorcelainStdoutTest::run_cmd(expected_path, actual_path);
+  const auto read_ahead = PorcelainStdoutTest::run_cmd(expected_path, actual_path, "--read-ahead 2"sv);
+  EXPECT_NE(read_ahead.exit_code, 0);
+  EXPECT_EQ(direct.stdout, read_ahead.stdout);
+}
+
+TEST_F(PorcelainStdoutTest, IgnoreAllSpace) {
+  const auto expected_path = test_res_dir / "testcase_whitespace-expected.txt";
+  const auto actual_path = test_res_dir / "testcase_whitespace-actual.txt";
+
+  const auto exec_result = PorcelainStdoutTest::run_cmd(expected_path, actual_path, "-w --first"sv);
+  EXPECT_NE(exec_result.exit_code, 0);
+  EXPECT_EQ(exec_result.stdout, "-Hello World\n+hello world  \n"sv);
+  EXPECT_EQ(exec_result.stderr, R"()"sv);
+}
+
+TEST_F(PorcelainStdoutTest, IgnoreAll) {
+  const auto expected_path = test_res_dir / "testcase_whitespace-expected.txt";
+  const auto actual_path = test_res_dir / "testcase_whitespace-actual.txt";
+
+  const auto exec_result = PorcelainStdoutTest::run_cmd(
+      expected_path, actual_path, "--ignore-all-space --ignore-case --ignore-blank-lines"sv);
+  EXPECT_EQ(exec_result.exit_code, 0);
+  EXPECT_EQ(exec_result.stdout, R"()"sv);
+}
+
+TEST_F(PorcelainStdoutTest, NumericTolerance) {
+  const auto expected_path = test_res_dir / "testcase_numeric-expected.txt";
+  const auto actual_path = test_res_dir / "testcase_numeric-actual.txt";
+
+  const auto exec_result =
+      PorcelainStdoutTest::run_cmd(expected_path, actual_path, "--abs-tol 1e-6 --rel-tol 0.01 --first"sv);
+  EXPECT_NE(exec_result.exit_code, 0);
+  EXPECT_EQ(exec_result.stdout, "-version 1.2.3\n+version 1.2.4\n"sv);
+  EXPECT_EQ(exec_result.stderr, R"()"sv);
+}
+
+TEST_F(PorcelainStdoutTest, InvalidTolerance) {
+  const auto expected_path = test_res_dir / "testcase_numeric-expected.txt";
+  const auto actual_path = test_res_dir / "testcase_numeric-actual.txt";
+
+  const auto exec_result = PorcelainStdoutTest::run_cmd(expected_path, actual_path, "--abs-tol -1"sv);
+  EXPECT_NE(exec_result.exit_code, 0);
+  EXPECT_TRUE(exec_result.stdout.contains("must be a non-negative number"sv)) << exec_result.stdout;
+}
+
+TEST_F(PorcelainStdoutTest, Stdin) {
+  const auto expected_path = test_res_dir / "testcase_two_hunks-expected.txt";
+  const auto actual_path = test_res_dir / "testcase_two_hunks-actual.txt";
+
+  const auto exec_result = PorcelainStdoutTest::run_cmd_args(
+      std::format("--first -- {} - <{}", expected_path.string(), actual_path.string()));
+  EXPECT_NE(exec_result.exit_code, 0);
+  EXPECT_EQ(exec_result.stdout, "-2\n+X\n"sv);
+  EXPECT_EQ(exec_result.stderr, R"()"sv);
+}
+
+TEST_F(PorcelainStdoutTest, StdinTwice) {
+  const auto exec_result = PorcelainStdoutTest::run_cmd_args("-- - -"sv);
+  EXPECT_NE(exec_result.exit_code, 0);
+  EXPECT_TRUE(exec_result.stdout.contains("Standard input can only be read once"sv)) << exec_result.stdout;
+}
+
+TEST_F(PorcelainStdoutTest, Fifo) {
+  const auto expected_path = test_res_dir / "testcase_two_hunks-expected.txt";
+  const auto fifo_path = std::filesystem::temp_directory_path() / ".nanodiff-porcelain-test.fifo";
+
+  std::filesystem::remove(fifo_path);
+  ASSERT_EQ(::mkfifo(fifo_path.c_str(), 0600), 0) << "Failed to create FIFO " << fifo_path;
+
+  std::thread writer{[&fifo_path]() { std::ofstream{fifo_path} << "1\nX\n3\n4\n5\n6\n"; }};
+  const auto exec_result = PorcelainStdoutTest::run_cmd(expected_path, fifo_path, "--first"sv);
+  writer.join();
+  std::filesystem::remove(fifo_path);
+
+  EXPECT_NE(exec_result.exit_code, 0);
+  EXPECT_EQ(exec_result.stdout, "-2\n+X\n"sv);
+  EXPECT_EQ(exec_result.stderr, R"()"sv);
+}
+
+TEST_F(PorcelainStdoutTest, FifoReadAheadStaysOpen) {
+  const auto expected_path = test_res_dir / "testcase_two_hunks-expected.txt";
+  const auto fifo_path = std::filesystem::temp_directory_path() / ".nanodiff-porcelain-test-read-ahead.fifo";
+
+  std::filesystem::remove(fifo_path);
+  ASSERT_EQ(::mkfifo(fifo_path.c_str(), 0600), 0) << "Failed to create FIFO " << fifo_path;
+
+  // The writer keeps the FIFO open after the first line, until the command has exited or a long time has passed
+  std::promise<void> exited{};
+  std::thread writer{[&fifo_path, exit_future = exited.get_future()]() {
+    std::ofstream fifo{fifo_path};
+    fifo << "X\n" << std::flush;
+    exit_future.wait_for(std::chrono::seconds{30});
+  }};
+
+  const auto start = std::chrono::steady_clock::now();
+  const auto exec_result = PorcelainStdoutTest::run_cmd(expected_path, fifo_path, "--read-ahead 2 -q"sv);
+  const auto elapsed = std::chrono::steady_clock::now() - start;
+  exited.set_value();
+  writer.join();
+  std::filesystem::remove(fifo_path);
+
+  EXPECT_LT(elapsed, std::chrono::seconds{10});
+  EXPECT_NE(exec_result.exit_code, 0);
   EXPECT_EQ(exec_result.stdout, R"()"sv);
+}
+
+TEST_F(PorcelainStdoutTest, Directory) {
+  const auto exec_result = PorcelainStdoutTest::run_cmd(test_res_dir, test_res_dir);
+  EXPECT_NE(exec_result.exit_code, 0);
+  EXPECT_TRUE(exec_result.stderr.contains("Not a file"sv)) << exec_result.stderr;
+}
+
+TEST_F(PorcelainStdoutTest, Run) {
+  const auto expected_path = test_res_dir / "testcase_two_hunks-expected.txt";
+  const auto actual_path = test_res_dir / "testcase_two_hunks-actual.txt";
+
+  const auto exec_result = PorcelainStdoutTest::run_cmd_args(
+      std::format("--run -- cat {} {}", actual_path.string(), expected_path.string()));
+  EXPECT_NE(exec_result.exit_code, 0);
+  EXPECT_EQ(exec_result.stdout, "-2\n+X\n"sv);
   EXPECT_EQ(exec_result.stderr, R"()"sv);
 }
 
+TEST_F(PorcelainStdoutTest, RunSameOutput) {
+  const auto expected_path = test_res_dir / "testcase_two_hunks-expected.txt";
+
+  const auto exec_result = PorcelainStdoutTest::run_cmd_args(
+      std::format("--run -- cat {} {}", expected_path.string(), expected_path.string()));
+  EXPECT_EQ(exec_result.exit_code, 0);
+  EXPECT_EQ(exec_result.stdout, R"()"sv);
+}
+
+TEST_F(PorcelainStdoutTest, RunCommandFailed) {
+  const auto expected_path = test_res_dir / "testcase_two_hunks-expected.txt";
+
+  const auto exec_result = PorcelainStdoutTest::run_cmd_args(
+      std::format("--run -- sh -c 'cat \"$0\"; exit 3' {} {}", expected_path.string(), expected_path.string()));
+  EXPECT_NE(exec_result.exit_code, 0);
+  EXPECT_EQ(exec_result.stdout, R"()"sv);
+  EXPECT_TRUE(exec_result.stderr.contains("Command exited with status 3"sv)) << exec_result.stderr;
+}
+
+TEST_F(PorcelainStdoutTest, RunCommandFailedIgnoreExitStatus) {
+  const auto expected_path = test_res_dir / "testcase_two_hunks-expected.txt";
+
+  const auto exec_result = PorcelainStdoutTest::run_cmd_args(std::format(
+      "--run --ignore-exit-status -- sh -c 'cat \"$0\"; exit 3' {} {}", expected_path.string(),
+      expected_path.string()));
+  EXPECT_EQ(exec_result.exit_code, 0);
+  EXPECT_EQ(exec_result.stdout, R"()"sv);
+}
+
+TEST_F(PorcelainStdoutTest, RunCommandClosesOutput) {
+  const auto expected_path = test_res_dir / "testcase_two_hunks-expected.txt";
+
+  // The command would keep running long after its output is complete
+  const auto start = std::chrono::steady_clock::now();
+  const auto exec_result = PorcelainStdoutTest::run_cmd_args(std::format(
+      "--run -- sh -c 'cat \"$0\"; exec >&-; sleep 30' {} {}", expected_path.string(), expected_path.string()));
+  EXPECT_LT(std::chrono::steady_clock::now() - start, std::chrono::seconds{10});
+  EXPECT_NE(exec_result.exit_code, 0);
+  EXPECT_TRUE(exec_result.stderr.contains("Command was killed"sv)) << exec_result.stderr;
+}
+
+TEST_F(PorcelainStdoutTest, RunQuiet) {
+  const auto expected_path = test_res_dir / "testcase_two_hunks-expected.txt";
+
+  // The command never exits on its own
+  const auto exec_result = PorcelainStdoutTest::run_cmd_args(std::format("--run -q -- yes {}", expected_path.string()));
+  EXPECT_NE(exec_result.exit_code, 0);
+  EXPECT_EQ(exec_result.stdout, R"()"sv);
+}
+
+TEST_F(PorcelainStdoutTest, RunOutputLimit) {
+  const auto expected_path = test_res_dir / "testcase_two_hunks-expected.txt";
+
+  const auto exec_result = PorcelainStdoutTest::run_cmd_args(
+      std::format("--run --max-output-bytes 100000 -- yes {}", expected_path.string()));
+  EXPECT_NE(exec_result.exit_code, 0);
+  EXPECT_TRUE(exec_result.stderr.contains("Output limit reached"sv)) << exec_result.stderr;
+}
+
+TEST_F(PorcelainStdoutTest, RunDefaultOutputLimit) {
+  const auto expected_path = test_res_dir / "testcase_two_hunks-expected.txt";
+
+  // The expected lines never appear in the output of the command, which never exits on its own
+  const auto start = std::chrono::steady_clock::now();
+  const auto exec_result = PorcelainStdoutTest::run_cmd_args(std::format("--run -- yes {}", expected_path.string()));
+  EXPECT_LT(std::chrono::steady_clock::now() - start, std::chrono::seconds{10});
+  EXPECT_NE(exec_result.exit_code, 0);
+  // The limit is twice the 12 bytes of the expected file plus 1 MiB
+  EXPECT_TRUE(exec_result.stderr.contains("Output limit reached: the command was stopped after writing 1048600 bytes"sv))
+      << exec_result.stderr;
+}
+
 #endif  // defined(__linux__)
 }  // namespace